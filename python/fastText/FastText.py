@@ -51,6 +51,16 @@ class _FastText():
         self.f.getWordVector(b, word)
         return np.array(b)
 
+    def get_word_vectors(self, words, thread=None):
+        """
+        Get the vector representations of a list of words, as the rows
+        of an array. The vectors are computed by thread threads (by
+        default those of the model) without holding the GIL.
+        """
+        out = np.empty((len(words), self.get_dimension()), dtype=np.float32)
+        self.f.getWordVectors(words, out, self._threads(thread))
+        return out
+
     def get_sentence_vector(self, text):
         """
         Given a string, get a single vector represenation. This function
@@ -68,6 +78,16 @@ class _FastText():
         self.f.getSentenceVector(b, text)
         return np.array(b)
 
+    def get_sentence_vectors(self, texts, thread=None):
+        """
+        Get the vectors of a list of lines of text, as the rows of an
+        array, computed as get_sentence_vector does by thread threads.
+        """
+        texts = _check_lines(texts)
+        out = np.empty((len(texts), self.get_dimension()), dtype=np.float32)
+        self.f.getSentenceVectors(texts, out, self._threads(thread))
+        return out
+
     def get_word_id(self, word):
         """
         Given a word, get the word id within the dictionary.
@@ -111,8 +131,14 @@ class _FastText():
         newline, tab, vertical tab) and the control characters carriage
         return, formfeed and the null character.
 
+        Given a list of such lines instead, this returns the list of their
+        labels and the list of their probabilities, computed by the threads
+        of the model without holding the GIL.
+
         If the model is not supervised, this function will throw a ValueError.
         """
+        if isinstance(text, list):
+            return self._predict_batch(text, k)
         if text.find('\n') != -1:
             raise ValueError(
                 "predict processes one line at a time (remove \'\\n\')"
@@ -123,23 +149,47 @@ class _FastText():
         probs = np.exp(np.array(probs))
         return labels, probs
 
+    def _predict_batch(self, texts, k, thread=None):
+        """
+        Predict a list of lines at once, as predict does for each of them.
+        Returns the list of the labels of every line, and the list of
+        their probabilities.
+        """
+        texts = _check_lines(texts)
+        ids = np.empty((len(texts), max(k, 1)), dtype=np.int32)
+        scores = np.empty((len(texts), max(k, 1)), dtype=np.float32)
+        self.f.predictBatch(texts, k, ids, scores, self._threads(thread))
+        labels = self.get_labels()
+        all_labels = []
+        all_probs = []
+        for row, score in zip(ids, scores):
+            n = np.count_nonzero(row >= 0)
+            all_labels.append(tuple(labels[i] for i in row[:n]))
+            all_probs.append(np.exp(score[:n]))
+        return all_labels, all_probs
+
+    def _threads(self, thread):
+        return thread if thread else self.f.getArgs().thread
+
     def get_input_matrix(self):
         """
-        Get a copy of the full input matrix of a Model. This only
+        Get a read-only view of the full input matrix of a Model, which
+        shares its memory; np.array makes a copy of it. This only
         works if the model is not quantized.
         """
         if self.f.isQuant():
             raise ValueError("Can't get quantized Matrix")
-        return np.array(self.f.getInputMatrix())
+        return _view(self.f.getInputMatrix())
 
     def get_output_matrix(self):
         """
-        Get a copy of the full output matrix of a Model. This only
+        Get a read-only view of the full output matrix of a Model, which
+        shares its memory; np.array makes a copy of it. This only
         works if the model is not quantized.
         """
         if self.f.isQuant():
             raise ValueError("Can't get quantized Matrix")
-        return np.array(self.f.getOutputMatrix())
+        return _view(self.f.getOutputMatrix())
 
     def get_words(self, include_freq=False):
         """
@@ -187,11 +237,14 @@ class _FastText():
         thread=None,
         verbose=None,
         dsub=2,
-        qnorm=False
+        qnorm=False,
+        dtype=""
     ):
         """
         Quantize the model reducing the size of the model and
-        it's memory footprint.
+        it's memory footprint. With dtype "fp16" or "bf16", both
+        matrices are stored as 16-bit floats instead of being
+        product quantized.
         """
         a = self.f.getArgs()
         if not epoch:
@@ -204,7 +257,7 @@ class _FastText():
             verbose = a.verbose
         self.f.quantize(
             input, qout, cutoff, retrain, epoch, lr, thread, verbose, dsub,
-            qnorm
+            qnorm, dtype
         )
 
 
@@ -213,6 +266,21 @@ class _FastText():
 # - pretrained vectors
 
 
+def _check_lines(texts):
+    for text in texts:
+        if text.find('\n') != -1:
+            raise ValueError(
+                "predict processes one line at a time (remove \'\\n\')"
+            )
+    return [text + "\n" for text in texts]
+
+
+def _view(matrix):
+    view = np.asarray(matrix)
+    view.flags.writeable = False
+    return view
+
+
 def _parse_model_string(string):
     if string == "cbow":
         return model_name.cbow
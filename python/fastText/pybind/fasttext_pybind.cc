@@ -10,15 +10,38 @@
 #include <args.h>
 #include <fasttext.h>
 #include <matrix.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <real.h>
 #include <vector.h>
 #include <iterator>
 #include <sstream>
+#include <stdexcept>
+#include <string>
 
 namespace py = pybind11;
 
+namespace {
+
+// Batched calls write into an array of the caller, which must hold one
+// C-contiguous row of cols values per item.
+template <typename T>
+T* outputRows(
+    py::array_t<T, py::array::c_style>& out,
+    size_t rows,
+    int64_t cols) {
+  if (out.ndim() != 2 || out.shape(0) != static_cast<int64_t>(rows) ||
+      out.shape(1) != cols) {
+    throw std::invalid_argument(
+        "Output array needs the shape (" + std::to_string(rows) + ", " +
+        std::to_string(cols) + ")!");
+  }
+  return out.mutable_data();
+}
+
+} // namespace
+
 PYBIND11_MODULE(fasttext_pybind, m) {
   py::class_<fasttext::Args>(m, "args")
       .def(py::init<>())
@@ -40,11 +63,18 @@ PYBIND11_MODULE(fasttext_pybind, m) {
       .def_readwrite("minn", &fasttext::Args::minn)
       .def_readwrite("maxn", &fasttext::Args::maxn)
       .def_readwrite("thread", &fasttext::Args::thread)
+      .def_readwrite("batch", &fasttext::Args::batch)
       .def_readwrite("t", &fasttext::Args::t)
       .def_readwrite("label", &fasttext::Args::label)
       .def_readwrite("verbose", &fasttext::Args::verbose)
       .def_readwrite("pretrainedVectors", &fasttext::Args::pretrainedVectors)
+      .def_readwrite("cache", &fasttext::Args::cache)
+      .def_readwrite("dict", &fasttext::Args::dict)
+      .def_readwrite("dictSample", &fasttext::Args::dictSample)
+      .def_readwrite("tokens", &fasttext::Args::tokens)
+      .def_readwrite("metrics", &fasttext::Args::metrics)
       .def_readwrite("saveOutput", &fasttext::Args::saveOutput)
+      .def_readwrite("binaryVectors", &fasttext::Args::binaryVectors)
 
       .def_readwrite("qout", &fasttext::Args::qout)
       .def_readwrite("retrain", &fasttext::Args::retrain)
@@ -81,7 +111,9 @@ PYBIND11_MODULE(fasttext_pybind, m) {
             {sizeof(fasttext::real)});
       });
 
-  py::class_<fasttext::Matrix>(
+  // Held by shared pointers, so that views of the matrices of a model keep
+  // them alive.
+  py::class_<fasttext::Matrix, std::shared_ptr<fasttext::Matrix>>(
       m, "Matrix", py::buffer_protocol(), py::module_local())
       .def(py::init<>())
       .def(py::init<ssize_t, ssize_t>())
@@ -92,7 +124,7 @@ PYBIND11_MODULE(fasttext_pybind, m) {
             py::format_descriptor<fasttext::real>::format(),
             2,
             {m.m_, m.n_},
-            {sizeof(fasttext::real) * m.n_, sizeof(fasttext::real) * (int64_t)1});
+            {sizeof(fasttext::real) * m.stride_, sizeof(fasttext::real) * (int64_t)1});
       });
 
   py::class_<fasttext::FastText>(m, "fasttext")
@@ -101,14 +133,14 @@ PYBIND11_MODULE(fasttext_pybind, m) {
       .def(
           "getInputMatrix",
           [](fasttext::FastText& m) {
-            std::shared_ptr<const fasttext::Matrix> mm = m.getInputMatrix();
-            return *mm.get();
+            return std::const_pointer_cast<fasttext::Matrix>(
+                m.getInputMatrix());
           })
       .def(
           "getOutputMatrix",
           [](fasttext::FastText& m) {
-            std::shared_ptr<const fasttext::Matrix> mm = m.getOutputMatrix();
-            return *mm.get();
+            return std::const_pointer_cast<fasttext::Matrix>(
+                m.getOutputMatrix());
           })
       .def(
           "loadModel",
@@ -180,7 +212,8 @@ PYBIND11_MODULE(fasttext_pybind, m) {
              int thread,
              int verbose,
              int32_t dsub,
-             bool qnorm) {
+             bool qnorm,
+             const std::string dtype) {
             std::shared_ptr<fasttext::Args> qa =
                 std::make_shared<fasttext::Args>();
             qa->input = input;
@@ -193,6 +226,7 @@ PYBIND11_MODULE(fasttext_pybind, m) {
             qa->verbose = verbose;
             qa->dsub = dsub;
             qa->qnorm = qnorm;
+            qa->dtype = dtype;
             m.quantize(qa);
           })
       .def(
@@ -206,6 +240,24 @@ PYBIND11_MODULE(fasttext_pybind, m) {
             m.predict(ioss, k, predictions);
             return predictions;
           })
+      .def(
+          "predictBatch",
+          [](fasttext::FastText& m,
+             const std::vector<std::string>& texts,
+             int32_t k,
+             py::array_t<int32_t, py::array::c_style> labels,
+             py::array_t<fasttext::real, py::array::c_style> scores,
+             int32_t threads) {
+            int32_t* l = outputRows(labels, texts.size(), k);
+            fasttext::real* s = outputRows(scores, texts.size(), k);
+            py::gil_scoped_release release;
+            m.predict(texts, k, l, s, threads);
+          },
+          py::arg("texts"),
+          py::arg("k"),
+          py::arg("labels").noconvert(),
+          py::arg("scores").noconvert(),
+          py::arg("threads"))
       .def(
           "isQuant",
           [](fasttext::FastText& m) {
@@ -231,6 +283,32 @@ PYBIND11_MODULE(fasttext_pybind, m) {
           [](fasttext::FastText& m,
              fasttext::Vector& vec,
              const std::string word) { m.getWordVector(vec, word); })
+      .def(
+          "getWordVectors",
+          [](fasttext::FastText& m,
+             const std::vector<std::string>& words,
+             py::array_t<fasttext::real, py::array::c_style> out,
+             int32_t threads) {
+            fasttext::real* o = outputRows(out, words.size(), m.getDimension());
+            py::gil_scoped_release release;
+            m.getWordVectors(words, o, threads);
+          },
+          py::arg("words"),
+          py::arg("out").noconvert(),
+          py::arg("threads"))
+      .def(
+          "getSentenceVectors",
+          [](fasttext::FastText& m,
+             const std::vector<std::string>& texts,
+             py::array_t<fasttext::real, py::array::c_style> out,
+             int32_t threads) {
+            fasttext::real* o = outputRows(out, texts.size(), m.getDimension());
+            py::gil_scoped_release release;
+            m.getSentenceVectors(texts, o, threads);
+          },
+          py::arg("texts"),
+          py::arg("out").noconvert(),
+          py::arg("threads"))
       .def(
           "getSubwords",
           [](fasttext::FastText& m, const std::string word) {
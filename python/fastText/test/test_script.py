@@ -459,6 +459,30 @@ class TestFastTextPyUnit(TestFastTextPy):
         self.assertTrue(gotError)
 
 
+    # Check that the batched calls give what the single line ones give
+    def test_batch(self):
+        f = load_model(self.output_sup + '.bin')
+        sentences = get_random_words(100, 1, 20)
+        labels, probs = f.predict(sentences, k=3)
+        for i, sentence in enumerate(sentences):
+            l, p = f.predict(sentence, k=3)
+            self.assertEqual(labels[i], l)
+            self.assertTrue(np.allclose(probs[i], p, rtol=1e-04))
+        vectors = f.get_sentence_vectors(sentences)
+        for i, sentence in enumerate(sentences):
+            self.assertTrue(
+                np.allclose(vectors[i], f.get_sentence_vector(sentence))
+            )
+
+        f = load_model(self.output + '.bin')
+        words = get_random_words(100, 1, 20)
+        vectors = f.get_word_vectors(words, thread=4)
+        for i, word in enumerate(words):
+            self.assertTrue(np.allclose(vectors[i], f.get_word_vector(word)))
+        matrix = f.get_input_matrix()
+        self.assertFalse(matrix.flags.writeable)
+        self.assertEqual(matrix.shape[1], f.get_dimension())
+
 class TestFastTextPyIntegration(TestFastTextPy):
     @classmethod
     def setUpClass(cls):
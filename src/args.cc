@@ -30,18 +30,30 @@ Args::Args() {
   minn = 3;
   maxn = 6;
   thread = 12;
+  batch = 0;
   lrUpdateRate = 100;
   t = 1e-4;
   label = "__label__";
   verbose = 2;
   pretrainedVectors = "";
+  cache = "";
+  dict = "";
+  dictSample = 10000000;
+  tokens = 0;
+  metrics = "";
   saveOutput = 0;
+  binaryVectors = 0;
+  nodes = 1;
+  rank = 0;
+  master = "";
+  syncInterval = 1.0;
 
   qout = false;
   retrain = false;
   qnorm = false;
   cutoff = 0;
   dsub = 2;
+  dtype = "";
 }
 
 std::string Args::lossToString(loss_name ln) {
@@ -123,6 +135,8 @@ void Args::parseArgs(const std::vector<std::string>& args) {
       maxn = std::stoi(args[ai + 1]);
     } else if (args[ai] == "-thread") {
       thread = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-batch") {
+      batch = std::stoi(args[ai + 1]);
     } else if (args[ai] == "-t") {
       t = std::stof(args[ai + 1]);
     } else if (args[ai] == "-label") {
@@ -131,8 +145,28 @@ void Args::parseArgs(const std::vector<std::string>& args) {
       verbose = std::stoi(args[ai + 1]);
     } else if (args[ai] == "-pretrainedVectors") {
       pretrainedVectors = std::string(args[ai + 1]);
+    } else if (args[ai] == "-cache") {
+      cache = std::string(args[ai + 1]);
+    } else if (args[ai] == "-dict") {
+      dict = std::string(args[ai + 1]);
+    } else if (args[ai] == "-dictSample") {
+      dictSample = std::stoll(args[ai + 1]);
+    } else if (args[ai] == "-tokens") {
+      tokens = std::stoll(args[ai + 1]);
+    } else if (args[ai] == "-metrics") {
+      metrics = std::string(args[ai + 1]);
+    } else if (args[ai] == "-nodes") {
+      nodes = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-rank") {
+      rank = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-master") {
+      master = std::string(args[ai + 1]);
+    } else if (args[ai] == "-syncInterval") {
+      syncInterval = std::stod(args[ai + 1]);
     } else if (args[ai] == "-saveOutput") {
       saveOutput = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-binaryVectors") {
+      binaryVectors = std::stoi(args[ai + 1]);
     } else if (args[ai] == "-qnorm") {
       qnorm = true; ai--;
     } else if (args[ai] == "-retrain") {
@@ -143,6 +177,13 @@ void Args::parseArgs(const std::vector<std::string>& args) {
     cutoff = std::stoi(args[ai + 1]);
     } else if (args[ai] == "-dsub") {
       dsub = std::stoi(args[ai + 1]);
+    } else if (args[ai] == "-dtype") {
+      dtype = std::string(args[ai + 1]);
+      if (dtype != "fp16" && dtype != "bf16") {
+        std::cerr << "Unknown dtype: " << dtype << std::endl;
+        printHelp();
+        exit(EXIT_FAILURE);
+      }
     } else {
       std::cerr << "Unknown argument: " << args[ai] << std::endl;
       printHelp();
@@ -155,6 +196,12 @@ void Args::parseArgs(const std::vector<std::string>& args) {
     printHelp();
     exit(EXIT_FAILURE);
   }
+  if (nodes > 1 && (master.empty() || rank < 0 || rank >= nodes)) {
+    std::cerr << "Training on several nodes needs -master and a -rank "
+              << "below -nodes." << std::endl;
+    printHelp();
+    exit(EXIT_FAILURE);
+  }
   if (wordNgrams <= 1 && maxn == 0) {
     bucket = 0;
   }
@@ -187,7 +234,9 @@ void Args::printDictionaryHelp() {
     << "  -minn               min length of char ngram [" << minn << "]\n"
     << "  -maxn               max length of char ngram [" << maxn << "]\n"
     << "  -t                  sampling threshold [" << t << "]\n"
-    << "  -label              labels prefix [" << label << "]\n";
+    << "  -label              labels prefix [" << label << "]\n"
+    << "  -dict               reuse the dictionary of this model [" << dict << "]\n"
+    << "  -dictSample         stdin: tokens read to build the dictionary [" << dictSample << "]\n";
 }
 
 void Args::printTrainingHelp() {
@@ -201,8 +250,17 @@ void Args::printTrainingHelp() {
     << "  -neg                number of negatives sampled [" << neg << "]\n"
     << "  -loss               loss function {ns, hs, softmax} [" << lossToString(loss) << "]\n"
     << "  -thread             number of threads [" << thread << "]\n"
+    << "  -batch              skipgram: update each window at once with shared negatives [" << batch << "]\n"
     << "  -pretrainedVectors  pretrained word vectors for supervised learning ["<< pretrainedVectors <<"]\n"
-    << "  -saveOutput         whether output params should be saved [" << saveOutput << "]\n";
+    << "  -cache              tokenized corpus cache, written from -input if missing [" << cache << "]\n"
+    << "  -tokens             stdin: number of tokens to train on, instead of -epoch [" << tokens << "]\n"
+    << "  -metrics            file receiving training metrics as JSON lines [" << metrics << "]\n"
+    << "  -nodes              number of nodes training together [" << nodes << "]\n"
+    << "  -rank               index of this node, 0 coordinates the others [" << rank << "]\n"
+    << "  -master             host:port on which node 0 waits for the others, *:port for any host [" << master << "]\n"
+    << "  -syncInterval       seconds between two averagings of the nodes [" << syncInterval << "]\n"
+    << "  -saveOutput         whether output params should be saved [" << saveOutput << "]\n"
+    << "  -binaryVectors      save binary <output>.bvec instead of <output>.vec [" << binaryVectors << "]\n";
 }
 
 void Args::printQuantizationHelp() {
@@ -212,7 +270,8 @@ void Args::printQuantizationHelp() {
     << "  -retrain            finetune embeddings if a cutoff is applied [" << retrain << "]\n"
     << "  -qnorm              quantizing the norm separately [" << qnorm << "]\n"
     << "  -qout               quantizing the classifier [" << qout << "]\n"
-    << "  -dsub               size of each sub-vector [" << dsub << "]\n";
+    << "  -dsub               size of each sub-vector [" << dsub << "]\n"
+    << "  -dtype              16-bit floats (fp16 or bf16) instead of codes [" << dtype << "]\n";
 }
 
 void Args::save(std::ostream& out) {
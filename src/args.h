@@ -44,17 +44,31 @@ class Args {
     int minn;
     int maxn;
     int thread;
+    int batch;
     double t;
     std::string label;
     int verbose;
     std::string pretrainedVectors;
+    std::string cache;
+    std::string dict;
+    int64_t dictSample;
+    int64_t tokens;
+    std::string metrics;
     int saveOutput;
+    int binaryVectors;
+    // data-parallel training, see Cluster
+    int nodes;
+    int rank;
+    std::string master;
+    double syncInterval;
 
     bool qout;
     bool retrain;
     bool qnorm;
     size_t cutoff;
     size_t dsub;
+    // 16-bit storage of the matrices, "fp16" or "bf16", instead of codes
+    std::string dtype;
 
     void parseArgs(const std::vector<std::string>& args);
     void printHelp();
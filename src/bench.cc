@@ -0,0 +1,543 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "dictionary.h"
+#include "fasttext.h"
+#include "hmatrix.h"
+#include "kernels.h"
+#include "matrix.h"
+#include "model.h"
+#include "nnindex.h"
+#include "productquantizer.h"
+#include "qmatrix.h"
+#include "utils.h"
+#include "vector.h"
+
+using namespace fasttext;
+
+// Every operator new of the process is counted, so that the benchmarks can
+// report the allocations of their hot loops.
+static std::atomic<int64_t> newCalls(0);
+
+void* operator new(size_t size) {
+  newCalls.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size > 0 ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+// heap allocations so far, by operator new or by the aligned matrices
+int64_t allocations() {
+  return newCalls.load(std::memory_order_relaxed) +
+    utils::alignedAllocations();
+}
+
+struct BenchArgs {
+  int32_t dim = 100;
+  int32_t vocab = 50000;
+  int32_t labels = 1000;
+  int64_t tokens = 2000000;
+  int32_t thread = 1;
+  std::string filter;
+  std::string dir = ".";
+};
+
+void printUsage() {
+  BenchArgs a;
+  std::cerr
+    << "usage: fasttext-bench <args>\n\n"
+    << "  -dim       size of the vectors [" << a.dim << "]\n"
+    << "  -vocab     number of words of the synthetic corpora [" << a.vocab << "]\n"
+    << "  -labels    number of labels of the supervised corpus [" << a.labels << "]\n"
+    << "  -tokens    number of tokens of the synthetic corpora [" << a.tokens << "]\n"
+    << "  -thread    threads of the end-to-end runs [" << a.thread << "]\n"
+    << "  -filter    only run the benchmarks whose name contains this\n"
+    << "  -dir       where to write the synthetic corpora [" << a.dir << "]\n"
+    << std::endl;
+}
+
+struct Timing {
+  double seconds;
+  double allocs;
+};
+
+// Calls f until about 0.2 seconds have passed and returns the seconds and
+// the allocations per call.
+Timing measure(const std::function<void()>& f) {
+  f();
+  int64_t n = 1;
+  while (true) {
+    const int64_t allocs = allocations();
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < n; i++) {
+      f();
+    }
+    double t = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    if (t >= 0.2) {
+      return {t / n, double(allocations() - allocs) / n};
+    }
+    n *= 2;
+  }
+}
+
+void report(const std::string& name, Timing timing, double items,
+            const std::string& unit) {
+  std::cout << std::left << std::setw(32) << name << std::right
+            << std::fixed << std::setprecision(1)
+            << std::setw(12) << timing.seconds * 1e9 << " ns/op"
+            << std::setprecision(0)
+            << std::setw(14) << items / timing.seconds << " " << unit << "/s"
+            << std::setprecision(2)
+            << std::setw(10) << timing.allocs << " allocs/op"
+            << std::endl;
+}
+
+bool selected(const BenchArgs& a, const std::string& name) {
+  return a.filter.empty() || name.find(a.filter) != std::string::npos;
+}
+
+// Zipf-distributed words; in the supervised corpus, half of the words of a
+// line are drawn from a slice of the vocabulary that depends on its label.
+void writeCorpus(const std::string& filename, const BenchArgs& a,
+                 bool supervised) {
+  std::ofstream ofs(filename);
+  std::minstd_rand rng(1);
+  std::vector<double> weights(a.vocab);
+  for (int32_t i = 0; i < a.vocab; i++) {
+    weights[i] = 1.0 / (i + 1);
+  }
+  std::discrete_distribution<int32_t> zipf(weights.begin(), weights.end());
+  std::uniform_int_distribution<int32_t> length(5, 30);
+  std::uniform_int_distribution<int32_t> label(0, a.labels - 1);
+  std::uniform_int_distribution<int32_t> coin(0, 1);
+  const int32_t slice = std::max(1, a.vocab / a.labels);
+  std::uniform_int_distribution<int32_t> inSlice(0, slice - 1);
+  int64_t ntokens = 0;
+  while (ntokens < a.tokens) {
+    int32_t l = label(rng), n = length(rng);
+    if (supervised) {
+      ofs << "__label__" << l;
+    }
+    for (int32_t i = 0; i < n; i++) {
+      int32_t w = (supervised && coin(rng)) ?
+        (l * slice + inSlice(rng)) % a.vocab : zipf(rng);
+      ofs << (i > 0 || supervised ? " " : "") << "w" << w;
+    }
+    ofs << "\n";
+    ntokens += n + 1;
+  }
+}
+
+std::shared_ptr<Args> makeArgs(const BenchArgs& a, model_name model,
+                               loss_name loss) {
+  auto args = std::make_shared<Args>();
+  args->dim = a.dim;
+  args->model = model;
+  args->loss = loss;
+  args->thread = a.thread;
+  args->verbose = 0;
+  return args;
+}
+
+std::vector<int64_t> zipfCounts(int32_t n) {
+  std::vector<int64_t> counts(n);
+  for (int32_t i = 0; i < n; i++) {
+    counts[i] = 1000000 / (i + 1) + 1;
+  }
+  return counts;
+}
+
+void benchMatrix(const BenchArgs& a) {
+  Matrix m(a.vocab, a.dim);
+  m.uniform(1.0);
+  Vector v(a.dim);
+  for (int32_t j = 0; j < a.dim; j++) {
+    v[j] = 0.5;
+  }
+  std::minstd_rand rng(1);
+  std::uniform_int_distribution<int64_t> row(0, a.vocab - 1);
+  real sink = 0;
+  if (selected(a, "Matrix::dotRow")) {
+    report("Matrix::dotRow", measure([&]() {
+      sink += m.dotRow(v, row(rng));
+    }), a.dim, "floats");
+  }
+  if (selected(a, "Matrix::addRow")) {
+    report("Matrix::addRow", measure([&]() {
+      m.addRow(v, row(rng), 1e-6);
+    }), a.dim, "floats");
+  }
+  if (selected(a, "Vector::mul")) {
+    Matrix wo(a.labels, a.dim);
+    wo.uniform(1.0);
+    Vector out(a.labels);
+    report("Vector::mul", measure([&]() {
+      out.mul(wo, v);
+    }), double(a.labels) * a.dim, "floats");
+  }
+  if (selected(a, "HMatrix::dotRow") || selected(a, "Vector::mul(fp16)")) {
+    HMatrix h(m, false);
+    if (selected(a, "HMatrix::dotRow")) {
+      report("HMatrix::dotRow", measure([&]() {
+        sink += h.dotRow(v, row(rng));
+      }), a.dim, "floats");
+    }
+    if (selected(a, "Vector::mul(fp16)")) {
+      Matrix wo(a.labels, a.dim);
+      wo.uniform(1.0);
+      HMatrix hwo(wo, false);
+      Vector out(a.labels);
+      report("Vector::mul(fp16)", measure([&]() {
+        out.mul(hwo, v);
+      }), double(a.labels) * a.dim, "floats");
+    }
+  }
+  if (sink == 12345) {
+    std::cerr << sink;
+  }
+}
+
+void benchQuantizer(const BenchArgs& a) {
+  const int32_t n = 4096;
+  Matrix m(n, a.dim);
+  m.uniform(1.0);
+  ProductQuantizer pq(a.dim, 2);
+  pq.train(n, m.data_);
+  std::vector<uint8_t> codes(n * ((a.dim + 1) / 2));
+  pq.compute_codes(m.data_, codes.data(), n);
+  Vector v(a.dim);
+  v.zero();
+  std::vector<real> table(pq.table_size());
+  pq.compute_table(m.data_, table.data());
+  std::minstd_rand rng(1);
+  std::uniform_int_distribution<int32_t> row(0, n - 1);
+  real sink = 0;
+  if (selected(a, "ProductQuantizer::mulcode")) {
+    report("ProductQuantizer::mulcode", measure([&]() {
+      sink += pq.mulcode(v, codes.data(), row(rng), 1.0);
+    }), 1, "codes");
+  }
+  if (selected(a, "ProductQuantizer::mulcode(table)")) {
+    report("ProductQuantizer::mulcode(table)", measure([&]() {
+      sink += pq.mulcode(table.data(), codes.data(), row(rng), 1.0);
+    }), 1, "codes");
+  }
+  if (selected(a, "ProductQuantizer::mulcodes")) {
+    std::vector<real> scores(n);
+    report("ProductQuantizer::mulcodes", measure([&]() {
+      pq.mulcodes(table.data(), codes.data(), n, scores.data());
+      sink += scores[0];
+    }), n, "codes");
+  }
+  if (selected(a, "ProductQuantizer::addcode")) {
+    report("ProductQuantizer::addcode", measure([&]() {
+      pq.addcode(v, codes.data(), row(rng), 1e-6);
+    }), 1, "codes");
+  }
+  if (sink == 12345) {
+    std::cerr << sink;
+  }
+}
+
+// Unit rows drawn around a few hundred directions, like word vectors, and
+// queries near some of them at several norms. The index is checked against
+// an exact scan: its recall of the 10 nearest rows must not depend on the
+// norm of the query.
+void benchIndex(const BenchArgs& a) {
+  if (!selected(a, "NNIndex::search")) {
+    return;
+  }
+  const int32_t k = 10, nprobe = 16, nqueries = 200;
+  std::minstd_rand rng(1);
+  std::normal_distribution<real> normal(0.0, 1.0);
+  Matrix centers(512, a.dim), m(a.vocab, a.dim);
+  for (int64_t i = 0; i < centers.m_ * a.dim; i++) {
+    centers.data_[i] = normal(rng);
+  }
+  std::uniform_int_distribution<int32_t> center(0, 511);
+  for (int32_t i = 0; i < a.vocab; i++) {
+    const int32_t c = center(rng);
+    real norm = 0;
+    for (int32_t j = 0; j < a.dim; j++) {
+      m.at(i, j) = centers.at(c, j) + 0.7 * normal(rng);
+      norm += m.at(i, j) * m.at(i, j);
+    }
+    for (int32_t j = 0; j < a.dim; j++) {
+      m.at(i, j) /= std::sqrt(norm);
+    }
+  }
+  NNIndex index;
+  index.build(m, 2);
+  std::uniform_int_distribution<int32_t> row(0, a.vocab - 1);
+  Matrix queries(nqueries, a.dim);
+  std::vector<std::vector<int32_t>> exact(nqueries);
+  Vector v(a.dim);
+  for (int32_t q = 0; q < nqueries; q++) {
+    const int32_t r = row(rng);
+    for (int32_t j = 0; j < a.dim; j++) {
+      v[j] = m.at(r, j) + 0.3 * normal(rng) / std::sqrt(real(a.dim));
+      queries.at(q, j) = v[j];
+    }
+    std::vector<std::pair<real, int32_t>> heap;
+    for (int32_t i = 0; i < a.vocab; i++) {
+      heap.push_back(std::make_pair(m.dotRow(v, i), i));
+    }
+    std::partial_sort(heap.begin(), heap.begin() + k, heap.end(),
+                      std::greater<std::pair<real, int32_t>>());
+    for (int32_t i = 0; i < k; i++) {
+      exact[q].push_back(heap[i].second);
+    }
+  }
+  std::vector<std::pair<real, int32_t>> found;
+  for (real scale : {0.01, 1.0, 100.0}) {
+    int64_t hits = 0;
+    for (int32_t q = 0; q < nqueries; q++) {
+      for (int32_t j = 0; j < a.dim; j++) {
+        v[j] = queries.at(q, j) * scale;
+      }
+      index.search(v, k, nprobe, found);
+      for (auto& f : found) {
+        hits += std::count(exact[q].begin(), exact[q].end(), f.second);
+      }
+    }
+    std::cout << std::left << std::setw(32) << "NNIndex::search" << std::right
+              << "recall@" << k << " " << std::fixed << std::setprecision(3)
+              << double(hits) / (k * nqueries) << " at norm " << scale
+              << std::endl;
+  }
+  int32_t q = 0;
+  report("NNIndex::search", measure([&]() {
+    for (int32_t j = 0; j < a.dim; j++) {
+      v[j] = queries.at(q, j);
+    }
+    index.search(v, k, nprobe, found);
+    q = (q + 1) % nqueries;
+  }), 1, "queries");
+}
+
+void benchTokenizer(const BenchArgs& a, const std::string& corpus) {
+  if (!selected(a, "Dictionary::getLine")) {
+    return;
+  }
+  auto args = makeArgs(a, model_name::sup, loss_name::softmax);
+  args->input = corpus;
+  Dictionary dict(args);
+  dict.readFromFile(corpus);
+  std::ifstream ifs(corpus);
+  std::stringstream text;
+  text << ifs.rdbuf();
+  const std::string data = text.str();
+  std::minstd_rand rng(1);
+  std::vector<int32_t> words, labels;
+  int64_t ntokens = 0;
+  Timing t = measure([&]() {
+    std::istringstream in(data);
+    ntokens = 0;
+    while (in.peek() != EOF) {
+      ntokens += dict.getLine(in, words, labels, rng);
+    }
+  });
+  report("Dictionary::getLine", t, ntokens, "tokens");
+}
+
+void benchUpdate(const BenchArgs& a) {
+  const std::vector<std::pair<std::string, loss_name>> losses = {
+    {"ns", loss_name::ns}, {"hs", loss_name::hs},
+    {"softmax", loss_name::softmax}};
+  std::minstd_rand rng(1);
+  std::uniform_int_distribution<int32_t> word(0, a.vocab - 1);
+  std::uniform_int_distribution<int32_t> label(0, a.labels - 1);
+  for (auto& l : losses) {
+    const std::string name = "Model::update(" + l.first + ")";
+    if (!selected(a, name)) continue;
+    auto args = makeArgs(a, model_name::sup, l.second);
+    auto wi = std::make_shared<Matrix>(a.vocab, a.dim);
+    auto wo = std::make_shared<Matrix>(a.labels, a.dim);
+    wi->uniform(1.0 / a.dim);
+    wo->zero();
+    Model model(wi, wo, args, 0);
+    model.setTargetCounts(zipfCounts(a.labels));
+    std::vector<int32_t> input(10);
+    report(name, measure([&]() {
+      for (auto& w : input) {
+        w = word(rng);
+      }
+      model.update(input, label(rng), 0.05);
+    }), 1, "examples");
+  }
+}
+
+void benchPredict(const BenchArgs& a) {
+  std::minstd_rand rng(1);
+  std::uniform_int_distribution<int32_t> word(0, a.vocab - 1);
+  std::vector<int32_t> input(10);
+  for (auto& w : input) {
+    w = word(rng);
+  }
+  std::vector<std::pair<real, int32_t>> heap;
+  const std::vector<std::pair<std::string, loss_name>> losses = {
+    {"softmax", loss_name::softmax}, {"hs", loss_name::hs}};
+  for (auto& l : losses) {
+    for (int32_t quant = 0; quant < 3; quant++) {
+      const std::string name = "Model::predict(" + l.first +
+        (quant == 1 ? ",quantized)" : (quant == 2 ? ",fp16)" : ")"));
+      if (!selected(a, name)) continue;
+      auto args = makeArgs(a, model_name::sup, l.second);
+      auto wi = std::make_shared<Matrix>(a.vocab, a.dim);
+      auto wo = std::make_shared<Matrix>(a.labels, a.dim);
+      wi->uniform(1.0);
+      wo->uniform(1.0);
+      Model model(wi, wo, args, 0);
+      model.setTargetCounts(zipfCounts(a.labels), false);
+      if (quant == 2) {
+        model.setHalfPointer(std::make_shared<HMatrix>(*wi, false),
+                             std::make_shared<HMatrix>(*wo, false));
+      } else if (quant) {
+        args->qout = true;
+        auto qwi = std::make_shared<QMatrix>(*wi, 2, true);
+        auto qwo = std::make_shared<QMatrix>(*wo, 2, true);
+        model.quant_ = true;
+        model.setQuantizePointer(qwi, qwo, true);
+      }
+      PredictBuffers buffers(a.dim, a.labels, false);
+      report(name, measure([&]() {
+        heap.clear();
+        model.predict(input, 1, heap, buffers);
+      }), 1, "predictions");
+    }
+  }
+}
+
+void benchTrain(const BenchArgs& a, const std::string& sup,
+                const std::string& unsup) {
+  const std::vector<std::pair<std::string, model_name>> models = {
+    {"supervised", model_name::sup}, {"skipgram", model_name::sg},
+    {"cbow", model_name::cbow}};
+  for (auto& m : models) {
+    const std::string name = "train(" + m.first + ")";
+    if (!selected(a, name) && !selected(a, "predict(batch)")) continue;
+    auto args = makeArgs(a, m.second,
+        m.second == model_name::sup ? loss_name::softmax : loss_name::ns);
+    args->input = m.second == model_name::sup ? sup : unsup;
+    args->output = a.dir + "/fasttext-bench";
+    args->epoch = 1;
+    args->maxn = 0;
+    args->bucket = 0;
+    args->minCount = 1;
+    if (m.second == model_name::sup) {
+      args->lr = 0.1;
+    }
+    FastText fasttext;
+    int64_t allocs = allocations();
+    auto start = std::chrono::steady_clock::now();
+    fasttext.train(args);
+    double t = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    // per token, like the throughput
+    const int64_t ntokens = fasttext.getDictionary()->ntokens();
+    if (selected(a, name)) {
+      report(name, {t / ntokens, double(allocations() - allocs) / ntokens},
+             1, "tokens");
+    }
+    if (m.second != model_name::sup || !selected(a, "predict(batch)")) {
+      continue;
+    }
+    std::ifstream ifs(sup);
+    std::vector<std::string> docs;
+    std::string line;
+    while (std::getline(ifs, line)) {
+      docs.push_back(line + "\n");
+    }
+    std::vector<std::vector<std::pair<real, std::string>>> predictions;
+    allocs = allocations();
+    start = std::chrono::steady_clock::now();
+    fasttext.predict(docs, 1, predictions, a.thread);
+    t = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    report("predict(batch)", {t / docs.size(),
+           double(allocations() - allocs) / docs.size()}, 1, "documents");
+  }
+}
+
+int main(int argc, char** argv) {
+  BenchArgs a;
+  for (int ai = 1; ai < argc; ai += 2) {
+    const std::string arg = argv[ai];
+    if (ai + 1 >= argc) {
+      printUsage();
+      exit(EXIT_FAILURE);
+    }
+    if (arg == "-dim") {
+      a.dim = std::stoi(argv[ai + 1]);
+    } else if (arg == "-vocab") {
+      a.vocab = std::stoi(argv[ai + 1]);
+    } else if (arg == "-labels") {
+      a.labels = std::stoi(argv[ai + 1]);
+    } else if (arg == "-tokens") {
+      a.tokens = std::stoll(argv[ai + 1]);
+    } else if (arg == "-thread") {
+      a.thread = std::stoi(argv[ai + 1]);
+    } else if (arg == "-filter") {
+      a.filter = argv[ai + 1];
+    } else if (arg == "-dir") {
+      a.dir = argv[ai + 1];
+    } else {
+      std::cerr << "Unknown argument: " << arg << std::endl;
+      printUsage();
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (a.vocab < 256 || a.labels < 256) {
+    std::cerr << "-vocab and -labels must be at least 256 to quantize"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  const std::string sup = a.dir + "/fasttext-bench.sup";
+  const std::string unsup = a.dir + "/fasttext-bench.unsup";
+  writeCorpus(sup, a, true);
+  writeCorpus(unsup, a, false);
+
+  std::cout << "kernels: " << kernels::get().name << std::endl;
+  benchMatrix(a);
+  benchQuantizer(a);
+  benchIndex(a);
+  benchTokenizer(a, sup);
+  benchUpdate(a);
+  benchPredict(a);
+  benchTrain(a, sup, unsup);
+
+  remove(sup.c_str());
+  remove(unsup.c_str());
+  return 0;
+}
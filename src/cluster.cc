@@ -0,0 +1,401 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "cluster.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace fasttext {
+
+namespace {
+
+// how long the other nodes keep trying to reach the coordinator
+const int32_t CONNECT_SECONDS = 60;
+
+void setNoDelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}
+
+// master is host:port. The coordinator accepts the connections of the
+// other nodes on that port of host only, or of every interface when host is
+// empty or *; the nodes announce their rank.
+Cluster::Cluster(const std::string& master, int32_t nodes, int32_t rank)
+    : nodes_(nodes), rank_(rank) {
+  const size_t colon = master.rfind(':');
+  if (colon == std::string::npos || colon + 1 == master.size()) {
+    throw std::invalid_argument(master + " is not of the form host:port!");
+  }
+  const std::string host = master.substr(0, colon);
+  const std::string port = master.substr(colon + 1);
+  if (rank_ == 0) {
+    listen(host, port);
+  } else {
+    connect(host, port);
+    send(sockets_[0], &rank_, sizeof(rank_));
+  }
+}
+
+Cluster::~Cluster() {
+  for (int fd : sockets_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+void Cluster::listen(const std::string& host, const std::string& port) {
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  const bool any = host.empty() || host == "*";
+  struct addrinfo* res;
+  if (getaddrinfo(any ? nullptr : host.c_str(), port.c_str(), &hints,
+                  &res) != 0) {
+    throw std::invalid_argument(
+        "Cannot listen on " + host + ":" + port + "!");
+  }
+  int server = -1;
+  for (struct addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+    server = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (server < 0) {
+      continue;
+    }
+    int one = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(server, ai->ai_addr, ai->ai_addrlen) == 0 &&
+        ::listen(server, nodes_) == 0) {
+      break;
+    }
+    close(server);
+    server = -1;
+  }
+  freeaddrinfo(res);
+  if (server < 0) {
+    throw std::runtime_error("Cannot listen on " + host + ":" + port + ": " +
+                             std::strerror(errno));
+  }
+  sockets_.assign(nodes_ - 1, -1);
+  for (int32_t i = 1; i < nodes_; i++) {
+    const int fd = accept(server, nullptr, nullptr);
+    if (fd < 0) {
+      close(server);
+      throw std::runtime_error(
+          std::string("Cannot accept a node: ") + std::strerror(errno));
+    }
+    setNoDelay(fd);
+    int32_t rank;
+    recv(fd, &rank, sizeof(rank));
+    if (rank <= 0 || rank >= nodes_ || sockets_[rank - 1] >= 0) {
+      close(fd);
+      close(server);
+      throw std::runtime_error(
+          "Node of rank " + std::to_string(rank) + " is invalid or duplicate!");
+    }
+    sockets_[rank - 1] = fd;
+  }
+  close(server);
+}
+
+void Cluster::connect(const std::string& host, const std::string& port) {
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  const auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::seconds(CONNECT_SECONDS);
+  while (true) {
+    struct addrinfo* res;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) == 0) {
+      for (struct addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+        const int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+          continue;
+        }
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+          freeaddrinfo(res);
+          setNoDelay(fd);
+          sockets_.assign(1, fd);
+          return;
+        }
+        close(fd);
+      }
+      freeaddrinfo(res);
+    }
+    if (std::chrono::steady_clock::now() > deadline) {
+      throw std::runtime_error("Cannot connect to " + host + ":" + port + "!");
+    }
+    // the coordinator may not be listening yet
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
+void Cluster::send(int fd, const void* data, int64_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error(
+          std::string("Lost a node: ") + std::strerror(errno));
+    }
+    p += n;
+    size -= n;
+  }
+}
+
+void Cluster::recv(int fd, void* data, int64_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t n = ::recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error("Lost a node!");
+    }
+    p += n;
+    size -= n;
+  }
+}
+
+void Cluster::sendRows(int fd, const rows& r, int64_t n) {
+  const int64_t count = r.ids.size();
+  send(fd, &count, sizeof(count));
+  send(fd, r.ids.data(), count * sizeof(int32_t));
+  send(fd, r.values.data(), count * n * sizeof(real));
+}
+
+// Rows of mat sent by a node. Their count and ids are checked against the
+// shape of mat, as a stale or mismatched peer would otherwise make the
+// averaging write out of bounds.
+void Cluster::recvRows(int fd, rows& r, const Matrix& mat) {
+  const int64_t n = mat.n_;
+  int64_t count;
+  recv(fd, &count, sizeof(count));
+  if (count < 0 || count > mat.m_) {
+    throw std::runtime_error(
+        "A node sent " + std::to_string(count) + " rows of a matrix of " +
+        std::to_string(mat.m_) + "!");
+  }
+  r.ids.resize(count);
+  r.values.resize(count * n);
+  recv(fd, r.ids.data(), count * sizeof(int32_t));
+  for (const int32_t id : r.ids) {
+    if (id < 0 || id >= mat.m_) {
+      throw std::runtime_error(
+          "A node sent row " + std::to_string(id) + " of a matrix of " +
+          std::to_string(mat.m_) + "!");
+    }
+  }
+  recv(fd, r.values.data(), count * n * sizeof(real));
+}
+
+// Takes the initial snapshots, and checks that every node trains matrices
+// of the same shapes. They must also start from the same values, which the
+// fixed seed of Matrix::uniform gives for a shared dictionary.
+void Cluster::attach(std::shared_ptr<Matrix> input,
+                     std::shared_ptr<Matrix> output) {
+  parts_ = std::vector<part>(2);
+  parts_[0].matrix = input;
+  parts_[1].matrix = output;
+  int64_t shape[4] = {input->m_, input->n_, output->m_, output->n_};
+  for (auto& p : parts_) {
+    p.snapshot = *p.matrix;
+    p.slot.assign(p.matrix->m_, -1);
+    p.dirty.assign(p.matrix->m_, 0);
+  }
+  if (rank_ > 0) {
+    send(sockets_[0], shape, sizeof(shape));
+    uint8_t ok;
+    recv(sockets_[0], &ok, sizeof(ok));
+    if (!ok) {
+      throw std::invalid_argument(
+          "The nodes do not train matrices of the same shapes!");
+    }
+    return;
+  }
+  uint8_t ok = 1;
+  for (int fd : sockets_) {
+    int64_t other[4];
+    recv(fd, other, sizeof(other));
+    ok = ok && std::equal(shape, shape + 4, other);
+  }
+  for (int fd : sockets_) {
+    send(fd, &ok, sizeof(ok));
+  }
+  if (!ok) {
+    throw std::invalid_argument(
+        "The nodes do not train matrices of the same shapes!");
+  }
+}
+
+// The rows that differ from the snapshot, with their current values. Only
+// the rows marked dirty since the previous round can, and their bytes are
+// cleared before the row is read so that an update racing with the copy
+// marks it again for the next round.
+void Cluster::collect(part& p) {
+  const Matrix& mat = *p.matrix;
+  const int64_t n = mat.n_;
+  p.mine.ids.clear();
+  p.mine.values.clear();
+  for (int64_t i = 0; i < mat.m_; i++) {
+    if (!p.dirty[i]) {
+      continue;
+    }
+    p.dirty[i] = 0;
+    const real* row = mat.row(i);
+    if (std::memcmp(row, p.snapshot.row(i), n * sizeof(real)) != 0) {
+      p.mine.ids.push_back(i);
+      p.mine.values.insert(p.mine.values.end(), row, row + n);
+    }
+  }
+}
+
+// Coordinator: sums the rows sent by one node into average.
+void Cluster::accumulate(part& p, const rows& r) {
+  const int64_t n = p.matrix->n_;
+  for (size_t k = 0; k < r.ids.size(); k++) {
+    const int32_t id = r.ids[k];
+    const real* v = r.values.data() + k * n;
+    if (p.slot[id] < 0) {
+      p.slot[id] = p.average.ids.size();
+      p.average.ids.push_back(id);
+      p.average.values.insert(p.average.values.end(), v, v + n);
+      p.counts.push_back(1);
+    } else {
+      real* a = p.average.values.data() + p.slot[id] * n;
+      for (int64_t j = 0; j < n; j++) {
+        a[j] += v[j];
+      }
+      p.counts[p.slot[id]]++;
+    }
+  }
+}
+
+// Coordinator: turns the sums into averages over all the nodes, those that
+// did not change a row still holding its snapshot.
+void Cluster::average(part& p) {
+  const int64_t n = p.matrix->n_;
+  for (size_t k = 0; k < p.average.ids.size(); k++) {
+    const int32_t id = p.average.ids[k];
+    const real* s = p.snapshot.row(id);
+    const real others = nodes_ - p.counts[k];
+    real* a = p.average.values.data() + k * n;
+    for (int64_t j = 0; j < n; j++) {
+      a[j] = (a[j] + others * s[j]) / nodes_;
+    }
+    p.slot[id] = -1;
+  }
+  p.counts.clear();
+}
+
+// Moves the rows to their averages. What the local threads changed since
+// collect is kept on top of them, so training never has to pause; rows left
+// alone end up exactly equal to the new snapshot, the same on every node.
+void Cluster::apply(part& p) {
+  Matrix& mat = *p.matrix;
+  const int64_t n = mat.n_;
+  for (size_t k = 0; k < p.mine.ids.size(); k++) {
+    p.slot[p.mine.ids[k]] = k;
+  }
+  for (size_t k = 0; k < p.average.ids.size(); k++) {
+    const int32_t id = p.average.ids[k];
+    const real* a = p.average.values.data() + k * n;
+    real* row = mat.row(id);
+    real* s = p.snapshot.row(id);
+    const real* sent = p.slot[id] >= 0 ?
+      p.mine.values.data() + p.slot[id] * n : s;
+    for (int64_t j = 0; j < n; j++) {
+      row[j] = a[j] + (row[j] - sent[j]);
+      s[j] = a[j];
+    }
+  }
+  for (int32_t id : p.mine.ids) {
+    p.slot[id] = -1;
+  }
+}
+
+// One averaging round, which every node enters with the tokens it trained
+// on since the previous one and whether its threads are done. Returns the
+// tokens of all the nodes in the round; stop is set once they are all done.
+int64_t Cluster::sync(int64_t tokens, bool done, bool& stop) {
+  for (auto& p : parts_) {
+    collect(p);
+  }
+  uint8_t flag = done;
+  if (rank_ > 0) {
+    const int fd = sockets_[0];
+    send(fd, &tokens, sizeof(tokens));
+    send(fd, &flag, sizeof(flag));
+    for (auto& p : parts_) {
+      sendRows(fd, p.mine, p.matrix->n_);
+    }
+    recv(fd, &tokens, sizeof(tokens));
+    recv(fd, &flag, sizeof(flag));
+    for (auto& p : parts_) {
+      recvRows(fd, p.average, *p.matrix);
+      apply(p);
+    }
+    stop = flag;
+    return tokens;
+  }
+  for (auto& p : parts_) {
+    p.average.ids.clear();
+    p.average.values.clear();
+    accumulate(p, p.mine);
+  }
+  rows other;
+  for (int fd : sockets_) {
+    int64_t t;
+    uint8_t d;
+    recv(fd, &t, sizeof(t));
+    recv(fd, &d, sizeof(d));
+    tokens += t;
+    flag = flag && d;
+    for (auto& p : parts_) {
+      recvRows(fd, other, *p.matrix);
+      accumulate(p, other);
+    }
+  }
+  for (auto& p : parts_) {
+    average(p);
+  }
+  for (int fd : sockets_) {
+    send(fd, &tokens, sizeof(tokens));
+    send(fd, &flag, sizeof(flag));
+    for (auto& p : parts_) {
+      sendRows(fd, p.average, p.matrix->n_);
+    }
+  }
+  for (auto& p : parts_) {
+    apply(p);
+  }
+  stop = flag;
+  return tokens;
+}
+
+}
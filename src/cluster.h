@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_CLUSTER_H
+#define FASTTEXT_CLUSTER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+#include "real.h"
+
+namespace fasttext {
+
+// Data-parallel training over several nodes. Each node trains on its own
+// shard with the usual lock-free threads, while sync() periodically moves
+// every row changed on any node to the average of the nodes. Node 0 is the
+// coordinator: the others connect to it over TCP, send the rows they
+// changed since the previous round, and get the averaged rows back. Only
+// changed rows travel, so the traffic follows the part of the vocabulary
+// that is updated, not the size of the matrices.
+class Cluster {
+  protected:
+    // some rows of a matrix, with their values one after the other
+    struct rows {
+      std::vector<int32_t> ids;
+      std::vector<real> values;
+    };
+
+    // a trained matrix and its value at the end of the previous round,
+    // which is the same on every node
+    struct part {
+      std::shared_ptr<Matrix> matrix;
+      Matrix snapshot;
+      // one byte per row, set by the training threads when they update it
+      std::vector<uint8_t> dirty;
+      // scratch map from row ids to positions in a rows, -1 elsewhere
+      std::vector<int32_t> slot;
+      // the rows this node changed in the round, as they were sent
+      rows mine;
+      // the new value of every row changed on some node
+      rows average;
+      // coordinator: number of nodes that changed each row of average
+      std::vector<int32_t> counts;
+    };
+
+    int32_t nodes_;
+    int32_t rank_;
+    // on the coordinator one per other node, by rank - 1; else the
+    // coordinator's
+    std::vector<int> sockets_;
+    std::vector<part> parts_;
+
+    void listen(const std::string&, const std::string&);
+    void connect(const std::string&, const std::string&);
+    void send(int, const void*, int64_t);
+    void recv(int, void*, int64_t);
+    void sendRows(int, const rows&, int64_t);
+    void recvRows(int, rows&, const Matrix&);
+
+    void collect(part&);
+    void accumulate(part&, const rows&);
+    void average(part&);
+    void apply(part&);
+
+  public:
+    Cluster(const std::string&, int32_t, int32_t);
+    Cluster(const Cluster&) = delete;
+    Cluster& operator=(const Cluster&) = delete;
+    ~Cluster();
+
+    int32_t rank() const { return rank_; }
+    int32_t nodes() const { return nodes_; }
+
+    void attach(std::shared_ptr<Matrix>, std::shared_ptr<Matrix>);
+    // the dirty bytes of the input (0) or output (1) matrix, see
+    // Model::setDirtyRows
+    uint8_t* dirtyRows(int32_t i) { return parts_[i].dirty.data(); }
+    int64_t sync(int64_t, bool, bool&);
+};
+
+}
+
+#endif
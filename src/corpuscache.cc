@@ -0,0 +1,208 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "corpuscache.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace fasttext {
+
+namespace {
+
+// Size and modification time of a file, or -1 if it cannot be found.
+void statSource(const std::string& filename, int64_t& size, int64_t& time) {
+  struct stat st;
+  if (filename == "-" || stat(filename.c_str(), &st) != 0) {
+    size = -1;
+    time = -1;
+    return;
+  }
+  size = st.st_size;
+  time = st.st_mtime;
+}
+
+void writeString(std::ostream& out, const std::string& s) {
+  const int32_t size = s.size();
+  out.write((char*) &size, sizeof(int32_t));
+  out.write(s.data(), size);
+}
+
+void readString(std::istream& in, std::string& s) {
+  int32_t size;
+  in.read((char*) &size, sizeof(int32_t));
+  s.resize(size);
+  in.read(&s[0], size);
+}
+
+}
+
+CorpusCache::CorpusCache(const std::string& filename,
+                         std::shared_ptr<Args> args)
+  : dict_(std::make_shared<Dictionary>(args)), tokens_(nullptr), size_(0) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  int32_t magic, version;
+  ifs.read((char*) &magic, sizeof(int32_t));
+  ifs.read((char*) &version, sizeof(int32_t));
+  if (magic != FASTTEXT_CACHE_MAGIC_INT32) {
+    throw std::invalid_argument(filename + " is not a corpus cache!");
+  }
+  if (version != FASTTEXT_CACHE_VERSION) {
+    throw std::invalid_argument(
+        filename + " was written by another version, it needs to be rebuilt!");
+  }
+  ifs.read((char*) &minCount_, sizeof(int32_t));
+  ifs.read((char*) &minCountLabel_, sizeof(int32_t));
+  readString(ifs, label_);
+  ifs.read((char*) &model_, sizeof(int32_t));
+  readString(ifs, source_);
+  ifs.read((char*) &sourceSize_, sizeof(int64_t));
+  ifs.read((char*) &sourceTime_, sizeof(int64_t));
+  dict_->load(ifs);
+  ifs.read((char*) &size_, sizeof(int64_t));
+  utils::skipPad(ifs, FASTTEXT_PAGE_SIZE);
+  const int64_t offset = ifs.tellg();
+  ifs.close();
+
+  file_ = std::make_shared<utils::MappedFile>(filename);
+  if (size_ > 0) {
+    tokens_ = (const int32_t*) file_->at(offset, size_ * sizeof(int32_t));
+  }
+}
+
+bool CorpusCache::isCache(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  int32_t magic = 0;
+  ifs.read((char*) &magic, sizeof(int32_t));
+  return ifs.good() && magic == FASTTEXT_CACHE_MAGIC_INT32;
+}
+
+bool CorpusCache::isCurrent(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  int32_t magic = 0, version = 0;
+  ifs.read((char*) &magic, sizeof(int32_t));
+  ifs.read((char*) &version, sizeof(int32_t));
+  return ifs.good() && magic == FASTTEXT_CACHE_MAGIC_INT32 &&
+    version == FASTTEXT_CACHE_VERSION;
+}
+
+// source names the file in is read from, or - for stdin.
+void CorpusCache::save(const std::string& filename, const Dictionary& dict,
+                       const Args& args, std::istream& in,
+                       const std::string& source, int32_t verbose) {
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving!");
+  }
+  const int32_t magic = FASTTEXT_CACHE_MAGIC_INT32;
+  const int32_t version = FASTTEXT_CACHE_VERSION;
+  const int32_t minCount = args.minCount;
+  const int32_t minCountLabel = args.minCountLabel;
+  const int32_t model = static_cast<int32_t>(args.model);
+  int64_t sourceSize, sourceTime;
+  statSource(source, sourceSize, sourceTime);
+  ofs.write((char*) &magic, sizeof(int32_t));
+  ofs.write((char*) &version, sizeof(int32_t));
+  ofs.write((char*) &minCount, sizeof(int32_t));
+  ofs.write((char*) &minCountLabel, sizeof(int32_t));
+  writeString(ofs, args.label);
+  ofs.write((char*) &model, sizeof(int32_t));
+  writeString(ofs, source);
+  ofs.write((char*) &sourceSize, sizeof(int64_t));
+  ofs.write((char*) &sourceTime, sizeof(int64_t));
+  dict.save(ofs);
+  const int64_t sizePos = ofs.tellp();
+  int64_t size = 0;
+  ofs.write((char*) &size, sizeof(int64_t));
+  utils::pad(ofs, FASTTEXT_PAGE_SIZE);
+
+  const size_t BUFFER_SIZE = 1 << 16;
+  std::vector<int32_t> buffer;
+  buffer.reserve(BUFFER_SIZE);
+  span token;
+  std::string scratch;
+  while (dict.readToken(in, token, scratch)) {
+    int32_t wid = dict.getId(token);
+    if (wid < 0) {
+      wid = (token == Dictionary::EOS) ? OOV_EOS : OOV;
+    }
+    buffer.push_back(wid);
+    if (buffer.size() == BUFFER_SIZE) {
+      ofs.write((char*) buffer.data(), buffer.size() * sizeof(int32_t));
+      size += buffer.size();
+      buffer.clear();
+      if (verbose > 1 && size % 1000000 < BUFFER_SIZE) {
+        std::cerr << "\rCached " << size / 1000000 << "M words" << std::flush;
+      }
+    }
+  }
+  ofs.write((char*) buffer.data(), buffer.size() * sizeof(int32_t));
+  size += buffer.size();
+  ofs.seekp(sizePos);
+  ofs.write((char*) &size, sizeof(int64_t));
+  ofs.close();
+  if (verbose > 0) {
+    std::cerr << "\rCached " << size / 1000000 << "M words" << std::endl;
+  }
+}
+
+std::shared_ptr<Dictionary> CorpusCache::getDictionary() const {
+  return dict_;
+}
+
+// Whether the cache can stand for args.input: it was built from that very
+// file, unchanged since, with the same dictionary options.
+bool CorpusCache::matchesArgs(const Args& args) const {
+  if (minCount_ != args.minCount || minCountLabel_ != args.minCountLabel ||
+      label_ != args.label || model_ != static_cast<int32_t>(args.model) ||
+      source_ != args.input || sourceSize_ < 0) {
+    return false;
+  }
+  int64_t size, time;
+  statSource(args.input, size, time);
+  return size == sourceSize_ && time == sourceTime_;
+}
+
+bool CorpusCache::matchesDictionary(const Dictionary& dict) const {
+  if (dict.nwords() != dict_->nwords() || dict.nlabels() != dict_->nlabels()) {
+    return false;
+  }
+  for (int32_t i = 0; i < dict.nwords() + dict.nlabels(); i++) {
+    if (dict.getWord(i) != dict_->getWord(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Position of the first line start at or after pos.
+int64_t CorpusCache::nextLine(int64_t pos) const {
+  if (pos <= 0) {
+    return 0;
+  }
+  const int32_t eos = dict_->getId(Dictionary::EOS);
+  int64_t i = pos - 1;
+  while (i < size_ && tokens_[i] != eos && tokens_[i] != OOV_EOS) {
+    i++;
+  }
+  return std::min(i + 1, size_);
+}
+
+int64_t CorpusCache::shard(int32_t i, int32_t n) const {
+  return nextLine(i * size_ / n);
+}
+
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_CORPUSCACHE_H
+#define FASTTEXT_CORPUSCACHE_H
+
+#define FASTTEXT_CACHE_VERSION 2
+#define FASTTEXT_CACHE_MAGIC_INT32 793712315
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "dictionary.h"
+#include "utils.h"
+
+namespace fasttext {
+
+// A corpus tokenized once against a dictionary: the options and the file it
+// was built from, the dictionary itself, followed by one int32 per token read
+// by Dictionary::readWord. In-vocabulary tokens are stored as their id, the
+// others as OOV (or OOV_EOS for an out-of-vocabulary end of line). The token
+// stream starts on a page boundary and is memory-mapped; shards for any
+// number of threads are cut at the end-of-line markers when the cache is
+// read.
+class CorpusCache {
+  protected:
+    std::shared_ptr<Dictionary> dict_;
+    std::shared_ptr<utils::MappedFile> file_;
+    const int32_t* tokens_;
+    int64_t size_;
+    std::vector<int64_t> shards_;
+
+    int32_t minCount_;
+    int32_t minCountLabel_;
+    std::string label_;
+    int32_t model_;
+    // path, size and modification time of the tokenized file, -1 for stdin
+    std::string source_;
+    int64_t sourceSize_;
+    int64_t sourceTime_;
+
+  public:
+    static const int32_t OOV = -1;
+    static const int32_t OOV_EOS = -2;
+
+    CorpusCache(const std::string&, std::shared_ptr<Args>);
+
+    static bool isCache(const std::string&);
+    static bool isCurrent(const std::string&);
+    static void save(const std::string&, const Dictionary&, const Args&,
+                     std::istream&, const std::string&, int32_t);
+
+    std::shared_ptr<Dictionary> getDictionary() const;
+    bool matchesArgs(const Args&) const;
+    bool matchesDictionary(const Dictionary&) const;
+
+    const int32_t* data() const { return tokens_; }
+    int64_t size() const { return size_; }
+    int64_t shard(int32_t, int32_t) const;
+    int64_t nextLine(int64_t) const;
+};
+
+}
+
+#endif
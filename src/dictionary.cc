@@ -16,37 +16,173 @@
 #include <algorithm>
 #include <iterator>
 #include <cmath>
+#include <cstring>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "corpuscache.h"
+#include "utils.h"
 
 namespace fasttext {
+
+namespace {
+
+// Read-only streambuf over a block of memory, so that the counting threads
+// tokenize their shard with the very same readWord as the sequential path.
+class membuf : public std::streambuf {
+  public:
+    membuf(char* begin, char* end) {
+      setg(begin, begin, end);
+    }
+};
+
+// ' ', '\n', '\r', '\t', '\v', '\f' and '\0', as a bit set over [0, 32]
+const uint64_t SEPARATORS = (1ull << ' ') | (1ull << '\n') | (1ull << '\r') |
+  (1ull << '\t') | (1ull << '\v') | (1ull << '\f') | 1ull;
+
+inline bool isSeparator(char c) {
+  return uint8_t(c) <= ' ' && ((SEPARATORS >> uint8_t(c)) & 1);
+}
+
+const uint32_t FNV_OFFSET = 2166136261;
+const uint32_t FNV_PRIME = 16777619;
+
+// The bytes are sign-extended as chars, as they always were: changing that
+// would change the ids of the word n-gram buckets of existing models.
+inline uint32_t hashBytes(uint32_t h, const char* p, const char* e) {
+  for (; p < e; p++) {
+    h = (h ^ uint32_t(*p)) * FNV_PRIME;
+  }
+  return h;
+}
+
+// First separator in [p, e), or e. Only bytes up to ' ' can be separators,
+// so 16 bytes at a time are screened for those before testing them exactly.
+inline const char* findSeparator(const char* p, const char* e) {
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(' ');
+  for (; e - p >= 16; p += 16) {
+    const __m128i x = _mm_loadu_si128((const __m128i*) p);
+    uint32_t mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_min_epu8(x, space), x));
+    while (mask != 0) {
+      const int32_t i = __builtin_ctz(mask);
+      if (isSeparator(p[i])) {
+        return p + i;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  while (p < e && !isSeparator(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// Gives access to the get area of any streambuf, so that tokens are scanned
+// in place in the stream's buffer instead of one sbumpc() at a time.
+struct getarea : public std::streambuf {
+  static char* begin(std::streambuf& sb) {
+    return (sb.*(&getarea::gptr))();
+  }
+  static char* end(std::streambuf& sb) {
+    return (sb.*(&getarea::egptr))();
+  }
+  static void consume(std::streambuf& sb, const char* p) {
+    (sb.*(&getarea::gbump))(int(p - begin(sb)));
+  }
+};
+
+}
+
   const std::string Dictionary::EOS = "</s>";
 
   Dictionary::Dictionary(std::shared_ptr<Args> args) :
-    args_(args), word2int_(MAX_VOCAB_SIZE, -1), nwords_(0), nlabels_(0), ntokens_(0), pruneidx_size_(-1) {}
+    args_(args), size_(0), nwords_(0), nlabels_(0), ntokens_(0),
+    pruneidx_size_(-1) {
+    if (args_->wordNgrams > MAX_WORD_NGRAMS) {
+      throw std::invalid_argument(
+          "-wordNgrams is at most " + std::to_string(MAX_WORD_NGRAMS));
+    }
+    resizeIndex(0);
+  }
 
   int32_t Dictionary::find(const std::string& w) const {
     return find(w, hash(w));
   }
 
   int32_t Dictionary::find(const std::string& w, uint32_t h) const {
-    int32_t id = h % MAX_VOCAB_SIZE;
-    while (word2int_[id] != -1 && words_[word2int_[id]].word != w) {
-      id = (id + 1) % MAX_VOCAB_SIZE;
+    return find(w.data(), w.size(), h);
+  }
+
+  int32_t Dictionary::find(const char* w, size_t size, uint32_t h) const {
+    const uint32_t mask = word2int_.size() - 1;
+    uint32_t id = h & mask;
+    while (word2int_[id].id != -1) {
+      if (word2int_[id].hash == h) {
+        const std::string& word = words_[word2int_[id].id].word;
+        if (word.size() == size && std::memcmp(word.data(), w, size) == 0) {
+          break;
+        }
+      }
+      id = (id + 1) & mask;
     }
     return id;
   }
 
+  // Sizes the index to the smallest power of two keeping the load factor of
+  // n entries at or below 1/2, and re-inserts the current slots.
+  void Dictionary::resizeIndex(int64_t n) {
+    int64_t capacity = MIN_INDEX_SIZE;
+    while (capacity < 2 * n) {
+      capacity *= 2;
+    }
+    std::vector<slot> old(capacity, slot{0, -1});
+    std::swap(old, word2int_);
+    const uint32_t mask = capacity - 1;
+    for (const auto& s : old) {
+      if (s.id == -1) continue;
+      uint32_t id = s.hash & mask;
+      while (word2int_[id].id != -1) {
+        id = (id + 1) & mask;
+      }
+      word2int_[id] = s;
+    }
+  }
+
+  void Dictionary::rebuildIndex() {
+    word2int_.clear();
+    resizeIndex(words_.size());
+    for (int32_t i = 0; i < words_.size(); i++) {
+      uint32_t h = hash(words_[i].word);
+      word2int_[find(words_[i].word, h)] = slot{h, i};
+    }
+  }
+
   void Dictionary::add(const std::string& w) {
-    int32_t h = find(w);
+    add(span{w.data(), w.size(), hash(w)});
+  }
+
+  // Only new entries copy the token.
+  void Dictionary::add(const span& w) {
+    int32_t h = find(w.data, w.size, w.hash);
     ntokens_++;
-    if (word2int_[h] == -1) {
+    if (word2int_[h].id == -1) {
       entry e;
-      e.word = w;
+      e.word.assign(w.data, w.size);
       e.count = 1;
-      e.type = getType(w);
+      e.type = getType(e.word);
       words_.push_back(e);
-      word2int_[h] = size_++;
+      word2int_[h] = slot{w.hash, size_++};
+      if (2 * int64_t(size_) > word2int_.size()) {
+        resizeIndex(size_);
+      }
     } else {
-      words_[word2int_[h]].count++;
+      words_[word2int_[h].id].count++;
     }
   }
 
@@ -62,6 +198,16 @@ namespace fasttext {
     return ntokens_;
   }
 
+  // Rows of the input matrix after the words, one per hashed feature that
+  // getLine emits: the word n-grams of supervised models. Character n-grams
+  // are not computed, so -minn and -maxn take no rows.
+  int32_t Dictionary::nbuckets() const {
+    if (args_->model != model_name::sup || args_->wordNgrams <= 1) {
+      return 0;
+    }
+    return args_->bucket;
+  }
+
   bool Dictionary::discard(int32_t id, real rand) const {
     assert(id >= 0);
     assert(id < nwords_);
@@ -71,12 +217,16 @@ namespace fasttext {
 
   int32_t Dictionary::getId(const std::string& w, uint32_t h) const {
     int32_t id = find(w, h);
-    return word2int_[id];
+    return word2int_[id].id;
   }
 
   int32_t Dictionary::getId(const std::string& w) const {
     int32_t h = find(w);
-    return word2int_[h];
+    return word2int_[h].id;
+  }
+
+  int32_t Dictionary::getId(const span& w) const {
+    return word2int_[find(w.data, w.size, w.hash)].id;
   }
 
   entry_type Dictionary::getType(id_t id) const {
@@ -89,6 +239,13 @@ namespace fasttext {
     return (w.find(args_->label) == 0) ? entry_type::label : entry_type::word;
   }
 
+  entry_type Dictionary::getType(const span& w) const {
+    const std::string& prefix = args_->label;
+    return (w.size >= prefix.size() &&
+            std::memcmp(w.data, prefix.data(), prefix.size()) == 0) ?
+      entry_type::label : entry_type::word;
+  }
+
 
   std::string Dictionary::getWord(int32_t id) const {
     assert(id >= 0);
@@ -97,45 +254,107 @@ namespace fasttext {
   }
 
   uint32_t Dictionary::hash(const std::string& str) const {
-    uint32_t h = 2166136261;
-    for (size_t i = 0; i < str.size(); i++) {
-      h = h ^ uint32_t(str[i]);
-      h = h * 16777619;
+    return hashBytes(FNV_OFFSET, str.data(), str.data() + str.size());
+  }
+
+  bool Dictionary::readWord(std::istream& in, std::string& word) const {
+    span token;
+    if (!readToken(in, token, word)) {
+      return false;
     }
-    return h;
+    if (token.data != word.data()) {
+      word.assign(token.data, token.size);
+    }
+    return true;
   }
 
-  bool Dictionary::readWord(std::istream& in, std::string& word) const
-  {
-    char c;
+  // Tokens are runs of non-separators; a newline is a token of its own, EOS.
+  // A newline ending a token is left in the stream, for the next call.
+  bool Dictionary::readToken(std::istream& in, span& token,
+                             std::string& scratch) const {
+    static const uint32_t eosHash = hashBytes(
+        FNV_OFFSET, EOS.data(), EOS.data() + EOS.size());
     std::streambuf& sb = *in.rdbuf();
-    word.clear();
-    while ((c = sb.sbumpc()) != EOF) {
-      if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
-          c == '\f' || c == '\0') {
-        if (word.empty()) {
+    uint32_t h = FNV_OFFSET;
+    // the beginning of the token, read before a refill, is in scratch
+    bool partial = false;
+    scratch.clear();
+    while (true) {
+      const char* p = getarea::begin(sb);
+      const char* e = getarea::end(sb);
+      if (p == e) {
+        if (sb.sgetc() == EOF) {
+          break;
+        }
+        p = getarea::begin(sb);
+        e = getarea::end(sb);
+      }
+      if (p == e) {
+        // unbuffered stream, read one character at a time
+        const char c = sb.sbumpc();
+        if (!isSeparator(c)) {
+          scratch.push_back(c);
+          h = hashBytes(h, &c, &c + 1);
+          partial = true;
+          continue;
+        }
+        if (partial) {
           if (c == '\n') {
-            word += EOS;
+            sb.sungetc();
+          }
+          token = span{scratch.data(), scratch.size(), h};
+          return true;
+        }
+        if (c == '\n') {
+          token = span{EOS.data(), EOS.size(), eosHash};
+          return true;
+        }
+        continue;
+      }
+      if (!partial) {
+        while (p < e && isSeparator(*p)) {
+          if (*p == '\n') {
+            getarea::consume(sb, p + 1);
+            token = span{EOS.data(), EOS.size(), eosHash};
             return true;
           }
+          p++;
+        }
+        if (p == e) {
+          getarea::consume(sb, e);
           continue;
-        } else {
-          if (c == '\n')
-            sb.sungetc();
-          return true;
         }
       }
-      word.push_back(c);
+      const char* q = findSeparator(p, e);
+      h = hashBytes(h, p, q);
+      if (q == e) {
+        scratch.append(p, e);
+        partial = true;
+        getarea::consume(sb, e);
+        continue;
+      }
+      if (partial) {
+        scratch.append(p, q);
+        token = span{scratch.data(), scratch.size(), h};
+      } else {
+        token = span{p, size_t(q - p), h};
+      }
+      getarea::consume(sb, *q == '\n' ? q : q + 1);
+      return true;
     }
     // trigger eofbit
     in.get();
-    return !word.empty();
+    if (partial) {
+      token = span{scratch.data(), scratch.size(), h};
+    }
+    return partial;
   }
 
   void Dictionary::readFromFile(std::istream& in) {
-    std::string word;
+    span word;
+    std::string scratch;
     int64_t minThreshold = 1;
-    while (readWord(in, word)) {
+    while (readToken(in, word, scratch)) {
       add(word);
       if (ntokens_ % 1000000 == 0 && args_->verbose > 1) {
         std::cerr << "\rRead " << ntokens_  / 1000000 << "M words" << std::flush;
@@ -145,6 +364,112 @@ namespace fasttext {
         threshold(minThreshold, minThreshold);
       }
     }
+    finalize();
+  }
+
+  // Counts the file with args_->thread threads, each one tokenizing a byte
+  // range that starts and ends on a line boundary. Since every whitespace
+  // run separates tokens the same way wherever the file is cut, merging the
+  // shards in file order gives the same entries, counts and first-occurrence
+  // order as the sequential pass, and thus the same words_ after threshold.
+  void Dictionary::readFromFile(const std::string& filename) {
+    std::ifstream ifs(filename);
+    if (!ifs.is_open()) {
+      throw std::invalid_argument(filename + " cannot be opened for reading!");
+    }
+    const int32_t nthreads = std::max(args_->thread, 1);
+    if (nthreads == 1) {
+      readFromFile(ifs);
+      return;
+    }
+    const int64_t size = utils::size(ifs);
+    std::vector<int64_t> offsets(nthreads + 1, size);
+    for (int32_t i = 0; i < nthreads; i++) {
+      offsets[i] = utils::seekLine(ifs, i * size / nthreads);
+    }
+    ifs.close();
+
+    std::atomic<int64_t> progress(0);
+    std::vector<std::shared_ptr<Dictionary>> shards;
+    std::vector<std::thread> threads;
+    for (int32_t i = 0; i < nthreads; i++) {
+      shards.push_back(std::make_shared<Dictionary>(args_));
+    }
+    for (int32_t i = 0; i < nthreads; i++) {
+      threads.push_back(std::thread([&, i]() {
+        shards[i]->countShard(filename, offsets[i], offsets[i + 1], progress);
+      }));
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+      it->join();
+    }
+    int64_t minThreshold = 1;
+    for (int32_t i = 0; i < nthreads; i++) {
+      merge(*shards[i]);
+      shards[i].reset();
+      while (size_ > 0.75 * MAX_VOCAB_SIZE) {
+        minThreshold++;
+        threshold(minThreshold, minThreshold);
+      }
+    }
+    finalize();
+  }
+
+  void Dictionary::countShard(const std::string& filename, int64_t begin,
+                              int64_t end, std::atomic<int64_t>& progress) {
+    const int64_t BLOCK_SIZE = 1 << 22;
+    std::ifstream ifs(filename);
+    utils::seek(ifs, begin);
+    std::vector<char> buffer;
+    span word;
+    std::string scratch;
+    int64_t pos = begin;
+    size_t carry = 0;
+    while (pos < end) {
+      const int64_t n = std::min(BLOCK_SIZE, end - pos);
+      buffer.resize(carry + n);
+      ifs.read(buffer.data() + carry, n);
+      pos += n;
+      // only tokenize up to the last separator, unless the shard is over
+      size_t cut = buffer.size();
+      if (pos < end) {
+        while (cut > 0 && !isSeparator(buffer[cut - 1])) {
+          cut--;
+        }
+      }
+      membuf sb(buffer.data(), buffer.data() + cut);
+      std::istream in(&sb);
+      const int64_t before = ntokens_;
+      while (readToken(in, word, scratch)) {
+        add(word);
+      }
+      int64_t total = (progress += ntokens_ - before);
+      if (args_->verbose > 1 && begin == 0) {
+        std::cerr << "\rRead " << total / 1000000 << "M words" << std::flush;
+      }
+      carry = buffer.size() - cut;
+      memmove(buffer.data(), buffer.data() + cut, carry);
+    }
+  }
+
+  void Dictionary::merge(const Dictionary& other) {
+    for (const auto& e : other.words_) {
+      uint32_t hw = hash(e.word);
+      int32_t h = find(e.word, hw);
+      if (word2int_[h].id == -1) {
+        words_.push_back(e);
+        word2int_[h] = slot{hw, size_++};
+        if (2 * int64_t(size_) > word2int_.size()) {
+          resizeIndex(size_);
+        }
+      } else {
+        words_[word2int_[h].id].count += e.count;
+      }
+    }
+    ntokens_ += other.ntokens_;
+  }
+
+  void Dictionary::finalize() {
     threshold(args_->minCount, args_->minCountLabel);
     initTableDiscard();
     if (args_->verbose > 0) {
@@ -172,13 +497,12 @@ namespace fasttext {
     size_ = 0;
     nwords_ = 0;
     nlabels_ = 0;
-    std::fill(word2int_.begin(), word2int_.end(), -1);
     for (auto it = words_.begin(); it != words_.end(); ++it) {
-      int32_t h = find(it->word);
-      word2int_[h] = size_++;
+      size_++;
       if (it->type == entry_type::word) nwords_++;
       if (it->type == entry_type::label) nlabels_++;
     }
+    rebuildIndex();
   }
 
 
@@ -202,14 +526,14 @@ namespace fasttext {
                               std::vector<int32_t>& words,
                               std::minstd_rand& rng) const {
     std::uniform_real_distribution<> uniform(0, 1);
-    std::string token;
+    span token;
+    std::string scratch;
     int32_t ntokens = 0;
 
     reset(in);
     words.clear();
-    while (readWord(in, token)) {
-      int32_t h = find(token);
-      int32_t wid = word2int_[h];
+    while (readToken(in, token, scratch)) {
+      int32_t wid = getId(token);
       if (wid < 0) continue;
 
       ntokens++;
@@ -225,36 +549,105 @@ namespace fasttext {
                               std::vector<int32_t>& words,
                               std::vector<int32_t>& labels,
                               std::minstd_rand& rng) const {
-    std::string token;
+    span token;
+    std::string scratch;
     int32_t ntokens = 0;
+    const int32_t n = nbuckets() > 0 ? args_->wordNgrams : 1;
+    // hashes of the n-grams ending at the previous word, by length minus one
+    uint64_t ngrams[MAX_WORD_NGRAMS];
+    int32_t window = 0;
 
     reset(in);
     words.clear();
     labels.clear();
-    while (readWord(in, token)) {
-      uint32_t h = hash(token);
-      int32_t wid = getId(token, h);
-      entry_type type = wid < 0 ? getType(token) : getType(wid);
+    while (readToken(in, token, scratch)) {
+      int32_t wid = getId(token);
+      entry_type type = wid >= 0 ? getType(wid) : getType(token);
 
       ntokens++;
-      if (type == entry_type::word) {
+      if (type == entry_type::word && wid >= 0) {
         words.push_back(wid);
       } else if (type == entry_type::label && wid >= 0) {
         labels.push_back(wid - nwords_);
       }
+      // Word n-grams, out-of-vocabulary words included, hashed as a rolling
+      // polynomial of the word hashes while the line is read. The 32-bit
+      // hashes are sign-extended, which keeps the buckets of existing models.
+      if (n > 1 && type == entry_type::word) {
+        const uint64_t h = int32_t(token.hash);
+        for (int32_t d = window; d > 0; d--) {
+          ngrams[d] = ngrams[d - 1] * 116049371 + h;
+          pushHash(words, ngrams[d] % args_->bucket);
+        }
+        ngrams[0] = h;
+        window = std::min(window + 1, n - 1);
+      }
       if (token == EOS) break;
     }
     return ntokens;
   }
 
+  // Same as the stream versions, reading token ids from a cache built
+  // against this dictionary; pos wraps around at the end like reset().
+  int32_t Dictionary::getLine(const CorpusCache& cache, int64_t& pos,
+                              std::vector<int32_t>& words,
+                              std::minstd_rand& rng) const {
+    std::uniform_real_distribution<> uniform(0, 1);
+    const int32_t* tokens = cache.data();
+    const int64_t size = cache.size();
+    const int32_t eos = getId(EOS);
+    int32_t ntokens = 0;
+
+    if (pos >= size) pos = 0;
+    words.clear();
+    while (pos < size) {
+      int32_t wid = tokens[pos++];
+      if (wid < 0) continue;
+
+      ntokens++;
+      if (getType(wid) == entry_type::word && !discard(wid, uniform(rng))) {
+        words.push_back(wid);
+      }
+      if (ntokens > MAX_LINE_SIZE || wid == eos) break;
+    }
+    return ntokens;
+  }
+
+  int32_t Dictionary::getLine(const CorpusCache& cache, int64_t& pos,
+                              std::vector<int32_t>& words,
+                              std::vector<int32_t>& labels,
+                              std::minstd_rand& rng) const {
+    const int32_t* tokens = cache.data();
+    const int64_t size = cache.size();
+    const int32_t eos = getId(EOS);
+    int32_t ntokens = 0;
+
+    if (pos >= size) pos = 0;
+    words.clear();
+    labels.clear();
+    while (pos < size) {
+      int32_t wid = tokens[pos++];
+
+      ntokens++;
+      if (wid >= 0 && getType(wid) == entry_type::word) {
+        words.push_back(wid);
+      } else if (wid >= 0) {
+        labels.push_back(wid - nwords_);
+      }
+      if (wid == CorpusCache::OOV_EOS || (wid >= 0 && wid == eos)) break;
+    }
+    return ntokens;
+  }
+
   void Dictionary::pushHash(std::vector<int32_t>& hashes, int32_t id) const {
     if (pruneidx_size_ == 0 || id < 0) return;
     if (pruneidx_size_ > 0) {
-      if (pruneidx_.count(id)) {
-        id = pruneidx_.at(id);
-      } else {
+      auto it = std::lower_bound(pruneidx_.begin(), pruneidx_.end(),
+                                 std::make_pair(id, int32_t(-1)));
+      if (it == pruneidx_.end() || it->first != id) {
         return;
       }
+      id = it->second;
     }
     hashes.push_back(nwords_ + id);
   }
@@ -287,56 +680,74 @@ namespace fasttext {
 
   void Dictionary::load(std::istream& in) {
     words_.clear();
-    std::fill(word2int_.begin(), word2int_.end(), -1);
     in.read((char*) &size_, sizeof(int32_t));
     in.read((char*) &nwords_, sizeof(int32_t));
     in.read((char*) &nlabels_, sizeof(int32_t));
     in.read((char*) &ntokens_, sizeof(int64_t));
     in.read((char*) &pruneidx_size_, sizeof(int64_t));
+    words_.reserve(size_);
     for (int32_t i = 0; i < size_; i++) {
-      char c;
       entry e;
-      while ((c = in.get()) != 0) {
-        e.word.push_back(c);
-      }
+      std::getline(in, e.word, '\0');
       in.read((char*) &(e.count), sizeof(int64_t));
       in.read((char*) &(e.type), sizeof(entry_type));
       words_.push_back(e);
-      word2int_[find(e.word)] = i;
     }
+    rebuildIndex();
     pruneidx_.clear();
     for (int32_t i = 0; i < pruneidx_size_; i++) {
       int32_t first;
       int32_t second;
       in.read((char*) &first, sizeof(int32_t));
       in.read((char*) &second, sizeof(int32_t));
-      pruneidx_[first] = second;
+      pruneidx_.push_back(std::make_pair(first, second));
     }
+    std::sort(pruneidx_.begin(), pruneidx_.end());
     initTableDiscard();
   }
 
+  // Keeps the rows idx of the input matrix. idx becomes the order of the
+  // rows of the pruned matrix: the kept words by id, then the kept n-gram
+  // rows in their order in idx.
   void Dictionary::prune(std::vector<int32_t>& idx) {
-    std::vector<int32_t> words;
+    std::vector<int32_t> words, ngrams;
     for (auto it = idx.cbegin(); it != idx.cend(); ++it) {
-      if (*it < nwords_) {words.push_back(*it);}
+      if (*it < nwords_) {
+        words.push_back(*it);
+      } else {
+        ngrams.push_back(*it);
+      }
     }
     std::sort(words.begin(), words.end());
     idx = words;
 
+    // rows of an already pruned dictionary map back to their buckets
+    std::vector<int32_t> buckets(pruneidx_.size());
+    for (const auto& p : pruneidx_) {
+      buckets[p.second] = p.first;
+    }
+    const bool pruned = isPruned();
+    pruneidx_.clear();
+    for (int32_t j = 0; j < ngrams.size(); j++) {
+      const int32_t row = ngrams[j] - nwords_;
+      pruneidx_.push_back(std::make_pair(pruned ? buckets[row] : row, j));
+    }
+    std::sort(pruneidx_.begin(), pruneidx_.end());
+    idx.insert(idx.end(), ngrams.begin(), ngrams.end());
     pruneidx_size_ = pruneidx_.size();
 
-    std::fill(word2int_.begin(), word2int_.end(), -1);
     size_t j = 0;
     for (size_t i = 0; i < words_.size(); i++) {
       if (getType(i) == entry_type::label ||
           (j < words.size() && words[j] == static_cast<int32_t>(i))) {
         words_[j] = words_[i];
-        word2int_[find(words_[j].word)] = j;
         j++;
       }
     }
+    words_.resize(j);
     nwords_ = words.size();
     size_ = nwords_ +  nlabels_;
+    rebuildIndex();
   }
 
   std::vector<int64_t> Dictionary::getCounts(entry_type type) const {
@@ -10,19 +10,22 @@
 #ifndef FASTTEXT_DICTIONARY_H
 #define FASTTEXT_DICTIONARY_H
 
+#include <atomic>
 #include <vector>
 #include <string>
 #include <istream>
 #include <ostream>
 #include <random>
 #include <memory>
-#include <unordered_map>
+#include <utility>
 
 #include "args.h"
 #include "real.h"
 
 namespace fasttext {
 
+class CorpusCache;
+
 using id_t =  int32_t;
 enum class entry_type : int8_t {word=0, label=1};
 
@@ -32,19 +35,50 @@ struct entry {
   int64_t count;
 };
 
+// Open-addressing slot of the word index. The hash is kept next to the id so
+// that probing only compares strings when the full 32-bit hashes agree.
+struct slot {
+  uint32_t hash;
+  int32_t id;
+};
+
+// Token handed out by Dictionary::readToken, valid until the next read from
+// the same stream: a span of the stream's own buffer, or of the caller's
+// scratch string when the token straddled two refills. The hash is computed
+// while scanning.
+struct span {
+  const char* data;
+  size_t size;
+  uint32_t hash;
+
+  bool operator==(const std::string& s) const {
+    return size == s.size() && s.compare(0, size, data, size) == 0;
+  }
+};
+
 class Dictionary {
   protected:
     static const int32_t MAX_VOCAB_SIZE = 30000000;
     static const int32_t MAX_LINE_SIZE = 1024;
+    static const int32_t MIN_INDEX_SIZE = 1024;
+    static const int32_t MAX_WORD_NGRAMS = 16;
 
     int32_t find(const std::string&) const;
     int32_t find(const std::string&, uint32_t h) const;
+    int32_t find(const char*, size_t, uint32_t h) const;
+    void resizeIndex(int64_t);
+    void rebuildIndex();
     void initTableDiscard();
     void reset(std::istream&) const;
+    void countShard(const std::string&, int64_t, int64_t,
+                    std::atomic<int64_t>&);
+    void merge(const Dictionary&);
+    void finalize();
     void pushHash(std::vector<int32_t>&, int32_t) const;
+    void add(const span&);
 
     std::shared_ptr<Args> args_;
-    std::vector<int32_t> word2int_;
+    std::vector<slot> word2int_;
     std::vector<entry> words_;
 
     std::vector<real> pdiscard_;
@@ -54,7 +88,8 @@ class Dictionary {
     int64_t ntokens_;
 
     int64_t pruneidx_size_;
-    std::unordered_map<int32_t, int32_t> pruneidx_;
+    // (bucket, row) of the n-gram buckets kept by prune, sorted by bucket
+    std::vector<std::pair<int32_t, int32_t>> pruneidx_;
 
    public:
     static const std::string EOS;
@@ -62,16 +97,21 @@ class Dictionary {
     int32_t nwords() const;
     int32_t nlabels() const;
     int64_t ntokens() const;
+    int32_t nbuckets() const;
     int32_t getId(const std::string&) const;
     int32_t getId(const std::string&, uint32_t h) const;
+    int32_t getId(const span&) const;
     entry_type getType(id_t) const;
     entry_type getType(const std::string&) const;
+    entry_type getType(const span&) const;
     bool discard(int32_t, real) const;
     std::string getWord(int32_t) const;
     uint32_t hash(const std::string& str) const;
     void add(const std::string&);
     bool readWord(std::istream&, std::string&) const;
+    bool readToken(std::istream&, span&, std::string&) const;
     void readFromFile(std::istream&);
+    void readFromFile(const std::string&);
     std::string getLabel(int32_t) const;
     void save(std::ostream&) const;
     void load(std::istream&);
@@ -80,6 +120,10 @@ class Dictionary {
                     std::vector<int32_t>& words,
                     std::vector<int32_t>& labels,
                     std::minstd_rand& rng) const;
+    int32_t getLine(const CorpusCache&, int64_t&, std::vector<int32_t>&,
+                    std::minstd_rand&) const;
+    int32_t getLine(const CorpusCache&, int64_t&, std::vector<int32_t>&,
+                    std::vector<int32_t>&, std::minstd_rand&) const;
     void threshold(int64_t, int64_t);
     void prune(std::vector<int32_t>&);
     bool isPruned() { return pruneidx_size_ >= 0; }
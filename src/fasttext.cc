@@ -9,27 +9,95 @@
 
 #include "fasttext.h"
 
+#include <ctype.h>
 #include <math.h>
+#include <sys/stat.h>
 
+#include <cmath>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <thread>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <queue>
 #include <algorithm>
 #include <stdexcept>
+#include <limits>
 #include <numeric>
 
+#include "kernels.h"
+#include "prefetchbuf.h"
+#include "vectorsfile.h"
+
 
 namespace fasttext {
 
-FastText::FastText() : quant_(false) {}
+namespace {
+
+// The byte stored before each matrix of a model file. Versions before 14
+// only know the first two.
+enum class storage : uint8_t { dense = 0, quantized = 1, half = 2 };
+
+// bytes of a file that test and predict hand to a thread at once
+const int64_t CHUNK_SIZE = 1 << 20;
+
+// Identifies a version of a file by its size and last modification, 0 when
+// it cannot be found.
+uint64_t stampFile(const std::string& filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) {
+    return 0;
+  }
+  const uint64_t prime = 1099511628211ULL;
+  uint64_t h = 14695981039346656037ULL;
+  h = (h ^ uint64_t(st.st_size)) * prime;
+  h = (h ^ uint64_t(st.st_mtim.tv_sec)) * prime;
+  h = (h ^ uint64_t(st.st_mtim.tv_nsec)) * prime;
+  return h;
+}
+
+// Reads a saved index, or says why it has to be rebuilt.
+bool readIndex(const std::string& filename, NNIndex& index) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    return false;
+  }
+  try {
+    index.load(ifs);
+  } catch (const std::invalid_argument& e) {
+    std::cerr << filename << ": " << e.what() << " Rebuilding it."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// The buffers a thread keeps for the const methods on one line at a time,
+// remade for a model of other sizes.
+PredictBuffers& lineBuffers(std::unique_ptr<PredictBuffers>& buffers,
+                            int32_t hsz, int32_t osz) {
+  if (!buffers || buffers->hidden.size() != hsz ||
+      buffers->output.size() != osz) {
+    buffers.reset(new PredictBuffers(hsz, osz, false));
+  }
+  return *buffers;
+}
+
+}
+
+FastText::FastText()
+  : readerDone_(false), nprobe_(0), modelStamp_(0), quant_(false),
+    half_(false),
+    version(FASTTEXT_VERSION) {}
 
 void FastText::addInputVector(Vector& vec, int32_t ind) const {
   if (quant_) {
     vec.addRow(*qinput_, ind);
+  } else if (half_) {
+    vec.addRow(*hinput_, ind);
   } else {
     vec.addRow(*input_, ind);
   }
@@ -57,48 +125,52 @@ int32_t FastText::getWordId(const std::string& word) const {
 
 void FastText::getWordVector(Vector& vec, const std::string& word) const {
   vec.zero();
-  addInputVector(vec, getWordId(word));
+  const int32_t id = getWordId(word);
+  if (id >= 0) {
+    addInputVector(vec, id);
+  }
 }
 
 void FastText::saveVectors() {
-  std::ofstream ofs(args_->output + ".vec");
-  if (!ofs.is_open()) {
-    std::cerr << "Error opening file for saving vectors." << std::endl;
-    exit(EXIT_FAILURE);
-  }
-  ofs << dict_->nwords() << " " << args_->dim << std::endl;
-  Vector vec(args_->dim);
+  std::vector<std::string> words(dict_->nwords());
   for (int32_t i = 0; i < dict_->nwords(); i++) {
-    std::string word = dict_->getWord(i);
-    getWordVector(vec, word);
-    ofs << word << " " << vec << std::endl;
+    words[i] = dict_->getWord(i);
+  }
+  const bool binary = args_->binaryVectors > 0;
+  try {
+    VectorsFile::save(args_->output + (binary ? ".bvec" : ".vec"), words,
+                      args_->dim, [&](int64_t i, Vector& vec) {
+      getWordVector(vec, words[i]);
+    }, binary, args_->thread);
+  } catch (const std::invalid_argument& e) {
+    std::cerr << "Error saving vectors: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   }
-  ofs.close();
 }
 
 void FastText::saveOutput() {
-  std::ofstream ofs(args_->output + ".output");
-  if (!ofs.is_open()) {
-    std::cerr << "Error opening file for saving vectors." << std::endl;
-    exit(EXIT_FAILURE);
-  }
-  if (quant_) {
+  if (quant_ || half_) {
     std::cerr << "Option -saveOutput is not supported for quantized models."
               << std::endl;
     return;
   }
   int32_t n = (args_->model == model_name::sup) ? dict_->nlabels()
                                                 : dict_->nwords();
-  ofs << n << " " << args_->dim << std::endl;
-  Vector vec(args_->dim);
+  std::vector<std::string> words(n);
   for (int32_t i = 0; i < n; i++) {
-    std::string word = (args_->model == model_name::sup) ? dict_->getLabel(i)
-                                                         : dict_->getWord(i);
-    vec.zero();
-    vec.addRow(*output_, i);
-    ofs << word << " " << vec << std::endl;
+    words[i] = (args_->model == model_name::sup) ? dict_->getLabel(i)
+                                                 : dict_->getWord(i);
+  }
+  try {
+    VectorsFile::save(args_->output + ".output", words, args_->dim,
+                      [&](int64_t i, Vector& vec) {
+      vec.zero();
+      vec.addRow(*output_, i);
+    }, false, args_->thread);
+  } catch (const std::invalid_argument& e) {
+    std::cerr << "Error saving vectors: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   }
-  ofs.close();
 }
 
 bool FastText::checkModel(std::istream& in) {
@@ -123,7 +195,7 @@ void FastText::signModel(std::ostream& out) {
 
 void FastText::saveModel() {
   std::string fn(args_->output);
-  if (quant_) {
+  if (quant_ || half_) {
     fn += ".ftz";
   } else {
     fn += ".bin";
@@ -140,16 +212,24 @@ void FastText::saveModel(const std::string path) {
   args_->save(ofs);
   dict_->save(ofs);
 
-  ofs.write((char*)&(quant_), sizeof(bool));
+  storage s = quant_ ? storage::quantized :
+    (half_ ? storage::half : storage::dense);
+  ofs.write((char*)&(s), sizeof(storage));
   if (quant_) {
     qinput_->save(ofs);
+  } else if (half_) {
+    hinput_->save(ofs);
   } else {
     input_->save(ofs);
   }
 
-  ofs.write((char*)&(args_->qout), sizeof(bool));
+  s = (quant_ && args_->qout) ? storage::quantized :
+    (half_ ? storage::half : storage::dense);
+  ofs.write((char*)&(s), sizeof(storage));
   if (quant_ && args_->qout) {
     qoutput_->save(ofs);
+  } else if (half_) {
+    houtput_->save(ofs);
   } else {
     output_->save(ofs);
   }
@@ -157,7 +237,7 @@ void FastText::saveModel(const std::string path) {
   ofs.close();
 }
 
-void FastText::loadModel(const std::string& filename) {
+void FastText::loadModel(const std::string& filename, bool mmap) {
   std::ifstream ifs(filename, std::ifstream::binary);
   if (!ifs.is_open()) {
     throw std::invalid_argument(filename + " cannot be opened for loading!");
@@ -165,63 +245,131 @@ void FastText::loadModel(const std::string& filename) {
   if (!checkModel(ifs)) {
     throw std::invalid_argument(filename + " has wrong file format!");
   }
-  loadModel(ifs);
+  std::shared_ptr<utils::MappedFile> file;
+  if (mmap) {
+    file = std::make_shared<utils::MappedFile>(filename);
+  }
+  loadModel(ifs, file);
   ifs.close();
+  modelStamp_ = stampFile(filename);
 }
 
 void FastText::loadModel(std::istream& in) {
+  loadModel(in, nullptr);
+}
+
+void FastText::loadModel(std::istream& in,
+                         std::shared_ptr<utils::MappedFile> file) {
+  // models older than version 13 store matrices without page alignment
+  const bool aligned = version >= 13;
   args_ = std::make_shared<Args>();
   dict_ = std::make_shared<Dictionary>(args_);
   input_ = std::make_shared<Matrix>();
   output_ = std::make_shared<Matrix>();
   qinput_ = std::make_shared<QMatrix>();
   qoutput_ = std::make_shared<QMatrix>();
+  hinput_ = std::make_shared<HMatrix>();
+  houtput_ = std::make_shared<HMatrix>();
+  quant_ = false;
+  half_ = false;
+  file_ = file;
+  modelStamp_ = 0;
   args_->load(in);
   if (version == 11 && args_->model == model_name::sup) {
     // backward compatibility: old supervised models do not use char ngrams.
     args_->maxn = 0;
   }
+  if (version < 14 && args_->model == model_name::sup) {
+    // older models accepted -wordNgrams without training the bucket rows,
+    // which only hold their random initialization
+    args_->wordNgrams = 1;
+  }
   dict_->load(in);
 
-  bool quant_input;
-  in.read((char*) &quant_input, sizeof(bool));
-  if (quant_input) {
+  storage s;
+  in.read((char*) &s, sizeof(storage));
+  if (s == storage::quantized) {
     quant_ = true;
-    qinput_->load(in);
+    qinput_->load(in, file);
+  } else if (s == storage::half) {
+    half_ = true;
+    hinput_->load(in, file);
   } else {
-    input_->load(in);
+    input_->load(in, aligned, file);
   }
 
-  if (!quant_input && dict_->isPruned()) {
+  if (s == storage::dense && dict_->isPruned()) {
     std::cerr << "Invalid model file.\n"
               << "Please download the updated model from www.fasttext.cc.\n"
               << "See issue #332 on Github for more information.\n";
     exit(1);
   }
 
-  in.read((char*) &args_->qout, sizeof(bool));
+  in.read((char*) &s, sizeof(storage));
+  args_->qout = s == storage::quantized;
   if (quant_ && args_->qout) {
-    qoutput_->load(in);
+    qoutput_->load(in, file);
+  } else if (s == storage::half) {
+    houtput_->load(in, file);
   } else {
-    output_->load(in);
+    output_->load(in, aligned, file);
   }
 
   model_ = std::make_shared<Model>(input_, output_, args_, 0);
   model_->quant_ = quant_;
   model_->setQuantizePointer(qinput_, qoutput_, args_->qout);
+  if (half_) {
+    model_->setHalfPointer(hinput_, houtput_);
+  }
+
+  // the rest is built on the first update if training is resumed
+  model_->setTargetCounts(getTargetCounts(), false);
+}
 
+void FastText::warmUp() const {
+  if (file_) {
+    file_->prefault();
+  }
   if (args_->model == model_name::sup) {
-    model_->setTargetCounts(dict_->getCounts(entry_type::label));
-  } else {
-    model_->setTargetCounts(dict_->getCounts(entry_type::word));
+    std::vector<std::vector<std::pair<real, std::string>>> predictions;
+    predict(std::vector<std::string>(1, "\n"), 1, predictions);
+  }
+}
+
+// Reuses the dictionary of an existing model, as when training from a stream
+// that cannot be read twice.
+void FastText::loadDictionary(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  if (!checkModel(ifs)) {
+    throw std::invalid_argument(filename + " has wrong file format!");
+  }
+  Args args;
+  args.load(ifs);
+  dict_->load(ifs);
+  if (dict_->isPruned()) {
+    throw std::invalid_argument(filename + " has a pruned dictionary!");
   }
+  version = FASTTEXT_VERSION;
+  if (args_->verbose > 0) {
+    std::cerr << "Number of words:  " << dict_->nwords() << std::endl;
+    std::cerr << "Number of labels: " << dict_->nlabels() << std::endl;
+  }
+}
+
+// Wall-clock seconds since the training threads were started.
+double FastText::elapsed() const {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
 }
 
 void FastText::printInfo(real progress, real loss) {
-  real t = real(clock() - start) / CLOCKS_PER_SEC;
-  real wst = real(tokenCount) / t;
+  real t = elapsed();
+  real wst = real(tokenCount) / t / args_->thread;
   real lr = args_->lr * (1.0 - progress);
-  int eta = int(t / progress * (1 - progress) / args_->thread);
+  int eta = int(t / progress * (1 - progress));
   int etah = eta / 3600;
   int etam = (eta - etah * 3600) / 60;
   std::cerr << std::fixed;
@@ -233,6 +381,42 @@ void FastText::printInfo(real progress, real loss) {
   std::cerr << std::flush;
 }
 
+// One JSON object per line: the overall progress, then for every thread its
+// token rate and the seconds spent reading lines and in SGD updates, so that
+// slow threads and the parsing share can be told apart.
+void FastText::writeMetrics(real progress, real loss) {
+  const double t = elapsed();
+  lastMetrics_ = t;
+  // the loss is undefined until a thread has seen an example
+  auto number = [](double x) {
+    std::ostringstream ss;
+    if (std::isfinite(x)) {
+      ss << std::setprecision(6) << x;
+    } else {
+      ss << "null";
+    }
+    return ss.str();
+  };
+  metricsOut_ << std::setprecision(6)
+              << "{\"time\": " << t
+              << ", \"progress\": " << progress
+              << ", \"tokens\": " << tokenCount
+              << ", \"lr\": " << args_->lr * (1.0 - progress)
+              << ", \"loss\": " << number(loss)
+              << ", \"threads\": [";
+  for (size_t i = 0; i < metrics_.size(); i++) {
+    const ThreadMetrics& m = metrics_[i];
+    metricsOut_ << (i > 0 ? ", " : "")
+                << "{\"id\": " << i
+                << ", \"tokens\": " << m.tokens
+                << ", \"tokens_per_sec\": " << (t > 0 ? m.tokens / t : 0.0)
+                << ", \"parse_sec\": " << m.parseNs * 1e-9
+                << ", \"update_sec\": " << m.updateNs * 1e-9
+                << ", \"loss\": " << number(m.loss) << "}";
+  }
+  metricsOut_ << "]}" << std::endl;
+}
+
 std::vector<int32_t> FastText::selectEmbeddings(int32_t cutoff) const {
   Vector norms(input_->m_);
   input_->l2NormRow(norms);
@@ -247,13 +431,17 @@ std::vector<int32_t> FastText::selectEmbeddings(int32_t cutoff) const {
   return idx;
 }
 
+// With qargs->dtype, both matrices are only rounded to 16-bit floats, which
+// needs no training and works for every model; the cutoff still requires a
+// supervised one.
 void FastText::quantize(std::shared_ptr<Args> qargs) {
-  if (args_->model != model_name::sup) {
+  const bool half = !qargs->dtype.empty();
+  if (args_->model != model_name::sup && (!half || qargs->cutoff > 0)) {
     throw std::invalid_argument(
         "For now we only support quantization of supervised models");
   }
   args_->input = qargs->input;
-  args_->qout = qargs->qout;
+  args_->qout = qargs->qout && !half;
   args_->output = qargs->output;
 
   if (qargs->cutoff > 0 && qargs->cutoff < input_->m_) {
@@ -276,10 +464,22 @@ void FastText::quantize(std::shared_ptr<Args> qargs) {
     }
   }
 
-  qinput_ = std::make_shared<QMatrix>(*input_, qargs->dsub, qargs->qnorm);
+  if (half) {
+    const bool bf16 = qargs->dtype == "bf16";
+    hinput_ = std::make_shared<HMatrix>(*input_, bf16);
+    houtput_ = std::make_shared<HMatrix>(*output_, bf16);
+    half_ = true;
+    model_ = std::make_shared<Model>(input_, output_, args_, 0);
+    model_->setHalfPointer(hinput_, houtput_);
+    return;
+  }
+
+  qinput_ = std::make_shared<QMatrix>(*input_, qargs->dsub, qargs->qnorm,
+                                      qargs->thread);
 
   if (args_->qout) {
-    qoutput_ = std::make_shared<QMatrix>(*output_, 2, qargs->qnorm);
+    qoutput_ = std::make_shared<QMatrix>(*output_, 2, qargs->qnorm,
+                                         qargs->thread);
   }
 
   quant_ = true;
@@ -301,7 +501,7 @@ void FastText::supervised(
 
 void FastText::cbow(Model& model, real lr,
                     const std::vector<int32_t>& line) {
-  std::vector<int32_t> bow;
+  std::vector<int32_t>& bow = model.window;
   std::uniform_int_distribution<> uniform(1, args_->ws);
   const auto line_len = static_cast<int32_t>(line.size());
   for (int32_t w = 0; w < line_len; w++) {
@@ -320,36 +520,53 @@ void FastText::skipgram(Model& model, real lr,
                         const std::vector<int32_t>& line) {
   std::uniform_int_distribution<> uniform(1, args_->ws);
   const auto line_len = static_cast<int32_t>(line.size());
+  if (args_->batch > 0 && args_->loss == loss_name::ns) {
+    // the context words of a window are the inputs of one batched update,
+    // predicting the center word with negatives shared across the window
+    std::vector<int32_t>& context = model.window;
+    for (int32_t w = 0; w < line_len; w++) {
+      int32_t boundary = uniform(model.rng);
+      context.clear();
+      for (int32_t c = -boundary; c <= boundary; c++) {
+        if (c != 0 && w + c >= 0 && w + c < line_len) {
+          context.push_back(line[w + c]);
+        }
+      }
+      model.updateBatch(context, line[w], lr);
+    }
+    return;
+  }
   for (int32_t w = 0; w < line_len; w++) {
     int32_t boundary = uniform(model.rng);
-    const std::vector<int32_t> input(1, line[w]);
+    model.window.assign(1, line[w]);
     for (int32_t c = -boundary; c <= boundary; c++) {
       if (c != 0 && w + c >= 0 && w + c < line_len) {
-        model.update(input, line[w + c], lr);
+        model.update(model.window, line[w + c], lr);
       }
     }
   }
 }
 
-void FastText::test(std::istream& in, int32_t k) {
-  int32_t nexamples = 0, nlabels = 0;
-  double precision = 0.0;
-  std::vector<int32_t> line, labels;
-
-  while (in.peek() != EOF) {
-    dict_->getLine(in, line, labels, model_->rng);
-    if (labels.size() > 0 && line.size() > 0) {
-      std::vector<std::pair<real, int32_t>> modelPredictions;
-      model_->predict(line, k, modelPredictions);
-      for (auto it = modelPredictions.cbegin(); it != modelPredictions.cend(); it++) {
-        if (std::find(labels.begin(), labels.end(), it->second) != labels.end()) {
-          precision += 1.0;
-        }
+void FastText::testLine(const std::vector<int32_t>& line,
+                        const std::vector<int32_t>& labels, int32_t k,
+                        PredictBuffers& buffers, int64_t& nexamples,
+                        int64_t& nlabels, double& precision) {
+  if (labels.size() > 0 && line.size() > 0) {
+    std::vector<std::pair<real, int32_t>>& modelPredictions = buffers.heap;
+    modelPredictions.clear();
+    model_->predict(line, k, modelPredictions, buffers);
+    for (auto it = modelPredictions.cbegin(); it != modelPredictions.cend(); it++) {
+      if (std::find(labels.begin(), labels.end(), it->second) != labels.end()) {
+        precision += 1.0;
       }
-      nexamples++;
-      nlabels += labels.size();
     }
+    nexamples++;
+    nlabels += labels.size();
   }
+}
+
+void FastText::printTest(int32_t k, int64_t nexamples, int64_t nlabels,
+                         double precision) const {
   std::cout << "N" << "\t" << nexamples << std::endl;
   std::cout << std::setprecision(3);
   std::cout << "P@" << k << "\t" << precision / (k * nexamples) << std::endl;
@@ -357,51 +574,360 @@ void FastText::test(std::istream& in, int32_t k) {
   std::cerr << "Number of examples: " << nexamples << std::endl;
 }
 
-void FastText::predict(std::istream& in, int32_t k,
-                       std::vector<std::pair<real,std::string>>& predictions) const {
-  std::vector<int32_t> words, labels;
-  predictions.clear();
-  dict_->getLine(in, words, labels, model_->rng);
+void FastText::test(std::istream& in, int32_t k) {
+  int64_t nexamples = 0, nlabels = 0;
+  double precision = 0.0;
+  std::vector<int32_t> line, labels;
+  PredictBuffers buffers(args_->dim, dict_->nlabels(), false);
+
+  while (in.peek() != EOF) {
+    dict_->getLine(in, line, labels, model_->rng);
+    testLine(line, labels, k, buffers, nexamples, nlabels, precision);
+  }
+  printTest(k, nexamples, nlabels, precision);
+}
+
+void FastText::test(const CorpusCache& cache, int32_t k) {
+  int64_t nexamples = 0, nlabels = 0;
+  double precision = 0.0;
+  std::vector<int32_t> line, labels;
+  PredictBuffers buffers(args_->dim, dict_->nlabels(), false);
+
+  int64_t pos = 0;
+  while (pos < cache.size()) {
+    dict_->getLine(cache, pos, line, labels, model_->rng);
+    testLine(line, labels, k, buffers, nexamples, nlabels, precision);
+  }
+  printTest(k, nexamples, nlabels, precision);
+}
+
+void FastText::predictLine(const std::vector<int32_t>& words, int32_t k,
+                           std::vector<std::pair<real,std::string>>& predictions,
+                           PredictBuffers& buffers) const {
   predictions.clear();
   if (words.empty()) return;
-  Vector hidden(args_->dim);
-  Vector output(dict_->nlabels());
-  std::vector<std::pair<real,int32_t>> modelPredictions;
-  model_->predict(words, k, modelPredictions, hidden, output);
+  std::vector<std::pair<real,int32_t>>& modelPredictions = buffers.heap;
+  modelPredictions.clear();
+  model_->predict(words, k, modelPredictions, buffers);
   for (auto it = modelPredictions.cbegin(); it != modelPredictions.cend(); it++) {
     predictions.push_back(std::make_pair(it->first, dict_->getLabel(it->second)));
   }
 }
 
+void FastText::predict(std::istream& in, int32_t k,
+                       std::vector<std::pair<real,std::string>>& predictions) const {
+  thread_local std::unique_ptr<PredictBuffers> local;
+  PredictBuffers& buffers = lineBuffers(local, args_->dim, dict_->nlabels());
+  predictions.clear();
+  dict_->getLine(in, buffers.words, buffers.labels, model_->rng);
+  predictLine(buffers.words, k, predictions, buffers);
+}
+
+void FastText::predictRange(
+    const std::vector<std::vector<int32_t>>& docs, int32_t k,
+    std::vector<std::vector<std::pair<real, int32_t>>>& heaps,
+    std::vector<std::vector<std::pair<real, std::string>>>& predictions,
+    int64_t ib, int64_t ie, bool normalize) const {
+  PredictBuffers buffers(args_->dim, dict_->nlabels());
+  model_->predict(docs, k, heaps, buffers, ib, ie, normalize);
+  for (int64_t i = ib; i < ie; i++) {
+    predictions[i].clear();
+    for (auto it = heaps[i].cbegin(); it != heaps[i].cend(); it++) {
+      predictions[i].push_back(
+          std::make_pair(it->first, dict_->getLabel(it->second)));
+    }
+  }
+}
+
+void FastText::predict(
+    const std::vector<std::vector<int32_t>>& docs, int32_t k,
+    std::vector<std::vector<std::pair<real, std::string>>>& predictions,
+    int32_t threads, bool normalize) const {
+  std::vector<std::vector<std::pair<real, int32_t>>> heaps(docs.size());
+  predictions.resize(docs.size());
+  utils::parallelFor(docs.size(), threads, [&](int64_t ib, int64_t ie) {
+    predictRange(docs, k, heaps, predictions, ib, ie, normalize);
+  });
+}
+
+void FastText::predict(
+    const std::vector<std::string>& docs, int32_t k,
+    std::vector<std::vector<std::pair<real, std::string>>>& predictions,
+    int32_t threads, bool normalize) const {
+  std::vector<std::vector<int32_t>> words(docs.size());
+  std::vector<std::vector<std::pair<real, int32_t>>> heaps(docs.size());
+  predictions.resize(docs.size());
+  utils::parallelFor(docs.size(), threads, [&](int64_t ib, int64_t ie) {
+    std::minstd_rand rng;
+    std::vector<int32_t> labels;
+    std::istringstream in;
+    for (int64_t i = ib; i < ie; i++) {
+      in.clear();
+      in.str(docs[i]);
+      dict_->getLine(in, words[i], labels, rng);
+    }
+    predictRange(words, k, heaps, predictions, ib, ie, normalize);
+  });
+}
+
+// Fills k label ids and scores per document, padded with -1 and -infinity
+// after the labels found.
+void FastText::predict(const std::vector<std::string>& docs, int32_t k,
+                       int32_t* labels, real* scores, int32_t threads,
+                       bool normalize) const {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  std::vector<std::vector<int32_t>> words(docs.size());
+  std::vector<std::vector<std::pair<real, int32_t>>> heaps(docs.size());
+  utils::parallelFor(docs.size(), threads, [&](int64_t ib, int64_t ie) {
+    std::minstd_rand rng;
+    std::vector<int32_t> lineLabels;
+    std::istringstream in;
+    for (int64_t i = ib; i < ie; i++) {
+      in.clear();
+      in.str(docs[i]);
+      dict_->getLine(in, words[i], lineLabels, rng);
+    }
+    PredictBuffers buffers(args_->dim, dict_->nlabels());
+    model_->predict(words, k, heaps, buffers, ib, ie, normalize);
+    for (int64_t i = ib; i < ie; i++) {
+      for (int32_t j = 0; j < k; j++) {
+        const bool found = j < heaps[i].size();
+        labels[i * k + j] = found ? heaps[i][j].second : -1;
+        scores[i * k + j] = found ? heaps[i][j].first :
+          -std::numeric_limits<real>::infinity();
+      }
+    }
+  });
+}
+
+void FastText::printPredictions(
+    const std::vector<std::pair<real, std::string>>& predictions,
+    bool print_prob, std::ostream& out) const {
+  for (auto it = predictions.cbegin(); it != predictions.cend(); it++) {
+    if (it != predictions.cbegin()) {
+      out << " ";
+    }
+    out << it->second;
+    if (print_prob) {
+      out << " " << exp(it->first);
+    }
+  }
+  out << "\n";
+}
+
 void FastText::predict(std::istream& in, int32_t k, bool print_prob) {
-  std::vector<std::pair<real,std::string>> predictions;
+  const int32_t batch = 1024;
+  std::vector<std::vector<int32_t>> words(batch);
+  std::vector<std::vector<std::pair<real,std::string>>> predictions;
+  std::vector<int32_t> labels;
   while (in.peek() != EOF) {
-    predictions.clear();
-    predict(in, k, predictions);
-    if (predictions.empty()) {
-      std::cout << std::endl;
-      continue;
+    int32_t n = 0;
+    while (n < batch && in.peek() != EOF) {
+      dict_->getLine(in, words[n++], labels, model_->rng);
+    }
+    words.resize(n);
+    predict(words, k, predictions, 1, print_prob);
+    for (int32_t i = 0; i < n; i++) {
+      printPredictions(predictions[i], print_prob, std::cout);
+    }
+  }
+}
+
+void FastText::predict(const CorpusCache& cache, int32_t k, bool print_prob) {
+  std::vector<std::pair<real,std::string>> predictions;
+  std::vector<int32_t> words, labels;
+  PredictBuffers buffers(args_->dim, dict_->nlabels(), false);
+  int64_t pos = 0;
+  while (pos < cache.size()) {
+    dict_->getLine(cache, pos, words, labels, model_->rng);
+    predictLine(words, k, predictions, buffers);
+    printPredictions(predictions, print_prob, std::cout);
+  }
+}
+
+// Splits a file into chunks of about CHUNK_SIZE bytes that start at line
+// boundaries, which the threads take in turn and pass to f. With ordered,
+// what f writes for a chunk goes to std::cout once every previous chunk is
+// written: the output follows the input while each thread holds at most the
+// output of one chunk.
+void FastText::forEachChunk(
+    const std::string& filename, int32_t threads,
+    const std::function<void(int32_t, std::istream&, std::ostream&)>& f,
+    bool ordered) const {
+  const int64_t chunk = CHUNK_SIZE;
+  std::ifstream ifs(filename);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened!");
+  }
+  const int64_t size = utils::size(ifs);
+  ifs.close();
+  const int64_t nchunks = std::max<int64_t>(1, (size + chunk - 1) / chunk);
+  threads = std::max<int64_t>(1, std::min<int64_t>(threads, nchunks));
+  std::atomic<int64_t> next(0);
+  int64_t written = 0;
+  std::mutex mutex;
+  std::condition_variable cv;
+  auto work = [&](int32_t t) {
+    std::ifstream in(filename);
+    std::string text;
+    std::ostringstream out;
+    for (int64_t c = next++; c < nchunks; c = next++) {
+      const int64_t end = c + 1 == nchunks ?
+        size : utils::seekLine(in, (c + 1) * chunk);
+      const int64_t begin = utils::seekLine(in, c * chunk);
+      text.resize(end - begin);
+      in.read(&text[0], end - begin);
+      std::istringstream lines(text);
+      out.str("");
+      f(t, lines, out);
+      if (ordered) {
+        const std::string result = out.str();
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return written == c; });
+        std::cout.write(result.data(), result.size());
+        written++;
+        cv.notify_all();
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int32_t t = 1; t < threads; t++) {
+    pool.push_back(std::thread(work, t));
+  }
+  work(0);
+  for (auto& t : pool) {
+    t.join();
+  }
+}
+
+// Scratch space of one thread of test or predict on a file: the lines of a
+// chunk, and their predictions.
+struct FastText::ChunkBuffers {
+  std::shared_ptr<PredictBuffers> predict;
+  std::vector<std::vector<int32_t>> words;
+  std::vector<std::vector<int32_t>> labels;
+  std::vector<std::vector<std::pair<real, int32_t>>> heaps;
+  int64_t nexamples = 0;
+  int64_t nlabels = 0;
+  double precision = 0.0;
+
+  // Grows the vectors to hold line i, and returns i.
+  int64_t reserve(int64_t i) {
+    if (i == words.size()) {
+      words.emplace_back();
+      labels.emplace_back();
+      heaps.emplace_back();
+    }
+    return i;
+  }
+};
+
+void FastText::test(const std::string& filename, int32_t k, int32_t threads) {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  threads = std::max(1, threads);
+  std::vector<ChunkBuffers> shards(threads);
+  const auto t0 = std::chrono::steady_clock::now();
+  forEachChunk(filename, threads,
+      [&](int32_t t, std::istream& in, std::ostream&) {
+    ChunkBuffers& shard = shards[t];
+    if (!shard.predict) {
+      shard.predict = std::make_shared<PredictBuffers>(
+          args_->dim, dict_->nlabels());
     }
-    for (auto it = predictions.cbegin(); it != predictions.cend(); it++) {
-      if (it != predictions.cbegin()) {
-        std::cout << " ";
+    std::minstd_rand rng;
+    int64_t n = 0;
+    while (in.peek() != EOF) {
+      const int64_t i = shard.reserve(n);
+      dict_->getLine(in, shard.words[i], shard.labels[i], rng);
+      // only lines with both words and labels count as examples
+      if (!shard.words[i].empty() && !shard.labels[i].empty()) {
+        n++;
       }
-      std::cout << it->second;
-      if (print_prob) {
-        std::cout << " " << exp(it->first);
+    }
+    model_->predict(shard.words, k, shard.heaps, *shard.predict, 0, n);
+    for (int64_t i = 0; i < n; i++) {
+      const std::vector<int32_t>& labels = shard.labels[i];
+      for (const auto& p : shard.heaps[i]) {
+        if (std::find(labels.begin(), labels.end(), p.second) !=
+            labels.end()) {
+          shard.precision += 1.0;
+        }
       }
+      shard.nlabels += labels.size();
     }
-    std::cout << std::endl;
+    shard.nexamples += n;
+  }, false);
+  const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - t0).count();
+  int64_t nexamples = 0, nlabels = 0;
+  double precision = 0.0;
+  for (const auto& shard : shards) {
+    nexamples += shard.nexamples;
+    nlabels += shard.nlabels;
+    precision += shard.precision;
   }
+  printTest(k, nexamples, nlabels, precision);
+  std::cerr << "Examples per second: "
+            << int64_t(nexamples / std::max(seconds, 1e-9)) << std::endl;
+}
+
+void FastText::predict(const std::string& filename, int32_t k,
+                       bool print_prob, int32_t threads) {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  threads = std::max(1, threads);
+  std::vector<ChunkBuffers> shards(threads);
+  forEachChunk(filename, threads,
+      [&](int32_t t, std::istream& in, std::ostream& out) {
+    ChunkBuffers& shard = shards[t];
+    if (!shard.predict) {
+      shard.predict = std::make_shared<PredictBuffers>(
+          args_->dim, dict_->nlabels());
+    }
+    std::minstd_rand rng;
+    int64_t n = 0;
+    while (in.peek() != EOF) {
+      const int64_t i = shard.reserve(n++);
+      dict_->getLine(in, shard.words[i], shard.labels[i], rng);
+    }
+    model_->predict(shard.words, k, shard.heaps, *shard.predict, 0, n,
+                    print_prob);
+    std::vector<std::pair<real, std::string>> predictions;
+    for (int64_t i = 0; i < n; i++) {
+      predictions.clear();
+      for (const auto& p : shard.heaps[i]) {
+        predictions.push_back(
+            std::make_pair(p.first, dict_->getLabel(p.second)));
+      }
+      printPredictions(predictions, print_prob, out);
+    }
+  }, true);
 }
 
 void FastText::getSentenceVector(
     std::istream& in,
     fasttext::Vector& svec) {
+  thread_local std::unique_ptr<PredictBuffers> local;
+  sentenceVector(in, svec, lineBuffers(local, args_->dim, 0), model_->rng);
+}
+
+// Only the hidden vector and the line buffers of buffers are used, so that
+// their output can be empty.
+void FastText::sentenceVector(std::istream& in, Vector& svec,
+                              PredictBuffers& buffers,
+                              std::minstd_rand& rng) const {
   svec.zero();
   if (args_->model == model_name::sup) {
-    std::vector<int32_t> line, labels;
-    dict_->getLine(in, line, labels, model_->rng);
+    std::vector<int32_t>& line = buffers.words;
+    dict_->getLine(in, line, buffers.labels, rng);
     for (int32_t i = 0; i < line.size(); i++) {
       addInputVector(svec, line[i]);
     }
@@ -409,13 +935,23 @@ void FastText::getSentenceVector(
       svec.mul(1.0 / line.size());
     }
   } else {
-    Vector vec(args_->dim);
-    std::string sentence;
-    std::getline(in, sentence);
-    std::istringstream iss(sentence);
-    std::string word;
+    // the words of the line are split on white space, as by operator>>
+    Vector& vec = buffers.hidden;
+    const std::string& sentence = buffers.text;
+    std::string& word = buffers.word;
+    std::getline(in, buffers.text);
     int32_t count = 0;
-    while (iss >> word) {
+    for (size_t i = 0; i < sentence.size();) {
+      if (isspace((unsigned char) sentence[i])) {
+        i++;
+        continue;
+      }
+      size_t j = i;
+      while (j < sentence.size() && !isspace((unsigned char) sentence[j])) {
+        j++;
+      }
+      word.assign(sentence, i, j - i);
+      i = j;
       getWordVector(vec, word);
       real norm = vec.norm();
       if (norm > 0) {
@@ -430,6 +966,35 @@ void FastText::getSentenceVector(
   }
 }
 
+void FastText::getWordVectors(const std::vector<std::string>& words,
+                              real* out, int32_t threads) const {
+  const int32_t dim = args_->dim;
+  utils::parallelFor(words.size(), threads, [&](int64_t ib, int64_t ie) {
+    Vector vec(dim);
+    for (int64_t i = ib; i < ie; i++) {
+      getWordVector(vec, words[i]);
+      std::copy(vec.data_, vec.data_ + dim, out + i * dim);
+    }
+  });
+}
+
+void FastText::getSentenceVectors(const std::vector<std::string>& texts,
+                                  real* out, int32_t threads) const {
+  const int32_t dim = args_->dim;
+  utils::parallelFor(texts.size(), threads, [&](int64_t ib, int64_t ie) {
+    Vector vec(dim);
+    PredictBuffers buffers(dim, 0, false);
+    std::minstd_rand rng;
+    std::istringstream in;
+    for (int64_t i = ib; i < ie; i++) {
+      in.clear();
+      in.str(texts[i]);
+      sentenceVector(in, vec, buffers, rng);
+      std::copy(vec.data_, vec.data_ + dim, out + i * dim);
+    }
+  });
+}
+
 void FastText::precomputeWordVectors(Matrix& wordVectors) {
   Vector vec(args_->dim);
   wordVectors.zero();
@@ -451,36 +1016,150 @@ void FastText::findNN(const Matrix& wordVectors, const Vector& queryVec,
   if (std::abs(queryNorm) < 1e-8) {
     queryNorm = 1;
   }
-  std::priority_queue<std::pair<real, std::string>> heap;
-  Vector vec(args_->dim);
+  // bounded min-heap of the best k words, banned words excluded
+  auto worse = std::greater<std::pair<real, int32_t>>();
+  std::vector<std::pair<real, int32_t>> heap;
+  heap.reserve(k + 1);
+  std::vector<bool> banned(dict_->nwords(), false);
+  for (auto it = banSet.cbegin(); it != banSet.cend(); ++it) {
+    int32_t id = dict_->getId(*it);
+    if (id >= 0 && id < dict_->nwords()) {
+      banned[id] = true;
+    }
+  }
   for (int32_t i = 0; i < dict_->nwords(); i++) {
-    std::string word = dict_->getWord(i);
-    real dp = wordVectors.dotRow(queryVec, i);
-    heap.push(std::make_pair(dp / queryNorm, word));
+    if (banned[i]) continue;
+    real dp = wordVectors.dotRow(queryVec, i) / queryNorm;
+    if (heap.size() == k && dp < heap.front().first) {
+      continue;
+    }
+    heap.push_back(std::make_pair(dp, i));
+    std::push_heap(heap.begin(), heap.end(), worse);
+    if (heap.size() > k) {
+      std::pop_heap(heap.begin(), heap.end(), worse);
+      heap.pop_back();
+    }
+  }
+  std::sort_heap(heap.begin(), heap.end(), worse);
+  for (auto it = heap.cbegin(); it != heap.cend(); ++it) {
+    std::cout << dict_->getWord(it->second) << " " << it->first << std::endl;
+  }
+}
+
+// Approximate search: the index proposes a few times more candidates than
+// needed, which are then reranked with their exact vectors.
+void FastText::findNN(const NNIndex& index, const Vector& queryVec,
+                      int32_t k, const std::set<std::string>& banSet) {
+  real queryNorm = queryVec.norm();
+  if (std::abs(queryNorm) < 1e-8) {
+    queryNorm = 1;
+  }
+  std::vector<std::pair<real, int32_t>> candidates;
+  index.search(queryVec, 4 * (k + banSet.size()), nprobe_, candidates);
+  Vector vec(args_->dim);
+  for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+    getWordVector(vec, dict_->getWord(it->second));
+    real norm = vec.norm();
+    it->first = norm > 0 ? kernels::dot(vec.data_, queryVec.data_, args_->dim)
+                           / (norm * queryNorm) : 0.0;
   }
+  std::sort(candidates.begin(), candidates.end(),
+            std::greater<std::pair<real, int32_t>>());
   int32_t i = 0;
-  while (i < k && heap.size() > 0) {
-    auto it = banSet.find(heap.top().second);
-    if (it == banSet.end()) {
-      std::cout << heap.top().second << " " << heap.top().first << std::endl;
+  for (auto it = candidates.cbegin(); i < k && it != candidates.cend(); ++it) {
+    const std::string& word = dict_->getWord(it->second);
+    if (banSet.find(word) == banSet.end()) {
+      std::cout << word << " " << it->first << std::endl;
       i++;
     }
-    heap.pop();
   }
 }
 
+// Loads the index of the word vectors from filename, or builds it and saves
+// it there when the file is missing, corrupt or was built from another
+// model. A model read from a file is identified by the size and the
+// modification time of that file, so that a valid index is reused without
+// computing the word vectors.
+void FastText::loadNNIndex(const std::string& filename, int32_t nprobe) {
+  nprobe_ = nprobe;
+  if (!NNIndex::canIndex(dict_->nwords())) {
+    std::cerr << "Too few words for an index, using exact search."
+              << std::endl;
+    return;
+  }
+  nnindex_ = std::make_shared<NNIndex>();
+  const bool loaded = readIndex(filename, *nnindex_) &&
+    nnindex_->nwords() == dict_->nwords() && nnindex_->dim() == args_->dim;
+  if (loaded && modelStamp_ != 0 &&
+      nnindex_->getFingerprint() == modelStamp_) {
+    return;
+  }
+  Matrix wordVectors(dict_->nwords(), args_->dim);
+  precomputeWordVectors(wordVectors);
+  if (loaded && modelStamp_ == 0 && nnindex_->indexes(wordVectors)) {
+    return;
+  }
+  std::cerr << "Building index...";
+  nnindex_->build(wordVectors, 2, args_->thread);
+  if (modelStamp_ != 0) {
+    nnindex_->setFingerprint(modelStamp_);
+  }
+  std::cerr << " done." << std::endl;
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Index cannot be saved to " << filename << std::endl;
+    return;
+  }
+  nnindex_->save(ofs);
+}
+
+// Index of the rows of the output matrix, for predictions without
+// probabilities; saved to and reused from filename like the word index.
+void FastText::loadLabelIndex(const std::string& filename, int32_t nprobe) {
+  if (args_->model != model_name::sup || args_->loss == loss_name::hs ||
+      (quant_ && args_->qout) || half_ ||
+      !NNIndex::canIndex(dict_->nlabels())) {
+    std::cerr << "No label index for this model, using exact search."
+              << std::endl;
+    return;
+  }
+  auto index = std::make_shared<NNIndex>();
+  if (readIndex(filename, *index) && index->innerProduct() &&
+      index->indexes(*output_)) {
+    model_->setLabelIndex(index, nprobe);
+    return;
+  }
+  std::cerr << "Building label index...";
+  index->build(*output_, 2, args_->thread, true);
+  std::cerr << " done." << std::endl;
+  model_->setLabelIndex(index, nprobe);
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Index cannot be saved to " << filename << std::endl;
+    return;
+  }
+  index->save(ofs);
+}
+
 void FastText::nn(int32_t k) {
   std::string queryWord;
   Vector queryVec(args_->dim);
-  Matrix wordVectors(dict_->nwords(), args_->dim);
-  precomputeWordVectors(wordVectors);
+  Matrix wordVectors;
+  if (!nnindex_) {
+    wordVectors = Matrix(dict_->nwords(), args_->dim);
+    precomputeWordVectors(wordVectors);
+  }
   std::set<std::string> banSet;
   std::cout << "Query word? ";
   while (std::cin >> queryWord) {
     banSet.clear();
     banSet.insert(queryWord);
     getWordVector(queryVec, queryWord);
-    findNN(wordVectors, queryVec, k, banSet);
+    if (nnindex_) {
+      findNN(*nnindex_, queryVec, k, banSet);
+    } else {
+      findNN(wordVectors, queryVec, k, banSet);
+    }
     std::cout << "Query word? ";
   }
 }
@@ -488,8 +1167,11 @@ void FastText::nn(int32_t k) {
 void FastText::analogies(int32_t k) {
   std::string word;
   Vector buffer(args_->dim), query(args_->dim);
-  Matrix wordVectors(dict_->nwords(), args_->dim);
-  precomputeWordVectors(wordVectors);
+  Matrix wordVectors;
+  if (!nnindex_) {
+    wordVectors = Matrix(dict_->nwords(), args_->dim);
+    precomputeWordVectors(wordVectors);
+  }
   std::set<std::string> banSet;
   std::cout << "Query triplet (A - B + C)? ";
   while (true) {
@@ -508,144 +1190,472 @@ void FastText::analogies(int32_t k) {
     getWordVector(buffer, word);
     query.addVector(buffer, 1.0);
 
-    findNN(wordVectors, query, k, banSet);
+    if (nnindex_) {
+      findNN(*nnindex_, query, k, banSet);
+    } else {
+      findNN(wordVectors, query, k, banSet);
+    }
     std::cout << "Query triplet (A - B + C)? ";
   }
 }
 
+// Streaming workers take whole batches of lines from the reader thread.
+// Returns false once the reader is done and every batch has been taken.
+bool FastText::nextLine(LineBatch*& batch, int64_t& i,
+                        std::vector<int32_t>& line,
+                        std::vector<int32_t>& labels, int64_t& ntokens) {
+  while (batch == nullptr || i >= batch->size()) {
+    if (batch != nullptr) {
+      while (!free_->tryPush(batch)) {
+        std::this_thread::yield();
+      }
+      batch = nullptr;
+    }
+    bool done = readerDone_;
+    if (filled_->tryPop(batch)) {
+      i = 0;
+      ntokens += batch->ntokens;
+    } else if (done) {
+      return false;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  batch->getLine(i++, line, labels);
+  return true;
+}
+
 void FastText::trainThread(int32_t threadId) {
-  std::ifstream ifs(args_->input);
-  utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
+  std::unique_ptr<PrefetchBuffer> prefetch;
+  std::istream ifs(nullptr);
+  int64_t pos = 0;
+  const bool streaming = (filled_ != nullptr);
+  LineBatch* batch = nullptr;
+  if (cache_) {
+    pos = cache_->shard(threadId, args_->thread);
+  } else if (!streaming) {
+    prefetch = std::unique_ptr<PrefetchBuffer>(
+        new PrefetchBuffer(args_->input));
+    ifs.rdbuf(prefetch.get());
+    ifs.seekg(std::streampos(threadId * prefetch->size() / args_->thread));
+  }
 
   Model model(input_, output_, args_, threadId);
-  if (args_->model == model_name::sup) {
-    model.setTargetCounts(dict_->getCounts(entry_type::label));
-  } else {
-    model.setTargetCounts(dict_->getCounts(entry_type::word));
+  setTargets(model);
+  if (cluster_) {
+    model.setDirtyRows(cluster_->dirtyRows(0), cluster_->dirtyRows(1));
   }
 
-  const int64_t ntokens = dict_->ntokens();
+  const int64_t ntokens = streaming ? args_->tokens :
+                                      args_->epoch * dict_->ntokens();
   int64_t localTokenCount = 0;
+  int64_t parseNs = 0, updateNs = 0;
+  ThreadMetrics& metrics = metrics_[threadId];
   std::vector<int32_t> line, labels;
-  while (tokenCount < args_->epoch * ntokens) {
-    real progress = real(tokenCount) / (args_->epoch * ntokens);
+  while (tokenCount < ntokens) {
+    real progress = real(tokenCount) / ntokens;
     real lr = args_->lr * (1.0 - progress);
+    auto t0 = std::chrono::steady_clock::now();
+    if (streaming) {
+      if (!nextLine(batch, pos, line, labels, localTokenCount)) {
+        break;
+      }
+    } else if (args_->model == model_name::sup) {
+      localTokenCount += cache_ ?
+        dict_->getLine(*cache_, pos, line, labels, model.rng) :
+        dict_->getLine(ifs, line, labels, model.rng);
+    } else {
+      localTokenCount += cache_ ?
+        dict_->getLine(*cache_, pos, line, model.rng) :
+        dict_->getLine(ifs, line, model.rng);
+    }
+    auto t1 = std::chrono::steady_clock::now();
     if (args_->model == model_name::sup) {
-      localTokenCount += dict_->getLine(ifs, line, labels, model.rng);
       supervised(model, lr, line, labels);
     } else if (args_->model == model_name::cbow) {
-      localTokenCount += dict_->getLine(ifs, line, model.rng);
       cbow(model, lr, line);
     } else if (args_->model == model_name::sg) {
-      localTokenCount += dict_->getLine(ifs, line, model.rng);
       skipgram(model, lr, line);
     }
+    auto t2 = std::chrono::steady_clock::now();
+    parseNs += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0)
+        .count();
+    updateNs += std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1)
+        .count();
     if (localTokenCount > args_->lrUpdateRate) {
       tokenCount += localTokenCount;
+      metrics.tokens += localTokenCount;
+      metrics.parseNs = parseNs;
+      metrics.updateNs = updateNs;
+      metrics.loss = model.getLoss();
       localTokenCount = 0;
       if (threadId == 0 && args_->verbose > 1) {
         printInfo(progress, model.getLoss());
       }
+      if (threadId == 0 && metricsOut_.is_open() &&
+          elapsed() - lastMetrics_ >= 1.0) {
+        writeMetrics(progress, model.getLoss());
+      }
+    }
+  }
+  tokenCount += localTokenCount;
+  metrics.tokens += localTokenCount;
+  metrics.parseNs = parseNs;
+  metrics.updateNs = updateNs;
+  metrics.loss = model.getLoss();
+  if (batch != nullptr) {
+    while (!free_->tryPush(batch)) {
+      std::this_thread::yield();
     }
   }
   if (threadId == 0 && args_->verbose > 0) {
     printInfo(1.0, model.getLoss());
     std::cerr << std::endl;
   }
-  ifs.close();
 }
 
+// Keeps the first lines of the stream, up to about ntokens tokens, so that
+// the dictionary can be built from them before they are trained on.
+void FastText::readSample(std::istream& in, int64_t ntokens) {
+  sample_.clear();
+  std::string line;
+  int64_t n = 0;
+  while (n < ntokens && std::getline(in, line)) {
+    bool space = true;
+    for (char c : line) {
+      bool s = (c == ' ' || c == '\t' || c == '\v' || c == '\f' ||
+                c == '\r' || c == '\0');
+      n += (space && !s);
+      space = s;
+    }
+    n++;
+    sample_ += line;
+    sample_ += '\n';
+  }
+}
+
+// Tokenizes the sample, then the rest of stdin, into batches of lines until
+// the token budget is read.
+void FastText::readStream() {
+  const int64_t BATCH_TOKENS = 1 << 16;
+  std::minstd_rand rng(args_->thread);
+  std::istringstream sample(sample_);
+  std::istream* in = &sample;
+  std::vector<int32_t> words, labels;
+  int64_t ntokens = 0;
+  while (ntokens < args_->tokens) {
+    if (in->peek() == EOF) {
+      if (in == &sample) {
+        in = &std::cin;
+        continue;
+      }
+      break;
+    }
+    LineBatch* batch = nullptr;
+    while (!free_->tryPop(batch)) {
+      std::this_thread::yield();
+    }
+    batch->clear();
+    while (batch->ntokens < BATCH_TOKENS &&
+           ntokens + batch->ntokens < args_->tokens && in->peek() != EOF) {
+      int64_t n;
+      if (args_->model == model_name::sup) {
+        n = dict_->getLine(*in, words, labels, rng);
+      } else {
+        n = dict_->getLine(*in, words, rng);
+        labels.clear();
+      }
+      batch->addLine(words, labels, n);
+    }
+    ntokens += batch->ntokens;
+    while (!filled_->tryPush(batch)) {
+      std::this_thread::yield();
+    }
+  }
+  sample_.clear();
+  readerDone_ = true;
+}
+
+// Reads .vec files or the binary vectors of -binaryVectors, the rows going
+// straight to their place in input_.
 void FastText::loadVectors(std::string filename) {
-  std::ifstream in(filename);
-  std::vector<std::string> words;
-  std::shared_ptr<Matrix> mat; // temp. matrix for pretrained vectors
-  int64_t n, dim;
-  if (!in.is_open()) {
-    std::cerr << "Pretrained vectors file cannot be opened!" << std::endl;
+  std::shared_ptr<VectorsFile> vectors;
+  try {
+    vectors = std::make_shared<VectorsFile>(filename, args_->thread);
+  } catch (const std::invalid_argument& e) {
+    std::cerr << "Pretrained vectors file cannot be read: " << e.what()
+              << std::endl;
     exit(EXIT_FAILURE);
   }
-  in >> n >> dim;
-  if (dim != args_->dim) {
+  if (vectors->dim() != args_->dim) {
     std::cerr << "Dimension of pretrained vectors does not match -dim option"
               << std::endl;
     exit(EXIT_FAILURE);
   }
-  mat = std::make_shared<Matrix>(n, dim);
-  for (size_t i = 0; i < n; i++) {
-    std::string word;
-    in >> word;
-    words.push_back(word);
+  const std::vector<std::string>& words = vectors->words();
+  for (const auto& word : words) {
     dict_->add(word);
-    for (size_t j = 0; j < dim; j++) {
-      in >> mat->data_[i * dim + j];
-    }
   }
-  in.close();
 
   dict_->threshold(1, 0);
-  input_ = std::make_shared<Matrix>(dict_->nwords()+args_->bucket, args_->dim);
-  input_->uniform(1.0 / args_->dim);
+  input_ = std::make_shared<Matrix>(
+      dict_->nwords() + dict_->nbuckets(), args_->dim, args_->thread > 1);
+  input_->uniform(1.0 / args_->dim, args_->thread);
 
-  for (size_t i = 0; i < n; i++) {
+  // the last row of a word wins, as when the rows were copied in order
+  std::vector<int32_t> target(words.size(), -1);
+  std::vector<int64_t> last(dict_->nwords(), -1);
+  for (size_t i = 0; i < words.size(); i++) {
     int32_t idx = dict_->getId(words[i]);
     if (idx < 0 || idx >= dict_->nwords()) continue;
-    for (size_t j = 0; j < dim; j++) {
-      input_->data_[idx * dim + j] = mat->data_[i * dim + j];
+    if (last[idx] >= 0) {
+      target[last[idx]] = -1;
     }
+    target[i] = idx;
+    last[idx] = i;
+  }
+  try {
+    vectors->read([&](int64_t i) {
+      return target[i] < 0 ? nullptr : input_->row(target[i]);
+    }, args_->thread);
+  } catch (const std::invalid_argument& e) {
+    std::cerr << "Pretrained vectors file cannot be read: " << e.what()
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+std::shared_ptr<CorpusCache> FastText::loadCache(
+    const std::string& filename) const {
+  if (dict_->nbuckets() > 0) {
+    throw std::invalid_argument(
+        "A cache holds no word n-grams, it cannot be used with -wordNgrams!");
+  }
+  auto cache = std::make_shared<CorpusCache>(filename, args_);
+  if (!cache->matchesDictionary(*dict_)) {
+    throw std::invalid_argument(
+        filename + " was not tokenized with the dictionary of this model!");
+  }
+  return cache;
+}
+
+void FastText::saveCache(std::istream& in, const std::string& source,
+                         const std::string& filename) const {
+  if (dict_->nbuckets() > 0) {
+    throw std::invalid_argument(
+        "A cache holds no word n-grams, it cannot be used with -wordNgrams!");
   }
+  CorpusCache::save(filename, *dict_, *args_, in, source, args_->verbose);
 }
 
 void FastText::train(std::shared_ptr<Args> args) {
   args_ = args;
+  modelStamp_ = 0;
   dict_ = std::make_shared<Dictionary>(args_);
-  if (args_->input == "-") {
-    // manage expectations
-    std::cerr << "Cannot use stdin for training!" << std::endl;
-    exit(EXIT_FAILURE);
+  if (args_->nodes > 1) {
+    // the rows are matched by id across the nodes
+    if (args_->dict.empty()) {
+      std::cerr << "Training on several nodes needs the same -dict on every "
+                << "node!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    try {
+      cluster_ = std::make_shared<Cluster>(
+          args_->master, args_->nodes, args_->rank);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      exit(EXIT_FAILURE);
+    }
   }
-  std::ifstream ifs(args_->input);
-  if (!ifs.is_open()) {
-    std::cerr << "Input file cannot be opened!" << std::endl;
+  if (!args_->cache.empty() && dict_->nbuckets() > 0) {
+    std::cerr << "A cache holds no word n-grams, -cache cannot be used with "
+              << "-wordNgrams!" << std::endl;
     exit(EXIT_FAILURE);
   }
-  dict_->readFromFile(ifs);
-  ifs.close();
+  if (args_->input == "-") {
+    if (args_->tokens <= 0 || !args_->cache.empty()) {
+      std::cerr << "Training from stdin needs -tokens and no -cache!"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (!args_->dict.empty()) {
+      loadDictionary(args_->dict);
+    } else {
+      readSample(std::cin, args_->dictSample);
+      std::istringstream in(sample_);
+      dict_->readFromFile(in);
+    }
+  } else if (!args_->dict.empty()) {
+    loadDictionary(args_->dict);
+  } else if (!args_->cache.empty() && CorpusCache::isCurrent(args_->cache)) {
+    cache_ = std::make_shared<CorpusCache>(args_->cache, args_);
+    if (cache_->matchesArgs(*args_)) {
+      dict_ = cache_->getDictionary();
+      if (args_->verbose > 0) {
+        std::cerr << "Read " << dict_->ntokens() / 1000000 << "M words from "
+                  << args_->cache << std::endl;
+        std::cerr << "Number of words:  " << dict_->nwords() << std::endl;
+        std::cerr << "Number of labels: " << dict_->nlabels() << std::endl;
+      }
+    } else {
+      // the input or the dictionary options changed since the cache was
+      // written, it is rebuilt below
+      cache_.reset();
+    }
+  }
+  if (!cache_ && args_->input != "-" && args_->dict.empty()) {
+    std::ifstream ifs(args_->input);
+    if (!ifs.is_open()) {
+      std::cerr << "Input file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    ifs.close();
+    dict_->readFromFile(args_->input);
+    if (!args_->cache.empty()) {
+      std::ifstream in(args_->input);
+      saveCache(in, args_->input, args_->cache);
+      cache_ = std::make_shared<CorpusCache>(args_->cache, args_);
+    }
+  }
 
   if (args_->pretrainedVectors.size() != 0) {
     loadVectors(args_->pretrainedVectors);
   } else {
-    input_ = std::make_shared<Matrix>(dict_->nwords()+args_->bucket, args_->dim);
-    input_->uniform(1.0 / args_->dim);
+    input_ = std::make_shared<Matrix>(
+        dict_->nwords() + dict_->nbuckets(), args_->dim, args_->thread > 1);
+    input_->uniform(1.0 / args_->dim, args_->thread);
   }
 
-  if (args_->model == model_name::sup) {
-    output_ = std::make_shared<Matrix>(dict_->nlabels(), args_->dim);
-  } else {
-    output_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
+  // rows are only padded when several threads update them concurrently
+  const int64_t osz = args_->model == model_name::sup ?
+    dict_->nlabels() : dict_->nwords();
+  output_ = std::make_shared<Matrix>(osz, args_->dim, args_->thread > 1);
+  output_->zero(args_->thread);
+  if (cluster_) {
+    try {
+      cluster_->attach(input_, output_);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      exit(EXIT_FAILURE);
+    }
   }
-  output_->zero();
   startThreads();
+  cluster_.reset();
+  cache_.reset();
   model_ = std::make_shared<Model>(input_, output_, args_, 0);
+  setTargets(*model_);
+}
+
+std::vector<int64_t> FastText::getTargetCounts() const {
   if (args_->model == model_name::sup) {
-    model_->setTargetCounts(dict_->getCounts(entry_type::label));
+    return dict_->getCounts(entry_type::label);
   } else {
-    model_->setTargetCounts(dict_->getCounts(entry_type::word));
+    return dict_->getCounts(entry_type::word);
+  }
+}
+
+// The negative sampler only depends on the target counts, so it is built
+// once and shared by the models of all the threads.
+void FastText::setTargets(Model& model) {
+  if (args_->loss == loss_name::ns) {
+    if (!sampler_) {
+      sampler_ = std::make_shared<NegativeSampler>(getTargetCounts());
+    }
+    model.setNegativeSampler(sampler_);
+  } else {
+    model.setTargetCounts(getTargetCounts());
   }
 }
 
 void FastText::startThreads() {
-  start = clock();
+  start = std::chrono::steady_clock::now();
+  metrics_ = std::vector<ThreadMetrics>(args_->thread);
+  lastMetrics_ = 0.0;
+  if (!args_->metrics.empty()) {
+    metricsOut_.open(args_->metrics, std::ofstream::app);
+    if (!metricsOut_.is_open()) {
+      std::cerr << "Metrics file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  // built before spawning the threads, which only read it
+  sampler_.reset();
+  if (args_->loss == loss_name::ns) {
+    sampler_ = std::make_shared<NegativeSampler>(getTargetCounts());
+  }
   tokenCount = 0;
-  if (args_->thread > 1) {
-    std::vector<std::thread> threads;
-    for (int32_t i = 0; i < args_->thread; i++) {
-      threads.push_back(std::thread([=]() { trainThread(i); }));
+  std::thread reader;
+  if (args_->input == "-") {
+    const int32_t nbatches = 4 * args_->thread;
+    batches_ = std::vector<LineBatch>(nbatches);
+    free_ = std::make_shared<LineQueue>(nbatches);
+    filled_ = std::make_shared<LineQueue>(nbatches);
+    for (auto& batch : batches_) {
+      free_->tryPush(&batch);
     }
-    for (auto it = threads.begin(); it != threads.end(); ++it) {
-      it->join();
+    readerDone_ = false;
+    reader = std::thread([=]() { readStream(); });
+  }
+  // even a single training thread is spawned, so that this thread is free to
+  // run the averaging rounds of a cluster while the others train
+  std::vector<std::thread> threads;
+  finished_ = 0;
+  for (int32_t i = 0; i < args_->thread; i++) {
+    threads.push_back(std::thread([=]() {
+      trainThread(i);
+      finished_++;
+    }));
+  }
+  if (cluster_) {
+    syncThreads();
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+  if (metricsOut_.is_open()) {
+    double loss = 0.0;
+    for (auto& m : metrics_) {
+      loss += m.loss;
     }
-  } else {
-    trainThread(0);
+    writeMetrics(1.0, loss / metrics_.size());
+    metricsOut_.close();
+  }
+  if (reader.joinable()) {
+    reader.join();
+    free_.reset();
+    filled_.reset();
+    batches_.clear();
+  }
+}
+
+// Runs the averaging rounds while the threads train, until the threads of
+// every node are done. tokenCount counts the tokens of all the nodes, so that
+// the learning rate decays and training stops as on a single node.
+void FastText::syncThreads() {
+  const auto step = std::chrono::milliseconds(10);
+  int64_t reported = 0;
+  bool stop = false;
+  try {
+    while (!stop) {
+      bool done = finished_ == args_->thread;
+      const auto until = std::chrono::steady_clock::now() +
+        std::chrono::duration<double>(args_->syncInterval);
+      while (!done && std::chrono::steady_clock::now() < until) {
+        std::this_thread::sleep_for(step);
+        done = finished_ == args_->thread;
+      }
+      int64_t local = 0;
+      for (auto& m : metrics_) {
+        local += m.tokens;
+      }
+      const int64_t sent = local - reported;
+      const int64_t total = cluster_->sync(sent, done, stop);
+      tokenCount += total - sent;
+      reported = local;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   }
 }
 
@@ -654,7 +1664,7 @@ int FastText::getDimension() const {
 }
 
 bool FastText::isQuant() const {
-  return quant_;
+  return quant_ || half_;
 }
 
 }
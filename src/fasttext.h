@@ -10,19 +10,27 @@
 #ifndef FASTTEXT_FASTTEXT_H
 #define FASTTEXT_FASTTEXT_H
 
-#define FASTTEXT_VERSION 12 /* Version 1b */
+#define FASTTEXT_VERSION 14 /* Version 1d: half-precision matrices, word n-grams */
 #define FASTTEXT_FILEFORMAT_MAGIC_INT32 793712314
 
 #include <time.h>
 
 #include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
 #include <memory>
 #include <set>
 
 #include "args.h"
+#include "cluster.h"
+#include "corpuscache.h"
 #include "dictionary.h"
+#include "hmatrix.h"
+#include "linequeue.h"
 #include "matrix.h"
 #include "model.h"
+#include "nnindex.h"
 #include "qmatrix.h"
 #include "real.h"
 #include "utils.h"
@@ -30,6 +38,17 @@
 
 namespace fasttext {
 
+// Wall-clock counters of one training thread, published every lrUpdateRate
+// tokens and read by the metrics reports.
+struct ThreadMetrics {
+  std::atomic<int64_t> tokens;
+  std::atomic<int64_t> parseNs;
+  std::atomic<int64_t> updateNs;
+  std::atomic<double> loss;
+
+  ThreadMetrics() : tokens(0), parseNs(0), updateNs(0), loss(0.0) {}
+};
+
 class FastText {
  protected:
   std::shared_ptr<Args> args_;
@@ -41,17 +60,74 @@ class FastText {
   std::shared_ptr<QMatrix> qinput_;
   std::shared_ptr<QMatrix> qoutput_;
 
+  std::shared_ptr<HMatrix> hinput_;
+  std::shared_ptr<HMatrix> houtput_;
+
   std::shared_ptr<Model> model_;
+  // the model file, when the matrices were mapped from it
+  std::shared_ptr<utils::MappedFile> file_;
+
+  std::shared_ptr<CorpusCache> cache_;
+  std::shared_ptr<const NegativeSampler> sampler_;
+
+  // streaming from stdin: the reader thread fills batches from free_ and
+  // hands them to the workers through filled_
+  std::string sample_;
+  std::vector<LineBatch> batches_;
+  std::shared_ptr<LineQueue> free_;
+  std::shared_ptr<LineQueue> filled_;
+  std::atomic<bool> readerDone_;
+
+  // training on several nodes: the threads done, for the sync rounds
+  std::shared_ptr<Cluster> cluster_;
+  std::atomic<int32_t> finished_;
+
+  std::shared_ptr<NNIndex> nnindex_;
+  int32_t nprobe_;
+  // size and modification time of the model file, 0 when not loaded from one
+  uint64_t modelStamp_;
 
   std::atomic<int64_t> tokenCount;
-  clock_t start;
+  std::chrono::steady_clock::time_point start;
+  std::vector<ThreadMetrics> metrics_;
+  std::ofstream metricsOut_;
+  double lastMetrics_;
+  double elapsed() const;
+  void writeMetrics(real, real);
   void signModel(std::ostream&);
   bool checkModel(std::istream&);
 
   bool quant_;
+  bool half_;
   int32_t version;
 
   void startThreads();
+  void sentenceVector(std::istream&, Vector&, PredictBuffers&,
+                      std::minstd_rand&) const;
+  void syncThreads();
+  void readSample(std::istream&, int64_t);
+  void readStream();
+  bool nextLine(LineBatch*&, int64_t&, std::vector<int32_t>&,
+                std::vector<int32_t>&, int64_t&);
+  std::vector<int64_t> getTargetCounts() const;
+  void setTargets(Model&);
+  void testLine(const std::vector<int32_t>&, const std::vector<int32_t>&,
+                int32_t, PredictBuffers&, int64_t&, int64_t&, double&);
+  void printTest(int32_t, int64_t, int64_t, double) const;
+  void predictLine(const std::vector<int32_t>&, int32_t,
+                   std::vector<std::pair<real, std::string>>&,
+                   PredictBuffers&) const;
+  void printPredictions(const std::vector<std::pair<real, std::string>>&,
+                        bool, std::ostream&) const;
+  struct ChunkBuffers;
+  void forEachChunk(
+      const std::string&, int32_t,
+      const std::function<void(int32_t, std::istream&, std::ostream&)>&,
+      bool) const;
+  void predictRange(const std::vector<std::vector<int32_t>>&, int32_t,
+                    std::vector<std::vector<std::pair<real, int32_t>>>&,
+                    std::vector<std::vector<std::pair<real, std::string>>>&,
+                    int64_t, int64_t, bool) const;
 
  public:
   FastText();
@@ -73,7 +149,12 @@ class FastText {
   void saveOutput();
   void saveModel();
   void loadModel(std::istream&);
-  void loadModel(const std::string&);
+  void loadModel(std::istream&, std::shared_ptr<utils::MappedFile>);
+  void loadModel(const std::string&, bool mmap = false);
+  // Brings a loaded model in memory and through a first prediction, so that
+  // the first requests it serves do not pay for page faults and lazy setup.
+  void warmUp() const;
+  void loadDictionary(const std::string&);
   void printInfo(real, real);
 
   void supervised(
@@ -85,22 +166,63 @@ class FastText {
   void skipgram(Model&, real, const std::vector<int32_t>&);
   std::vector<int32_t> selectEmbeddings(int32_t) const;
   void getSentenceVector(std::istream&, Vector&);
+  // Batched, thread-safe getWordVector and getSentenceVector, writing one
+  // row of getDimension() values per item to out.
+  void getWordVectors(const std::vector<std::string>&, real*, int32_t) const;
+  void getSentenceVectors(const std::vector<std::string>&, real*,
+                          int32_t) const;
   void quantize(std::shared_ptr<Args>);
   void test(std::istream&, int32_t);
+  void test(const CorpusCache&, int32_t);
+  // test and predict on a file, with threads sharing its chunks
+  void test(const std::string&, int32_t, int32_t);
   void predict(std::istream&, int32_t, bool);
+  void predict(const CorpusCache&, int32_t, bool);
+  void predict(const std::string&, int32_t, bool, int32_t);
   void predict(
       std::istream&,
       int32_t,
       std::vector<std::pair<real, std::string>>&) const;
+  // Batch predictions, optionally spread over threads. Raw documents are
+  // single lines; as with the cli, a trailing newline adds the EOS token.
+  // Without normalize, softmax scores are logits rather than
+  // log-probabilities, which skips the partition function and allows the
+  // label index.
+  void predict(
+      const std::vector<std::vector<int32_t>>&,
+      int32_t,
+      std::vector<std::vector<std::pair<real, std::string>>>&,
+      int32_t threads = 1,
+      bool normalize = true) const;
+  void predict(
+      const std::vector<std::string>&,
+      int32_t,
+      std::vector<std::vector<std::pair<real, std::string>>>&,
+      int32_t threads = 1,
+      bool normalize = true) const;
+  // the same, writing k label ids and scores per document to arrays
+  void predict(
+      const std::vector<std::string>&,
+      int32_t,
+      int32_t*,
+      real*,
+      int32_t threads = 1,
+      bool normalize = true) const;
   void precomputeWordVectors(Matrix&);
   void
   findNN(const Matrix&, const Vector&, int32_t, const std::set<std::string>&);
+  void
+  findNN(const NNIndex&, const Vector&, int32_t, const std::set<std::string>&);
+  void loadNNIndex(const std::string&, int32_t);
+  void loadLabelIndex(const std::string&, int32_t);
   void nn(int32_t);
   void analogies(int32_t);
   void trainThread(int32_t);
   void train(std::shared_ptr<Args>);
 
   void loadVectors(std::string);
+  std::shared_ptr<CorpusCache> loadCache(const std::string&) const;
+  void saveCache(std::istream&, const std::string&, const std::string&) const;
   int getDimension() const;
   bool isQuant() const;
 };
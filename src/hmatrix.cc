@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "hmatrix.h"
+
+#include <assert.h>
+
+#include "kernels.h"
+
+namespace fasttext {
+
+HMatrix::HMatrix() : data_(nullptr), m_(0), n_(0), bf16_(false) {}
+
+HMatrix::HMatrix(const Matrix& mat, bool bf16)
+    : m_(mat.m_), n_(mat.n_), bf16_(bf16) {
+  data_ = (uint16_t*) utils::alignedAlloc(m_ * n_ * sizeof(uint16_t));
+  for (int64_t i = 0; i < m_; i++) {
+    const real* r = mat.row(i);
+    uint16_t* h = data_ + i * n_;
+    for (int64_t j = 0; j < n_; j++) {
+      h[j] = kernels::realToHalf(r[j], bf16_);
+    }
+  }
+}
+
+HMatrix::~HMatrix() {
+  if (!file_) {
+    utils::alignedFree(data_);
+  }
+}
+
+void HMatrix::addToVector(Vector& x, int64_t i) const {
+  assert(i >= 0);
+  assert(i < m_);
+  assert(x.size() == n_);
+  kernels::axpyHalf(1.0, row(i), x.data_, n_, bf16_);
+}
+
+real HMatrix::dotRow(const Vector& vec, int64_t i) const {
+  assert(i >= 0);
+  assert(i < m_);
+  assert(vec.size() == n_);
+  return kernels::dotHalf(row(i), vec.data_, n_, bf16_);
+}
+
+// The values start on a page boundary, as those of Matrix, so that they can
+// be mapped in place.
+void HMatrix::save(std::ostream& out) {
+  out.write((char*) &m_, sizeof(m_));
+  out.write((char*) &n_, sizeof(n_));
+  out.write((char*) &bf16_, sizeof(bf16_));
+  utils::pad(out, FASTTEXT_PAGE_SIZE);
+  out.write((char*) data_, m_ * n_ * sizeof(uint16_t));
+}
+
+void HMatrix::load(std::istream& in) {
+  load(in, nullptr);
+}
+
+void HMatrix::load(std::istream& in, std::shared_ptr<utils::MappedFile> file) {
+  in.read((char*) &m_, sizeof(m_));
+  in.read((char*) &n_, sizeof(n_));
+  in.read((char*) &bf16_, sizeof(bf16_));
+  utils::skipPad(in, FASTTEXT_PAGE_SIZE);
+  if (!file_) {
+    utils::alignedFree(data_);
+  }
+  file_.reset();
+  const int64_t bytes = m_ * n_ * sizeof(uint16_t);
+  if (file) {
+    data_ = (uint16_t*) file->at(in.tellg(), bytes);
+    file_ = file;
+    in.seekg(bytes, std::ios::cur);
+  } else {
+    data_ = (uint16_t*) utils::alignedAlloc(bytes);
+    in.read((char*) data_, bytes);
+  }
+}
+
+}
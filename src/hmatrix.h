@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_HMATRIX_H
+#define FASTTEXT_HMATRIX_H
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+
+#include "real.h"
+
+#include "matrix.h"
+#include "vector.h"
+
+#include "utils.h"
+
+namespace fasttext {
+
+// Read-only copy of a Matrix in 16-bit floats, IEEE fp16 or bf16: half the
+// memory and bandwidth of Matrix, without the training step of QMatrix.
+// Rows are widened to real in the kernels while they are read.
+class HMatrix {
+  protected:
+    uint16_t* data_;
+    int64_t m_;
+    int64_t n_;
+    bool bf16_;
+
+    // set when data_ points into a mapped model file
+    std::shared_ptr<utils::MappedFile> file_;
+
+  public:
+    HMatrix();
+    HMatrix(const Matrix&, bool);
+    HMatrix(const HMatrix&) = delete;
+    HMatrix& operator=(const HMatrix&) = delete;
+    ~HMatrix();
+
+    int64_t getM() const { return m_; }
+    int64_t getN() const { return n_; }
+    bool isBf16() const { return bf16_; }
+    const uint16_t* data() const { return data_; }
+    const uint16_t* row(int64_t i) const { return data_ + i * n_; }
+
+    void addToVector(Vector&, int64_t) const;
+    real dotRow(const Vector&, int64_t) const;
+
+    void save(std::ostream&);
+    void load(std::istream&);
+    void load(std::istream&, std::shared_ptr<utils::MappedFile>);
+};
+
+}
+
+#endif
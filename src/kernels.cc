@@ -0,0 +1,1027 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "kernels.h"
+
+#include <cmath>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define FASTTEXT_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define FASTTEXT_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace fasttext {
+
+namespace kernels {
+
+namespace {
+
+// The dot, axpy, update and gemv kernels are templates on the length of the
+// vectors: the instances with N > 0 ignore n and are compiled for N values,
+// which turns their loops into sequences of known length, with the masks of
+// the tails known too.
+template <int64_t N>
+real dotScalar(const real* x, const real* y, int64_t n) {
+  n = N > 0 ? N : n;
+  real d = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    d += x[i] * y[i];
+  }
+  return d;
+}
+
+template <int64_t N>
+void axpyScalar(real a, const real* x, real* y, int64_t n) {
+  n = N > 0 ? N : n;
+  for (int64_t i = 0; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+template <int64_t N>
+void updateScalar(real a, real* w, const real* h, real* g, int64_t n) {
+  n = N > 0 ? N : n;
+  for (int64_t i = 0; i < n; i++) {
+    g[i] += a * w[i];
+    w[i] += a * h[i];
+  }
+}
+
+template <int64_t N>
+void gemvScalar(const real* A, int64_t m, int64_t n, int64_t lda,
+                const real* x, real* y) {
+  n = N > 0 ? N : n;
+  for (int64_t i = 0; i < m; i++) {
+    y[i] = dotScalar<N>(A + i * lda, x, n);
+  }
+}
+
+real sumexpScalar(const real* x, real shift, int64_t n) {
+  real z = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    z += std::exp(x[i] - shift);
+  }
+  return z;
+}
+
+real dotHalfScalar(const uint16_t* x, const real* y, int64_t n, bool bf16) {
+  real d = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    d += halfToReal(x[i], bf16) * y[i];
+  }
+  return d;
+}
+
+void axpyHalfScalar(real a, const uint16_t* x, real* y, int64_t n,
+                    bool bf16) {
+  for (int64_t i = 0; i < n; i++) {
+    y[i] += a * halfToReal(x[i], bf16);
+  }
+}
+
+void gemvHalfScalar(const uint16_t* A, int64_t m, int64_t n, int64_t lda,
+                    const real* x, real* y, bool bf16) {
+  for (int64_t i = 0; i < m; i++) {
+    y[i] = dotHalfScalar(A + i * lda, x, n, bf16);
+  }
+}
+
+// The product quantization kernels take the codes of the subquantizers of a
+// row one after the other, and the 256 centroids of each subquantizer of 2
+// values one after the other.
+real dotCode2Scalar(const real* C, const uint8_t* code, const real* x,
+                    int64_t n) {
+  real d = 0.0;
+  for (int64_t j = 0; j < n; j++) {
+    const real* c = C + (j * 256 + code[j]) * 2;
+    d += x[2 * j] * c[0] + x[2 * j + 1] * c[1];
+  }
+  return d;
+}
+
+void axpyCode2Scalar(real a, const real* C, const uint8_t* code, real* y,
+                     int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    const real* c = C + (j * 256 + code[j]) * 2;
+    y[2 * j] += a * c[0];
+    y[2 * j + 1] += a * c[1];
+  }
+}
+
+void table2Scalar(const real* C, const real* x, int64_t n, real* table) {
+  for (int64_t j = 0; j < n * 256; j++) {
+    const real* xj = x + (j / 256) * 2;
+    table[j] = xj[0] * C[2 * j] + xj[1] * C[2 * j + 1];
+  }
+}
+
+#ifdef FASTTEXT_KERNELS_X86
+
+// exp(x) for x <= 0 as 2^k * p(r), with x = k ln(2) + r and the polynomial of
+// Cephes' expf, accurate to about 2 ulp. Inputs below ln(FLT_MIN) are clamped:
+// their exponentials are negligible next to exp(0) = 1, which the sums always
+// contain.
+const float EXP_MIN = -87.33654f;
+const float EXP_LOG2E = 1.44269504088896341f;
+const float EXP_LN2_HI = 0.693359375f;
+const float EXP_LN2_LO = -2.12194440e-4f;
+const float EXP_P[] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+                       4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+
+__attribute__((target("avx2,fma")))
+inline real hsumAvx2(__m256 v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+
+template <int64_t N>
+__attribute__((target("avx2,fma")))
+real dotAvx2(const real* x, const real* y, int64_t n) {
+  n = N > 0 ? N : n;
+  __m256 s0 = _mm256_setzero_ps();
+  __m256 s1 = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+    s1 = _mm256_fmadd_ps(
+        _mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), s1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+  }
+  real d = hsumAvx2(_mm256_add_ps(s0, s1));
+  for (; i < n; i++) {
+    d += x[i] * y[i];
+  }
+  return d;
+}
+
+template <int64_t N>
+__attribute__((target("avx2,fma")))
+void axpyAvx2(real a, const real* x, real* y, int64_t n) {
+  n = N > 0 ? N : n;
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(
+        y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+  }
+  for (; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+template <int64_t N>
+__attribute__((target("avx2,fma")))
+void updateAvx2(real a, real* w, const real* h, real* g, int64_t n) {
+  n = N > 0 ? N : n;
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 vw = _mm256_loadu_ps(w + i);
+    _mm256_storeu_ps(g + i, _mm256_fmadd_ps(va, vw, _mm256_loadu_ps(g + i)));
+    _mm256_storeu_ps(
+        w + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(h + i), vw));
+  }
+  for (; i < n; i++) {
+    g[i] += a * w[i];
+    w[i] += a * h[i];
+  }
+}
+
+// Four rows at a time, so that every load of x is shared by four products.
+template <int64_t N>
+__attribute__((target("avx2,fma")))
+void gemvAvx2(const real* A, int64_t m, int64_t n, int64_t lda,
+              const real* x, real* y) {
+  n = N > 0 ? N : n;
+  int64_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const real* a0 = A + i * lda;
+    const real* a1 = a0 + lda;
+    const real* a2 = a1 + lda;
+    const real* a3 = a2 + lda;
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    int64_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+      const __m256 vx = _mm256_loadu_ps(x + j);
+      s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + j), vx, s0);
+      s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a1 + j), vx, s1);
+      s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a2 + j), vx, s2);
+      s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a3 + j), vx, s3);
+    }
+    real d0 = hsumAvx2(s0), d1 = hsumAvx2(s1);
+    real d2 = hsumAvx2(s2), d3 = hsumAvx2(s3);
+    for (; j < n; j++) {
+      d0 += a0[j] * x[j];
+      d1 += a1[j] * x[j];
+      d2 += a2[j] * x[j];
+      d3 += a3[j] * x[j];
+    }
+    y[i] = d0;
+    y[i + 1] = d1;
+    y[i + 2] = d2;
+    y[i + 3] = d3;
+  }
+  for (; i < m; i++) {
+    y[i] = dotAvx2<N>(A + i * lda, x, n);
+  }
+}
+
+// The 16-bit kernels are instantiated once per format, so that the choice
+// between the two widenings is made outside of the loops.
+template <bool BF16>
+__attribute__((target("avx2,fma,f16c")))
+inline __m256 loadHalfAvx2(const uint16_t* x) {
+  const __m128i h = _mm_loadu_si128((const __m128i*) x);
+  if (BF16) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+  }
+  return _mm256_cvtph_ps(h);
+}
+
+template <bool BF16>
+__attribute__((target("avx2,fma,f16c")))
+real dotHalfAvx2(const uint16_t* x, const real* y, int64_t n) {
+  __m256 s0 = _mm256_setzero_ps();
+  __m256 s1 = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm256_fmadd_ps(loadHalfAvx2<BF16>(x + i), _mm256_loadu_ps(y + i), s0);
+    s1 = _mm256_fmadd_ps(
+        loadHalfAvx2<BF16>(x + i + 8), _mm256_loadu_ps(y + i + 8), s1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_fmadd_ps(loadHalfAvx2<BF16>(x + i), _mm256_loadu_ps(y + i), s0);
+  }
+  real d = hsumAvx2(_mm256_add_ps(s0, s1));
+  for (; i < n; i++) {
+    d += halfToReal(x[i], BF16) * y[i];
+  }
+  return d;
+}
+
+template <bool BF16>
+__attribute__((target("avx2,fma,f16c")))
+void axpyHalfAvx2(real a, const uint16_t* x, real* y, int64_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(
+          va, loadHalfAvx2<BF16>(x + i), _mm256_loadu_ps(y + i)));
+  }
+  for (; i < n; i++) {
+    y[i] += a * halfToReal(x[i], BF16);
+  }
+}
+
+template <bool BF16>
+__attribute__((target("avx2,fma,f16c")))
+void gemvHalfAvx2(const uint16_t* A, int64_t m, int64_t n, int64_t lda,
+                  const real* x, real* y) {
+  int64_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const uint16_t* a0 = A + i * lda;
+    const uint16_t* a1 = a0 + lda;
+    const uint16_t* a2 = a1 + lda;
+    const uint16_t* a3 = a2 + lda;
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    int64_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+      const __m256 vx = _mm256_loadu_ps(x + j);
+      s0 = _mm256_fmadd_ps(loadHalfAvx2<BF16>(a0 + j), vx, s0);
+      s1 = _mm256_fmadd_ps(loadHalfAvx2<BF16>(a1 + j), vx, s1);
+      s2 = _mm256_fmadd_ps(loadHalfAvx2<BF16>(a2 + j), vx, s2);
+      s3 = _mm256_fmadd_ps(loadHalfAvx2<BF16>(a3 + j), vx, s3);
+    }
+    real d0 = hsumAvx2(s0), d1 = hsumAvx2(s1);
+    real d2 = hsumAvx2(s2), d3 = hsumAvx2(s3);
+    for (; j < n; j++) {
+      d0 += halfToReal(a0[j], BF16) * x[j];
+      d1 += halfToReal(a1[j], BF16) * x[j];
+      d2 += halfToReal(a2[j], BF16) * x[j];
+      d3 += halfToReal(a3[j], BF16) * x[j];
+    }
+    y[i] = d0;
+    y[i + 1] = d1;
+    y[i + 2] = d2;
+    y[i + 3] = d3;
+  }
+  for (; i < m; i++) {
+    y[i] = dotHalfAvx2<BF16>(A + i * lda, x, n);
+  }
+}
+
+__attribute__((target("avx2,fma,f16c")))
+real dotHalfAvx2(const uint16_t* x, const real* y, int64_t n, bool bf16) {
+  return bf16 ? dotHalfAvx2<true>(x, y, n) : dotHalfAvx2<false>(x, y, n);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+void axpyHalfAvx2(real a, const uint16_t* x, real* y, int64_t n, bool bf16) {
+  if (bf16) {
+    axpyHalfAvx2<true>(a, x, y, n);
+  } else {
+    axpyHalfAvx2<false>(a, x, y, n);
+  }
+}
+
+__attribute__((target("avx2,fma,f16c")))
+void gemvHalfAvx2(const uint16_t* A, int64_t m, int64_t n, int64_t lda,
+                  const real* x, real* y, bool bf16) {
+  if (bf16) {
+    gemvHalfAvx2<true>(A, m, n, lda, x, y);
+  } else {
+    gemvHalfAvx2<false>(A, m, n, lda, x, y);
+  }
+}
+
+__attribute__((target("avx2,fma")))
+inline __m256 expAvx2(__m256 x) {
+  x = _mm256_max_ps(x, _mm256_set1_ps(EXP_MIN));
+  const __m256 k = _mm256_round_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(k, _mm256_set1_ps(EXP_LN2_HI), x);
+  r = _mm256_fnmadd_ps(k, _mm256_set1_ps(EXP_LN2_LO), r);
+  __m256 p = _mm256_set1_ps(EXP_P[0]);
+  for (int32_t i = 1; i < 6; i++) {
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P[i]));
+  }
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+  const __m256i e = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2,fma")))
+real sumexpAvx2(const real* x, real shift, int64_t n) {
+  const __m256 vs = _mm256_set1_ps(shift);
+  __m256 z = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    z = _mm256_add_ps(z, expAvx2(_mm256_sub_ps(_mm256_loadu_ps(x + i), vs)));
+  }
+  real s = hsumAvx2(z);
+  for (; i < n; i++) {
+    s += std::exp(x[i] - shift);
+  }
+  return s;
+}
+
+// The centroids of 2 values are gathered 4 at a time as doubles. The tails
+// are done in place: calling the scalar kernels from here costs more than the
+// gathers save, the upper halves of the registers being dirty.
+__attribute__((target("avx2,fma")))
+real dotCode2Avx2(const real* C, const uint8_t* code, const real* x,
+                  int64_t n) {
+  const __m128i offsets = _mm_setr_epi32(0, 256, 512, 768);
+  __m256 s = _mm256_setzero_ps();
+  int64_t j = 0;
+  for (; j + 4 <= n; j += 4) {
+    int32_t b;
+    std::memcpy(&b, code + j, sizeof(b));
+    const __m128i c = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(b));
+    const __m256d g = _mm256_i32gather_pd(
+        (const double*) (C + j * 512), _mm_add_epi32(c, offsets), 8);
+    s = _mm256_fmadd_ps(_mm256_castpd_ps(g), _mm256_loadu_ps(x + 2 * j), s);
+  }
+  real d = hsumAvx2(s);
+  for (; j < n; j++) {
+    const real* c = C + (j * 256 + code[j]) * 2;
+    d += x[2 * j] * c[0] + x[2 * j + 1] * c[1];
+  }
+  return d;
+}
+
+__attribute__((target("avx2,fma")))
+void axpyCode2Avx2(real a, const real* C, const uint8_t* code, real* y,
+                   int64_t n) {
+  const __m128i offsets = _mm_setr_epi32(0, 256, 512, 768);
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 4 <= n; j += 4) {
+    int32_t b;
+    std::memcpy(&b, code + j, sizeof(b));
+    const __m128i c = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(b));
+    const __m256d g = _mm256_i32gather_pd(
+        (const double*) (C + j * 512), _mm_add_epi32(c, offsets), 8);
+    _mm256_storeu_ps(y + 2 * j, _mm256_fmadd_ps(
+        va, _mm256_castpd_ps(g), _mm256_loadu_ps(y + 2 * j)));
+  }
+  for (; j < n; j++) {
+    const real* c = C + (j * 256 + code[j]) * 2;
+    y[2 * j] += a * c[0];
+    y[2 * j + 1] += a * c[1];
+  }
+}
+
+// The products with 8 centroids are added pairwise by hadd, whose halves are
+// then put back in order.
+__attribute__((target("avx2,fma")))
+void table2Avx2(const real* C, const real* x, int64_t n, real* table) {
+  for (int64_t j = 0; j < n; j++) {
+    double xj;
+    std::memcpy(&xj, x + 2 * j, sizeof(xj));
+    const __m256 vx = _mm256_castpd_ps(_mm256_set1_pd(xj));
+    const real* c = C + j * 512;
+    real* t = table + j * 256;
+    for (int64_t i = 0; i < 256; i += 8) {
+      const __m256 p0 = _mm256_mul_ps(_mm256_loadu_ps(c + 2 * i), vx);
+      const __m256 p1 = _mm256_mul_ps(_mm256_loadu_ps(c + 2 * i + 8), vx);
+      const __m256d h = _mm256_castps_pd(_mm256_hadd_ps(p0, p1));
+      _mm256_storeu_ps(t + i, _mm256_castpd_ps(_mm256_permute4x64_pd(h, 0xd8)));
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+inline __m512 expAvx512(__m512 x) {
+  x = _mm512_max_ps(x, _mm512_set1_ps(EXP_MIN));
+  const __m512 k = _mm512_roundscale_ps(
+      _mm512_mul_ps(x, _mm512_set1_ps(EXP_LOG2E)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(k, _mm512_set1_ps(EXP_LN2_HI), x);
+  r = _mm512_fnmadd_ps(k, _mm512_set1_ps(EXP_LN2_LO), r);
+  __m512 p = _mm512_set1_ps(EXP_P[0]);
+  for (int32_t i = 1; i < 6; i++) {
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P[i]));
+  }
+  p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+  return _mm512_scalef_ps(p, k);
+}
+
+__attribute__((target("avx512f")))
+real sumexpAvx512(const real* x, real shift, int64_t n) {
+  const __m512 vs = _mm512_set1_ps(shift);
+  __m512 z = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    z = _mm512_add_ps(z, expAvx512(_mm512_sub_ps(_mm512_loadu_ps(x + i), vs)));
+  }
+  if (i < n) {
+    const __mmask16 m = (__mmask16) ((1u << (n - i)) - 1);
+    const __m512 e = expAvx512(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, x + i), vs));
+    z = _mm512_add_ps(z, _mm512_maskz_mov_ps(m, e));
+  }
+  return _mm512_reduce_add_ps(z);
+}
+
+template <int64_t N>
+__attribute__((target("avx512f")))
+real dotAvx512(const real* x, const real* y, int64_t n) {
+  n = N > 0 ? N : n;
+  __m512 s0 = _mm512_setzero_ps();
+  __m512 s1 = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), s0);
+    s1 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), s1);
+  }
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), s0);
+  }
+  if (i < n) {
+    const __mmask16 k = (__mmask16) ((1u << (n - i)) - 1);
+    s1 = _mm512_fmadd_ps(
+        _mm512_maskz_loadu_ps(k, x + i), _mm512_maskz_loadu_ps(k, y + i), s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+template <int64_t N>
+__attribute__((target("avx512f")))
+void axpyAvx512(real a, const real* x, real* y, int64_t n) {
+  n = N > 0 ? N : n;
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(
+        y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+  }
+  if (i < n) {
+    const __mmask16 k = (__mmask16) ((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(y + i, k, _mm512_fmadd_ps(
+          va, _mm512_maskz_loadu_ps(k, x + i), _mm512_maskz_loadu_ps(k, y + i)));
+  }
+}
+
+template <int64_t N>
+__attribute__((target("avx512f")))
+void updateAvx512(real a, real* w, const real* h, real* g, int64_t n) {
+  n = N > 0 ? N : n;
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512 vw = _mm512_loadu_ps(w + i);
+    _mm512_storeu_ps(g + i, _mm512_fmadd_ps(va, vw, _mm512_loadu_ps(g + i)));
+    _mm512_storeu_ps(
+        w + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(h + i), vw));
+  }
+  if (i < n) {
+    const __mmask16 k = (__mmask16) ((1u << (n - i)) - 1);
+    const __m512 vw = _mm512_maskz_loadu_ps(k, w + i);
+    _mm512_mask_storeu_ps(g + i, k,
+        _mm512_fmadd_ps(va, vw, _mm512_maskz_loadu_ps(k, g + i)));
+    _mm512_mask_storeu_ps(w + i, k,
+        _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(k, h + i), vw));
+  }
+}
+
+template <int64_t N>
+__attribute__((target("avx512f")))
+void gemvAvx512(const real* A, int64_t m, int64_t n, int64_t lda,
+                const real* x, real* y) {
+  n = N > 0 ? N : n;
+  int64_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const real* a0 = A + i * lda;
+    const real* a1 = a0 + lda;
+    const real* a2 = a1 + lda;
+    const real* a3 = a2 + lda;
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    int64_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+      const __m512 vx = _mm512_loadu_ps(x + j);
+      s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a0 + j), vx, s0);
+      s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a1 + j), vx, s1);
+      s2 = _mm512_fmadd_ps(_mm512_loadu_ps(a2 + j), vx, s2);
+      s3 = _mm512_fmadd_ps(_mm512_loadu_ps(a3 + j), vx, s3);
+    }
+    if (j < n) {
+      const __mmask16 k = (__mmask16) ((1u << (n - j)) - 1);
+      const __m512 vx = _mm512_maskz_loadu_ps(k, x + j);
+      s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(k, a0 + j), vx, s0);
+      s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(k, a1 + j), vx, s1);
+      s2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(k, a2 + j), vx, s2);
+      s3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(k, a3 + j), vx, s3);
+    }
+    y[i] = _mm512_reduce_add_ps(s0);
+    y[i + 1] = _mm512_reduce_add_ps(s1);
+    y[i + 2] = _mm512_reduce_add_ps(s2);
+    y[i + 3] = _mm512_reduce_add_ps(s3);
+  }
+  for (; i < m; i++) {
+    y[i] = dotAvx512<N>(A + i * lda, x, n);
+  }
+}
+
+// The 16-bit kernels use the masked 16-bit loads of AVX-512BW for the tails.
+template <bool BF16>
+__attribute__((target("avx512f,avx512bw")))
+inline __m512 widenHalfAvx512(__m256i h) {
+  if (BF16) {
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+  }
+  return _mm512_cvtph_ps(h);
+}
+
+template <bool BF16>
+__attribute__((target("avx512f,avx512bw")))
+inline __m512 loadHalfAvx512(const uint16_t* x) {
+  return widenHalfAvx512<BF16>(_mm256_loadu_si256((const __m256i*) x));
+}
+
+// the first n < 16 values of x, the others are zeros
+template <bool BF16>
+__attribute__((target("avx512f,avx512bw")))
+inline __m512 loadHalfTailAvx512(const uint16_t* x, int64_t n) {
+  const __mmask32 k = (__mmask32) ((1u << n) - 1);
+  return widenHalfAvx512<BF16>(
+      _mm512_castsi512_si256(_mm512_maskz_loadu_epi16(k, x)));
+}
+
+template <bool BF16>
+__attribute__((target("avx512f,avx512bw")))
+real dotHalfAvx512(const uint16_t* x, const real* y, int64_t n) {
+  __m512 s0 = _mm512_setzero_ps();
+  __m512 s1 = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    s0 = _mm512_fmadd_ps(loadHalfAvx512<BF16>(x + i), _mm512_loadu_ps(y + i), s0);
+    s1 = _mm512_fmadd_ps(
+        loadHalfAvx512<BF16>(x + i + 16), _mm512_loadu_ps(y + i + 16), s1);
+  }
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm512_fmadd_ps(loadHalfAvx512<BF16>(x + i), _mm512_loadu_ps(y + i), s0);
+  }
+  if (i < n) {
+    const __mmask16 k = (__mmask16) ((1u << (n - i)) - 1);
+    s1 = _mm512_fmadd_ps(loadHalfTailAvx512<BF16>(x + i, n - i),
+                         _mm512_maskz_loadu_ps(k, y + i), s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+template <bool BF16>
+__attribute__((target("avx512f,avx512bw")))
+void axpyHalfAvx512(real a, const uint16_t* x, real* y, int64_t n) {
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(
+          va, loadHalfAvx512<BF16>(x + i), _mm512_loadu_ps(y + i)));
+  }
+  if (i < n) {
+    const __mmask16 k = (__mmask16) ((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(y + i, k, _mm512_fmadd_ps(
+          va, loadHalfTailAvx512<BF16>(x + i, n - i),
+          _mm512_maskz_loadu_ps(k, y + i)));
+  }
+}
+
+template <bool BF16>
+__attribute__((target("avx512f,avx512bw")))
+void gemvHalfAvx512(const uint16_t* A, int64_t m, int64_t n, int64_t lda,
+                    const real* x, real* y) {
+  int64_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const uint16_t* a0 = A + i * lda;
+    const uint16_t* a1 = a0 + lda;
+    const uint16_t* a2 = a1 + lda;
+    const uint16_t* a3 = a2 + lda;
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    int64_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+      const __m512 vx = _mm512_loadu_ps(x + j);
+      s0 = _mm512_fmadd_ps(loadHalfAvx512<BF16>(a0 + j), vx, s0);
+      s1 = _mm512_fmadd_ps(loadHalfAvx512<BF16>(a1 + j), vx, s1);
+      s2 = _mm512_fmadd_ps(loadHalfAvx512<BF16>(a2 + j), vx, s2);
+      s3 = _mm512_fmadd_ps(loadHalfAvx512<BF16>(a3 + j), vx, s3);
+    }
+    if (j < n) {
+      const __mmask16 k = (__mmask16) ((1u << (n - j)) - 1);
+      const __m512 vx = _mm512_maskz_loadu_ps(k, x + j);
+      s0 = _mm512_fmadd_ps(loadHalfTailAvx512<BF16>(a0 + j, n - j), vx, s0);
+      s1 = _mm512_fmadd_ps(loadHalfTailAvx512<BF16>(a1 + j, n - j), vx, s1);
+      s2 = _mm512_fmadd_ps(loadHalfTailAvx512<BF16>(a2 + j, n - j), vx, s2);
+      s3 = _mm512_fmadd_ps(loadHalfTailAvx512<BF16>(a3 + j, n - j), vx, s3);
+    }
+    y[i] = _mm512_reduce_add_ps(s0);
+    y[i + 1] = _mm512_reduce_add_ps(s1);
+    y[i + 2] = _mm512_reduce_add_ps(s2);
+    y[i + 3] = _mm512_reduce_add_ps(s3);
+  }
+  for (; i < m; i++) {
+    y[i] = dotHalfAvx512<BF16>(A + i * lda, x, n);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+real dotHalfAvx512(const uint16_t* x, const real* y, int64_t n, bool bf16) {
+  return bf16 ? dotHalfAvx512<true>(x, y, n) : dotHalfAvx512<false>(x, y, n);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void axpyHalfAvx512(real a, const uint16_t* x, real* y, int64_t n,
+                    bool bf16) {
+  if (bf16) {
+    axpyHalfAvx512<true>(a, x, y, n);
+  } else {
+    axpyHalfAvx512<false>(a, x, y, n);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void gemvHalfAvx512(const uint16_t* A, int64_t m, int64_t n, int64_t lda,
+                    const real* x, real* y, bool bf16) {
+  if (bf16) {
+    gemvHalfAvx512<true>(A, m, n, lda, x, y);
+  } else {
+    gemvHalfAvx512<false>(A, m, n, lda, x, y);
+  }
+}
+
+__attribute__((target("avx512f")))
+real dotCode2Avx512(const real* C, const uint8_t* code, const real* x,
+                    int64_t n) {
+  const __m256i offsets = _mm256_setr_epi32(
+      0, 256, 512, 768, 1024, 1280, 1536, 1792);
+  __m512 s = _mm512_setzero_ps();
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    const __m256i c = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64((const __m128i*) (code + j)));
+    const __m512d g = _mm512_i32gather_pd(
+        _mm256_add_epi32(c, offsets), (const double*) (C + j * 512), 8);
+    s = _mm512_fmadd_ps(_mm512_castpd_ps(g), _mm512_loadu_ps(x + 2 * j), s);
+  }
+  real d = _mm512_reduce_add_ps(s);
+  for (; j < n; j++) {
+    const real* c = C + (j * 256 + code[j]) * 2;
+    d += x[2 * j] * c[0] + x[2 * j + 1] * c[1];
+  }
+  return d;
+}
+
+__attribute__((target("avx512f")))
+void axpyCode2Avx512(real a, const real* C, const uint8_t* code, real* y,
+                     int64_t n) {
+  const __m256i offsets = _mm256_setr_epi32(
+      0, 256, 512, 768, 1024, 1280, 1536, 1792);
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    const __m256i c = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64((const __m128i*) (code + j)));
+    const __m512d g = _mm512_i32gather_pd(
+        _mm256_add_epi32(c, offsets), (const double*) (C + j * 512), 8);
+    _mm512_storeu_ps(y + 2 * j, _mm512_fmadd_ps(
+        va, _mm512_castpd_ps(g), _mm512_loadu_ps(y + 2 * j)));
+  }
+  for (; j < n; j++) {
+    const real* c = C + (j * 256 + code[j]) * 2;
+    y[2 * j] += a * c[0];
+    y[2 * j + 1] += a * c[1];
+  }
+}
+
+// The products with 16 centroids are split into their even and odd values,
+// which are then added.
+__attribute__((target("avx512f")))
+void table2Avx512(const real* C, const real* x, int64_t n, real* table) {
+  const __m512i even = _mm512_setr_epi32(
+      0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+  const __m512i odd = _mm512_add_epi32(even, _mm512_set1_epi32(1));
+  for (int64_t j = 0; j < n; j++) {
+    double xj;
+    std::memcpy(&xj, x + 2 * j, sizeof(xj));
+    const __m512 vx = _mm512_castpd_ps(_mm512_set1_pd(xj));
+    const real* c = C + j * 512;
+    real* t = table + j * 256;
+    for (int64_t i = 0; i < 256; i += 16) {
+      const __m512 p0 = _mm512_mul_ps(_mm512_loadu_ps(c + 2 * i), vx);
+      const __m512 p1 = _mm512_mul_ps(_mm512_loadu_ps(c + 2 * i + 16), vx);
+      _mm512_storeu_ps(t + i, _mm512_add_ps(
+          _mm512_permutex2var_ps(p0, even, p1),
+          _mm512_permutex2var_ps(p0, odd, p1)));
+    }
+  }
+}
+
+#endif
+
+#ifdef FASTTEXT_KERNELS_NEON
+
+template <int64_t N>
+real dotNeon(const real* x, const real* y, int64_t n) {
+  n = N > 0 ? N : n;
+  float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = vfmaq_f32(s0, vld1q_f32(x + i), vld1q_f32(y + i));
+    s1 = vfmaq_f32(s1, vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+  }
+  for (; i + 4 <= n; i += 4) {
+    s0 = vfmaq_f32(s0, vld1q_f32(x + i), vld1q_f32(y + i));
+  }
+  real d = vaddvq_f32(vaddq_f32(s0, s1));
+  for (; i < n; i++) {
+    d += x[i] * y[i];
+  }
+  return d;
+}
+
+template <int64_t N>
+void axpyNeon(real a, const real* x, real* y, int64_t n) {
+  n = N > 0 ? N : n;
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(y + i, vfmaq_n_f32(vld1q_f32(y + i), vld1q_f32(x + i), a));
+  }
+  for (; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+template <int64_t N>
+void updateNeon(real a, real* w, const real* h, real* g, int64_t n) {
+  n = N > 0 ? N : n;
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const float32x4_t vw = vld1q_f32(w + i);
+    vst1q_f32(g + i, vfmaq_n_f32(vld1q_f32(g + i), vw, a));
+    vst1q_f32(w + i, vfmaq_n_f32(vw, vld1q_f32(h + i), a));
+  }
+  for (; i < n; i++) {
+    g[i] += a * w[i];
+    w[i] += a * h[i];
+  }
+}
+
+template <int64_t N>
+void gemvNeon(const real* A, int64_t m, int64_t n, int64_t lda,
+              const real* x, real* y) {
+  n = N > 0 ? N : n;
+  for (int64_t i = 0; i < m; i++) {
+    y[i] = dotNeon<N>(A + i * lda, x, n);
+  }
+}
+
+template <bool BF16>
+inline float32x4_t loadHalfNeon(const uint16_t* x) {
+  const uint16x4_t h = vld1_u16(x);
+  if (BF16) {
+    return vreinterpretq_f32_u32(vshll_n_u16(h, 16));
+  }
+  return vcvt_f32_f16(vreinterpret_f16_u16(h));
+}
+
+template <bool BF16>
+real dotHalfNeon(const uint16_t* x, const real* y, int64_t n) {
+  float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = vfmaq_f32(s0, loadHalfNeon<BF16>(x + i), vld1q_f32(y + i));
+    s1 = vfmaq_f32(s1, loadHalfNeon<BF16>(x + i + 4), vld1q_f32(y + i + 4));
+  }
+  for (; i + 4 <= n; i += 4) {
+    s0 = vfmaq_f32(s0, loadHalfNeon<BF16>(x + i), vld1q_f32(y + i));
+  }
+  real d = vaddvq_f32(vaddq_f32(s0, s1));
+  for (; i < n; i++) {
+    d += halfToReal(x[i], BF16) * y[i];
+  }
+  return d;
+}
+
+template <bool BF16>
+void axpyHalfNeon(real a, const uint16_t* x, real* y, int64_t n) {
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(y + i, vfmaq_n_f32(vld1q_f32(y + i), loadHalfNeon<BF16>(x + i), a));
+  }
+  for (; i < n; i++) {
+    y[i] += a * halfToReal(x[i], BF16);
+  }
+}
+
+real dotHalfNeon(const uint16_t* x, const real* y, int64_t n, bool bf16) {
+  return bf16 ? dotHalfNeon<true>(x, y, n) : dotHalfNeon<false>(x, y, n);
+}
+
+void axpyHalfNeon(real a, const uint16_t* x, real* y, int64_t n, bool bf16) {
+  if (bf16) {
+    axpyHalfNeon<true>(a, x, y, n);
+  } else {
+    axpyHalfNeon<false>(a, x, y, n);
+  }
+}
+
+void gemvHalfNeon(const uint16_t* A, int64_t m, int64_t n, int64_t lda,
+                  const real* x, real* y, bool bf16) {
+  for (int64_t i = 0; i < m; i++) {
+    y[i] = dotHalfNeon(A + i * lda, x, n, bf16);
+  }
+}
+
+#endif
+
+template <int64_t N>
+Kernels plain() {
+  return Kernels{
+      "scalar", dotScalar<N>, axpyScalar<N>, gemvScalar<N>, updateScalar<N>,
+      sumexpScalar, dotHalfScalar, axpyHalfScalar, gemvHalfScalar,
+      dotCode2Scalar, axpyCode2Scalar, table2Scalar};
+}
+
+template <int64_t N>
+Kernels select() {
+#ifdef FASTTEXT_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    Kernels k{
+        "avx512", dotAvx512<N>, axpyAvx512<N>, gemvAvx512<N>, updateAvx512<N>,
+        sumexpAvx512, dotHalfAvx2, axpyHalfAvx2, gemvHalfAvx2,
+        dotCode2Avx512, axpyCode2Avx512, table2Avx512};
+    if (__builtin_cpu_supports("avx512bw")) {
+      k.dotHalf = dotHalfAvx512;
+      k.axpyHalf = axpyHalfAvx512;
+      k.gemvHalf = gemvHalfAvx512;
+    }
+    return k;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    Kernels k{
+        "avx2", dotAvx2<N>, axpyAvx2<N>, gemvAvx2<N>, updateAvx2<N>,
+        sumexpAvx2, dotHalfScalar, axpyHalfScalar, gemvHalfScalar,
+        dotCode2Avx2, axpyCode2Avx2, table2Avx2};
+    if (__builtin_cpu_supports("f16c")) {
+      k.dotHalf = dotHalfAvx2;
+      k.axpyHalf = axpyHalfAvx2;
+      k.gemvHalf = gemvHalfAvx2;
+    }
+    return k;
+  }
+#endif
+#ifdef FASTTEXT_KERNELS_NEON
+  return Kernels{
+      "neon", dotNeon<N>, axpyNeon<N>, gemvNeon<N>, updateNeon<N>,
+      sumexpScalar, dotHalfNeon, axpyHalfNeon, gemvHalfNeon,
+      dotCode2Scalar, axpyCode2Scalar, table2Scalar};
+#endif
+  return plain<N>();
+}
+
+template <int64_t N>
+const Kernels& fixed() {
+  static const Kernels k = select<N>();
+  return k;
+}
+
+}
+
+const Kernels& scalar() {
+  static const Kernels k = plain<0>();
+  return k;
+}
+
+real halfToReal(uint16_t h, bool bf16) {
+  uint32_t b;
+  if (bf16) {
+    b = uint32_t(h) << 16;
+  } else {
+    const uint32_t sign = uint32_t(h & 0x8000) << 16;
+    const uint32_t e = (h >> 10) & 0x1f;
+    const uint32_t m = h & 0x3ff;
+    if (e == 0) {
+      // zero or subnormal, m * 2^-24
+      const float f = std::ldexp(float(m), -24);
+      std::memcpy(&b, &f, sizeof(b));
+      b |= sign;
+    } else if (e == 31) {
+      b = sign | 0x7f800000 | (m << 13);
+    } else {
+      b = sign | ((e + 112) << 23) | (m << 13);
+    }
+  }
+  float f;
+  std::memcpy(&f, &b, sizeof(f));
+  return f;
+}
+
+uint16_t realToHalf(real x, bool bf16) {
+  const float xf = x;
+  uint32_t b;
+  std::memcpy(&b, &xf, sizeof(b));
+  if (bf16) {
+    if ((b & 0x7fffffff) > 0x7f800000) {
+      return (b >> 16) | 0x40;
+    }
+    return (b + 0x7fff + ((b >> 16) & 1)) >> 16;
+  }
+  const uint32_t sign = (b >> 16) & 0x8000;
+  b &= 0x7fffffff;
+  if (b >= 0x47800000) {
+    // 2^16 and above, infinities and NaNs
+    return sign | (b > 0x7f800000 ? 0x7e00 : 0x7c00);
+  }
+  if (b < 0x38800000) {
+    // below 2^-14, the result is subnormal: adding 0.5 makes the float unit
+    // round the bits that fit in the fp16 mantissa
+    float f;
+    std::memcpy(&f, &b, sizeof(f));
+    f += 0.5f;
+    std::memcpy(&b, &f, sizeof(b));
+    return sign | (b - 0x3f000000);
+  }
+  b += 0xc8000fff + ((b >> 13) & 1);
+  return sign | (b >> 13);
+}
+
+const Kernels& get() {
+  return fixed<0>();
+}
+
+const Kernels& get(int64_t n) {
+  switch (n) {
+    case 50:
+      return fixed<50>();
+    case 100:
+      return fixed<100>();
+    default:
+      return get();
+  }
+}
+
+}
+
+}
@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_KERNELS_H
+#define FASTTEXT_KERNELS_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include "real.h"
+
+namespace fasttext {
+
+namespace kernels {
+
+// Dense vector primitives behind Matrix and Vector. One implementation per
+// instruction set is compiled in and the best one supported by the running
+// CPU is picked on first use (AVX-512, AVX2+FMA, NEON, or plain loops).
+struct Kernels {
+  const char* name;
+  // returns sum_i x[i] * y[i]
+  real (*dot)(const real* x, const real* y, int64_t n);
+  // y += a * x
+  void (*axpy)(real a, const real* x, real* y, int64_t n);
+  // y[i] = dot(A + i * lda, x, n) for the m rows of A
+  void (*gemv)(const real* A, int64_t m, int64_t n, int64_t lda,
+               const real* x, real* y);
+  // g += a * w, then w += a * h, in a single pass over the row w
+  void (*update)(real a, real* w, const real* h, real* g, int64_t n);
+  // returns sum_i exp(x[i] - shift), for shift >= max_i x[i]
+  real (*sumexp)(const real* x, real shift, int64_t n);
+  // dot, axpy and gemv with x (resp. A) made of 16-bit floats, bf16 when
+  // bf16 is set and IEEE fp16 otherwise, widened to real on the fly
+  real (*dotHalf)(const uint16_t* x, const real* y, int64_t n, bool bf16);
+  void (*axpyHalf)(real a, const uint16_t* x, real* y, int64_t n, bool bf16);
+  void (*gemvHalf)(const uint16_t* A, int64_t m, int64_t n, int64_t lda,
+                   const real* x, real* y, bool bf16);
+  // product quantization with n subquantizers of 2 values, their 256
+  // centroids each in C: dotCode2 returns the dot product of x with the
+  // centroids picked by code, axpyCode2 adds a times them to y, and table2
+  // sets table[j * 256 + i] to the dot product of centroid i of subquantizer
+  // j with x
+  real (*dotCode2)(const real* C, const uint8_t* code, const real* x,
+                   int64_t n);
+  void (*axpyCode2)(real a, const real* C, const uint8_t* code, real* y,
+                    int64_t n);
+  void (*table2)(const real* C, const real* x, int64_t n, real* table);
+};
+
+const Kernels& get();
+const Kernels& scalar();
+// The kernels of get() with dot, axpy, update and gemv compiled for vectors
+// of n values when n is one of the usual dimensions, 50 or 100, or the
+// kernels of get() otherwise. Callers working on rows of a fixed size pick
+// them once. Longer rows gain nothing from it, their loops being dominated
+// by the loads of the rows.
+const Kernels& get(int64_t n);
+
+// Conversions of a single value between real and fp16 or bf16, rounding to
+// the nearest even.
+real halfToReal(uint16_t h, bool bf16);
+uint16_t realToHalf(real x, bool bf16);
+
+inline real dot(const real* x, const real* y, int64_t n) {
+  return get().dot(x, y, n);
+}
+
+inline void axpy(real a, const real* x, real* y, int64_t n) {
+  get().axpy(a, x, y, n);
+}
+
+inline void gemv(const real* A, int64_t m, int64_t n, int64_t lda,
+                 const real* x, real* y) {
+  get().gemv(A, m, n, lda, x, y);
+}
+
+inline void update(real a, real* w, const real* h, real* g, int64_t n) {
+  get().update(a, w, h, g, n);
+}
+
+inline real sumexp(const real* x, real shift, int64_t n) {
+  return get().sumexp(x, shift, n);
+}
+
+inline real dotHalf(const uint16_t* x, const real* y, int64_t n, bool bf16) {
+  return get().dotHalf(x, y, n, bf16);
+}
+
+inline void axpyHalf(real a, const uint16_t* x, real* y, int64_t n,
+                     bool bf16) {
+  get().axpyHalf(a, x, y, n, bf16);
+}
+
+inline void gemvHalf(const uint16_t* A, int64_t m, int64_t n, int64_t lda,
+                     const real* x, real* y, bool bf16) {
+  get().gemvHalf(A, m, n, lda, x, y, bf16);
+}
+
+inline real dotCode2(const real* C, const uint8_t* code, const real* x,
+                     int64_t n) {
+  return get().dotCode2(C, code, x, n);
+}
+
+inline void axpyCode2(real a, const real* C, const uint8_t* code, real* y,
+                      int64_t n) {
+  get().axpyCode2(a, C, code, y, n);
+}
+
+inline void table2(const real* C, const real* x, int64_t n, real* table) {
+  get().table2(C, x, n, table);
+}
+
+// C[i * p + j] = dot(A + i * n, B + j * ldb, n) for the m rows of A and the
+// p rows of B. B is walked in blocks small enough to stay in cache while all
+// the rows of A are multiplied with them.
+inline void gemm(const real* A, int64_t m, const real* B, int64_t p,
+                 int64_t n, int64_t ldb, real* C) {
+  const Kernels& k = get(n);
+  const int64_t block = std::max<int64_t>(1, 32768 / (ldb * sizeof(real)));
+  for (int64_t j = 0; j < p; j += block) {
+    const int64_t nj = std::min(block, p - j);
+    for (int64_t i = 0; i < m; i++) {
+      k.gemv(B + j * ldb, nj, n, ldb, A + i * n, C + i * p + j);
+    }
+  }
+}
+
+// The same as gemm with B made of 16-bit floats.
+inline void gemmHalf(const real* A, int64_t m, const uint16_t* B, int64_t p,
+                     int64_t n, int64_t ldb, real* C, bool bf16) {
+  const int64_t block = std::max<int64_t>(1, 32768 / (ldb * sizeof(uint16_t)));
+  for (int64_t j = 0; j < p; j += block) {
+    const int64_t nj = std::min(block, p - j);
+    for (int64_t i = 0; i < m; i++) {
+      get().gemvHalf(B + j * ldb, nj, n, ldb, A + i * n, C + i * p + j, bf16);
+    }
+  }
+}
+
+// Hints the cache to start loading the n bytes at p.
+inline void prefetch(const void* p, int64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+  const char* c = static_cast<const char*>(p);
+  for (int64_t i = 0; i < n; i += 64) {
+    __builtin_prefetch(c + i, 1);
+  }
+#endif
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "linequeue.h"
+
+#include <assert.h>
+
+namespace fasttext {
+
+void LineBatch::clear() {
+  words.clear();
+  labels.clear();
+  wordEnds.clear();
+  labelEnds.clear();
+  ntokens = 0;
+}
+
+void LineBatch::addLine(const std::vector<int32_t>& lineWords,
+                        const std::vector<int32_t>& lineLabels,
+                        int64_t lineTokens) {
+  words.insert(words.end(), lineWords.begin(), lineWords.end());
+  labels.insert(labels.end(), lineLabels.begin(), lineLabels.end());
+  wordEnds.push_back(words.size());
+  labelEnds.push_back(labels.size());
+  ntokens += lineTokens;
+}
+
+void LineBatch::getLine(int64_t i, std::vector<int32_t>& lineWords,
+                        std::vector<int32_t>& lineLabels) const {
+  assert(i >= 0 && i < size());
+  const int64_t wb = i > 0 ? wordEnds[i - 1] : 0;
+  const int64_t lb = i > 0 ? labelEnds[i - 1] : 0;
+  lineWords.assign(words.begin() + wb, words.begin() + wordEnds[i]);
+  lineLabels.assign(labels.begin() + lb, labels.begin() + labelEnds[i]);
+}
+
+// The capacity is rounded up to a power of two.
+LineQueue::LineQueue(int64_t capacity) : head_(0), tail_(0) {
+  int64_t size = 2;
+  while (size < capacity) {
+    size *= 2;
+  }
+  cells_ = std::vector<cell>(size);
+  for (int64_t i = 0; i < size; i++) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+    cells_[i].batch = nullptr;
+  }
+  mask_ = size - 1;
+}
+
+bool LineQueue::tryPush(LineBatch* batch) {
+  int64_t pos = tail_.load(std::memory_order_relaxed);
+  while (true) {
+    cell& c = cells_[pos & mask_];
+    int64_t seq = c.sequence.load(std::memory_order_acquire);
+    int64_t diff = seq - pos;
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        c.batch = batch;
+        c.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool LineQueue::tryPop(LineBatch*& batch) {
+  int64_t pos = head_.load(std::memory_order_relaxed);
+  while (true) {
+    cell& c = cells_[pos & mask_];
+    int64_t seq = c.sequence.load(std::memory_order_acquire);
+    int64_t diff = seq - (pos + 1);
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        batch = c.batch;
+        c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+}
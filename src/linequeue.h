@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_LINEQUEUE_H
+#define FASTTEXT_LINEQUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace fasttext {
+
+// Lines tokenized by the reader thread, handed to a worker as one unit. The
+// words (resp. labels) of line i are words[wordEnds[i - 1]] up to
+// words[wordEnds[i]] (resp. labelEnds).
+struct LineBatch {
+  std::vector<int32_t> words;
+  std::vector<int32_t> labels;
+  std::vector<int64_t> wordEnds;
+  std::vector<int64_t> labelEnds;
+  // tokens read from the input for these lines, before any discarding
+  int64_t ntokens;
+
+  void clear();
+  void addLine(const std::vector<int32_t>&, const std::vector<int32_t>&,
+               int64_t);
+  int64_t size() const { return wordEnds.size(); }
+  void getLine(int64_t, std::vector<int32_t>&, std::vector<int32_t>&) const;
+};
+
+// Bounded multi-producer multi-consumer queue of batch pointers, as a ring
+// of slots tagged with sequence numbers: push and pop each claim a slot with
+// a single compare-and-swap and never take a lock.
+class LineQueue {
+  protected:
+    struct cell {
+      std::atomic<int64_t> sequence;
+      LineBatch* batch;
+    };
+
+    std::vector<cell> cells_;
+    int64_t mask_;
+    std::atomic<int64_t> head_;
+    std::atomic<int64_t> tail_;
+
+  public:
+    explicit LineQueue(int64_t);
+    LineQueue(const LineQueue&) = delete;
+    LineQueue& operator=(const LineQueue&) = delete;
+
+    bool tryPush(LineBatch*);
+    bool tryPop(LineBatch*&);
+};
+
+}
+
+#endif
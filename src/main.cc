@@ -27,6 +27,7 @@ void printUsage() {
     << "  cbow                    train a cbow model\n"
     << "  print-word-vectors      print word vectors given a trained model\n"
     << "  print-sentence-vectors  print sentence vectors given a trained model\n"
+    << "  cache                   tokenize a file once for test and predict\n"
     << "  nn                      query for nearest neighbors\n"
     << "  analogies               query for analogies\n"
     << std::endl;
@@ -40,19 +41,35 @@ void printQuantizeUsage() {
 
 void printTestUsage() {
   std::cerr
-    << "usage: fasttext test <model> <test-data> [<k>]\n\n"
+    << "usage: fasttext test <model> <test-data> [<k>] [-thread <n>]\n\n"
     << "  <model>      model filename\n"
-    << "  <test-data>  test data filename (if -, read from stdin)\n"
+    << "  <test-data>  test data filename or cache (if -, read from stdin)\n"
     << "  <k>          (optional; 1 by default) predict top k labels\n"
+    << "  -thread      (optional; 1 by default) threads sharing a test file\n"
+    << std::endl;
+}
+
+void printCacheUsage() {
+  std::cerr
+    << "usage: fasttext cache <model> <input> <output>\n\n"
+    << "  <model>      model filename\n"
+    << "  <input>      text filename (if -, read from stdin)\n"
+    << "  <output>     cache filename, usable as <test-data> for test and predict\n"
     << std::endl;
 }
 
 void printPredictUsage() {
   std::cerr
-    << "usage: fasttext predict[-prob] <model> <test-data> [<k>]\n\n"
+    << "usage: fasttext predict[-prob] <model> <test-data> [<k>] [<nprobe>]\n"
+    << "                               [-thread <n>]\n\n"
     << "  <model>      model filename\n"
-    << "  <test-data>  test data filename (if -, read from stdin)\n"
+    << "  <test-data>  test data filename or cache (if -, read from stdin)\n"
     << "  <k>          (optional; 1 by default) predict top k labels\n"
+    << "  <nprobe>     (optional; exact search by default) predict only: search\n"
+    << "               the index of the labels <model>.labels.nn, built if\n"
+    << "               missing, probing nprobe lists\n"
+    << "  -thread      (optional; 1 by default) threads sharing a test file,\n"
+    << "               whose predictions are still printed in order\n"
     << std::endl;
 }
 
@@ -96,21 +113,39 @@ void quantize(const std::vector<std::string>& args) {
 
 void printNNUsage() {
   std::cout
-    << "usage: fasttext nn <model> <k>\n\n"
+    << "usage: fasttext nn <model> <k> <nprobe>\n\n"
     << "  <model>      model filename\n"
     << "  <k>          (optional; 10 by default) predict top k labels\n"
+    << "  <nprobe>     (optional; exact search by default) search the index\n"
+    << "               <model>.nn, built if missing, probing nprobe lists\n"
     << std::endl;
 }
 
 void printAnalogiesUsage() {
   std::cout
-    << "usage: fasttext analogies <model> <k>\n\n"
+    << "usage: fasttext analogies <model> <k> <nprobe>\n\n"
     << "  <model>      model filename\n"
     << "  <k>          (optional; 10 by default) predict top k labels\n"
+    << "  <nprobe>     (optional; exact search by default) search the index\n"
+    << "               <model>.nn, built if missing, probing nprobe lists\n"
     << std::endl;
 }
 
-void test(const std::vector<std::string>& args) {
+// Removes -thread <n> from the arguments of test and predict, and returns n.
+int32_t takeThreads(std::vector<std::string>& args) {
+  int32_t threads = 1;
+  for (size_t i = 2; i + 1 < args.size(); i++) {
+    if (args[i] == "-thread") {
+      threads = std::stoi(args[i + 1]);
+      args.erase(args.begin() + i, args.begin() + i + 2);
+      break;
+    }
+  }
+  return threads;
+}
+
+void test(std::vector<std::string> args) {
+  const int32_t threads = takeThreads(args);
   if (args.size() < 4 || args.size() > 5) {
     printTestUsage();
     exit(EXIT_FAILURE);
@@ -121,25 +156,28 @@ void test(const std::vector<std::string>& args) {
   }
 
   FastText fasttext;
-  fasttext.loadModel(args[2]);
+  fasttext.loadModel(args[2], true);
 
   std::string infile = args[3];
   if (infile == "-") {
     fasttext.test(std::cin, k);
+  } else if (CorpusCache::isCache(infile)) {
+    fasttext.test(*fasttext.loadCache(infile), k);
   } else {
     std::ifstream ifs(infile);
     if (!ifs.is_open()) {
       std::cerr << "Test file cannot be opened!" << std::endl;
       exit(EXIT_FAILURE);
     }
-    fasttext.test(ifs, k);
     ifs.close();
+    fasttext.test(infile, k, threads);
   }
   exit(0);
 }
 
-void predict(const std::vector<std::string>& args) {
-  if (args.size() < 4 || args.size() > 5) {
+void predict(std::vector<std::string> args) {
+  const int32_t threads = takeThreads(args);
+  if (args.size() < 4 || args.size() > 6) {
     printPredictUsage();
     exit(EXIT_FAILURE);
   }
@@ -150,31 +188,65 @@ void predict(const std::vector<std::string>& args) {
 
   bool print_prob = args[1] == "predict-prob";
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
+  if (args.size() == 6) {
+    if (print_prob) {
+      std::cerr << "Probabilities need every label, using exact search."
+                << std::endl;
+    } else {
+      fasttext.loadLabelIndex(
+          std::string(args[2]) + ".labels.nn", std::stoi(args[5]));
+    }
+  }
 
   std::string infile(args[3]);
   if (infile == "-") {
     fasttext.predict(std::cin, k, print_prob);
+  } else if (CorpusCache::isCache(infile)) {
+    fasttext.predict(*fasttext.loadCache(infile), k, print_prob);
   } else {
     std::ifstream ifs(infile);
     if (!ifs.is_open()) {
       std::cerr << "Input file cannot be opened!" << std::endl;
       exit(EXIT_FAILURE);
     }
-    fasttext.predict(ifs, k, print_prob);
     ifs.close();
+    fasttext.predict(infile, k, print_prob, threads);
   }
 
   exit(0);
 }
 
+void cache(const std::vector<std::string>& args) {
+  if (args.size() != 5) {
+    printCacheUsage();
+    exit(EXIT_FAILURE);
+  }
+  FastText fasttext;
+  fasttext.loadModel(std::string(args[2]), true);
+
+  std::string infile(args[3]);
+  if (infile == "-") {
+    fasttext.saveCache(std::cin, infile, args[4]);
+  } else {
+    std::ifstream ifs(infile);
+    if (!ifs.is_open()) {
+      std::cerr << "Input file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fasttext.saveCache(ifs, infile, args[4]);
+    ifs.close();
+  }
+  exit(0);
+}
+
 void printWordVectors(const std::vector<std::string> args) {
   if (args.size() != 3) {
     printPrintWordVectorsUsage();
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
   std::string word;
   Vector vec(fasttext.getDimension());
   while (std::cin >> word) {
@@ -190,7 +262,7 @@ void printSentenceVectors(const std::vector<std::string> args) {
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
   Vector svec(fasttext.getDimension());
   while (std::cin.peek() != EOF) {
     fasttext.getSentenceVector(std::cin, svec);
@@ -201,33 +273,37 @@ void printSentenceVectors(const std::vector<std::string> args) {
 }
 
 void nn(const std::vector<std::string> args) {
-  int32_t k;
-  if (args.size() == 3) {
-    k = 10;
-  } else if (args.size() == 4) {
-    k = std::stoi(args[3]);
-  } else {
+  int32_t k = 10;
+  if (args.size() < 3 || args.size() > 5) {
     printNNUsage();
     exit(EXIT_FAILURE);
   }
+  if (args.size() >= 4) {
+    k = std::stoi(args[3]);
+  }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
+  if (args.size() == 5) {
+    fasttext.loadNNIndex(std::string(args[2]) + ".nn", std::stoi(args[4]));
+  }
   fasttext.nn(k);
   exit(0);
 }
 
 void analogies(const std::vector<std::string> args) {
-  int32_t k;
-  if (args.size() == 3) {
-    k = 10;
-  } else if (args.size() == 4) {
-    k = std::stoi(args[3]);
-  } else {
+  int32_t k = 10;
+  if (args.size() < 3 || args.size() > 5) {
     printAnalogiesUsage();
     exit(EXIT_FAILURE);
   }
+  if (args.size() >= 4) {
+    k = std::stoi(args[3]);
+  }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
+  if (args.size() == 5) {
+    fasttext.loadNNIndex(std::string(args[2]) + ".nn", std::stoi(args[4]));
+  }
   fasttext.analogies(k);
   exit(0);
 }
@@ -245,6 +321,8 @@ void train(const std::vector<std::string> args) {
 }
 
 int main(int argc, char** argv) {
+  // a buffered std::cin, so that the tokenizer reads stdin in blocks
+  std::ios_base::sync_with_stdio(false);
   std::vector<std::string> args(argv, argv + argc);
   if (args.size() < 2) {
     printUsage();
@@ -267,6 +345,8 @@ int main(int argc, char** argv) {
     analogies(args);
   } else if (command == "predict" || command == "predict-prob" ) {
     predict(args);
+  } else if (command == "cache") {
+    cache(args);
   } else {
     printUsage();
     exit(EXIT_FAILURE);
@@ -11,8 +11,11 @@
 
 #include <assert.h>
 
+#include <algorithm>
+#include <cstring>
 #include <random>
 
+#include "kernels.h"
 #include "utils.h"
 #include "vector.h"
 
@@ -21,21 +24,28 @@ namespace fasttext {
 Matrix::Matrix() {
   m_ = 0;
   n_ = 0;
+  stride_ = 0;
   data_ = nullptr;
 }
 
-Matrix::Matrix(int64_t m, int64_t n) {
+// Padded rows each start on their own cache line, so that threads updating
+// neighbouring rows without locks do not write to the same lines.
+Matrix::Matrix(int64_t m, int64_t n, bool padded) {
+  const int64_t line = FASTTEXT_ALIGNMENT / sizeof(real);
   m_ = m;
   n_ = n;
-  data_ = new real[m * n];
+  stride_ = padded ? (n + line - 1) / line * line : n;
+  data_ = (real*) utils::alignedAlloc(m * stride_ * sizeof(real));
 }
 
+// Copies are never padded.
 Matrix::Matrix(const Matrix& other) {
   m_ = other.m_;
   n_ = other.n_;
-  data_ = new real[m_ * n_];
-  for (int64_t i = 0; i < (m_ * n_); i++) {
-    data_[i] = other.data_[i];
+  stride_ = n_;
+  data_ = (real*) utils::alignedAlloc(m_ * n_ * sizeof(real));
+  for (int64_t i = 0; i < m_; i++) {
+    std::copy(other.row(i), other.row(i) + n_, row(i));
   }
 }
 
@@ -43,25 +53,40 @@ Matrix& Matrix::operator=(const Matrix& other) {
   Matrix temp(other);
   m_ = temp.m_;
   n_ = temp.n_;
+  stride_ = temp.stride_;
   std::swap(data_, temp.data_);
+  std::swap(file_, temp.file_);
   return *this;
 }
 
 Matrix::~Matrix() {
-  delete[] data_;
+  if (!file_) {
+    utils::alignedFree(data_);
+  }
 }
 
-void Matrix::zero() {
-  for (int64_t i = 0; i < (m_ * n_); i++) {
-      data_[i] = 0.0;
-  }
+// With several threads, each one is the first to write to its share of the
+// pages, which the kernel then places on that thread's NUMA node instead of
+// putting the whole matrix on the node of the main thread.
+void Matrix::zero(int32_t nthreads) {
+  utils::parallelFor(m_, nthreads, [this](int64_t ib, int64_t ie) {
+    std::memset(row(ib), 0, (ie - ib) * stride_ * sizeof(real));
+  });
 }
 
-void Matrix::uniform(real a) {
+// The values only depend on the seed, not on the number of threads: those
+// just touch the pages first.
+void Matrix::uniform(real a, int32_t nthreads) {
+  if (nthreads > 1 || isPadded()) {
+    zero(nthreads);
+  }
   std::minstd_rand rng(1);
   std::uniform_real_distribution<> uniform(-a, a);
-  for (int64_t i = 0; i < (m_ * n_); i++) {
-    data_[i] = uniform(rng);
+  for (int64_t i = 0; i < m_; i++) {
+    real* r = row(i);
+    for (int64_t j = 0; j < n_; j++) {
+      r[j] = uniform(rng);
+    }
   }
 }
 
@@ -69,20 +94,14 @@ real Matrix::dotRow(const Vector& vec, int64_t i) const {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  real d = 0.0;
-  for (int64_t j = 0; j < n_; j++) {
-    d += at(i, j) * vec.data_[j];
-  }
-  return d;
+  return kernels::dot(row(i), vec.data_, n_);
 }
 
 void Matrix::addRow(const Vector& vec, int64_t i, real a) {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  for (int64_t j = 0; j < n_; j++) {
-    data_[i * n_ + j] += a * vec.data_[j];
-  }
+  kernels::axpy(a, vec.data_, row(i), n_);
 }
 
 void Matrix::multiplyRow(const Vector& nums, int64_t ib, int64_t ie) {
@@ -130,15 +149,42 @@ void Matrix::l2NormRow(Vector& norms) const {
 void Matrix::save(std::ostream& out) {
   out.write((char*) &m_, sizeof(int64_t));
   out.write((char*) &n_, sizeof(int64_t));
-  out.write((char*) data_, m_ * n_ * sizeof(real));
+  utils::pad(out, FASTTEXT_PAGE_SIZE);
+  if (!isPadded()) {
+    out.write((char*) data_, m_ * n_ * sizeof(real));
+    return;
+  }
+  for (int64_t i = 0; i < m_; i++) {
+    out.write((char*) row(i), n_ * sizeof(real));
+  }
+}
+
+void Matrix::load(std::istream& in, bool aligned) {
+  load(in, aligned, nullptr);
 }
 
-void Matrix::load(std::istream& in) {
+void Matrix::load(std::istream& in, bool aligned,
+                  std::shared_ptr<utils::MappedFile> file) {
   in.read((char*) &m_, sizeof(int64_t));
   in.read((char*) &n_, sizeof(int64_t));
-  delete[] data_;
-  data_ = new real[m_ * n_];
-  in.read((char*) data_, m_ * n_ * sizeof(real));
+  stride_ = n_;
+  if (aligned) {
+    utils::skipPad(in, FASTTEXT_PAGE_SIZE);
+  }
+  if (!file_) {
+    utils::alignedFree(data_);
+  }
+  file_.reset();
+  const int64_t bytes = m_ * n_ * sizeof(real);
+  const int64_t offset = in.tellg();
+  if (file && offset % sizeof(real) == 0) {
+    data_ = (real*) file->at(offset, bytes);
+    file_ = file;
+    in.seekg(bytes, std::ios::cur);
+  } else {
+    data_ = (real*) utils::alignedAlloc(bytes);
+    in.read((char*) data_, bytes);
+  }
 }
 
 }
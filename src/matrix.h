@@ -12,33 +12,43 @@
 
 #include <cstdint>
 #include <istream>
+#include <memory>
 #include <ostream>
 
 #include "real.h"
+#include "utils.h"
 
 namespace fasttext {
 
 class Vector;
 
 class Matrix {
+  protected:
+    // set when data_ points into a mapped model file instead of owned memory
+    std::shared_ptr<utils::MappedFile> file_;
 
   public:
     real* data_;
     int64_t m_;
     int64_t n_;
+    // reals between the starts of consecutive rows: n_, or n_ rounded up to
+    // a whole number of cache lines when the rows are padded
+    int64_t stride_;
 
     Matrix();
-    Matrix(int64_t, int64_t);
+    Matrix(int64_t, int64_t, bool padded = false);
     Matrix(const Matrix&);
     Matrix& operator=(const Matrix&);
     ~Matrix();
 
-    inline const real& at(int64_t i, int64_t j) const {return data_[i * n_ + j];};
-    inline real& at(int64_t i, int64_t j) {return data_[i * n_ + j];};
+    inline const real& at(int64_t i, int64_t j) const {return data_[i * stride_ + j];};
+    inline real& at(int64_t i, int64_t j) {return data_[i * stride_ + j];};
+    inline const real* row(int64_t i) const {return data_ + i * stride_;};
+    inline real* row(int64_t i) {return data_ + i * stride_;};
 
 
-    void zero();
-    void uniform(real);
+    void zero(int32_t nthreads = 1);
+    void uniform(real, int32_t nthreads = 1);
     real dotRow(const Vector&, int64_t) const;
     void addRow(const Vector&, int64_t, real);
 
@@ -48,8 +58,12 @@ class Matrix {
     real l2NormRow(int64_t i) const;
     void l2NormRow(Vector& norms) const;
 
+    bool isMapped() const { return file_ != nullptr; }
+    bool isPadded() const { return stride_ != n_; }
+
     void save(std::ostream&);
-    void load(std::istream&);
+    void load(std::istream&, bool);
+    void load(std::istream&, bool, std::shared_ptr<utils::MappedFile>);
 };
 
 }
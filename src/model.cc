@@ -12,31 +12,111 @@
 #include <iostream>
 #include <assert.h>
 #include <algorithm>
+#include <cmath>
+
+#include "kernels.h"
 
 namespace fasttext {
 
+NegativeSampler::NegativeSampler(const std::vector<int64_t>& counts)
+  : prob_(counts.size()), alias_(counts.size()) {
+  const int32_t n = counts.size();
+  double z = 0.0;
+  for (int32_t i = 0; i < n; i++) {
+    z += pow(counts[i], 0.5);
+  }
+  std::vector<double> p(n);
+  std::vector<int32_t> small, large;
+  for (int32_t i = 0; i < n; i++) {
+    p[i] = pow(counts[i], 0.5) * n / z;
+    if (p[i] < 1.0) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+  while (!small.empty() && !large.empty()) {
+    int32_t s = small.back(), l = large.back();
+    small.pop_back();
+    prob_[s] = p[s];
+    alias_[s] = l;
+    p[l] -= 1.0 - p[s];
+    if (p[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // leftovers only differ from 1 by rounding errors
+  for (auto i : small) {
+    prob_[i] = 1.0;
+    alias_[i] = i;
+  }
+  for (auto i : large) {
+    prob_[i] = 1.0;
+    alias_[i] = i;
+  }
+}
+
+int32_t NegativeSampler::sample(std::minstd_rand& rng) const {
+  std::uniform_int_distribution<int32_t> column(0, prob_.size() - 1);
+  std::uniform_real_distribution<real> coin(0, 1);
+  int32_t i = column(rng);
+  return coin(rng) < prob_[i] ? i : alias_[i];
+}
+
+// The output rows of a chunk are capped to about 16MB for large label sets.
+PredictBuffers::PredictBuffers(int32_t hsz, int32_t osz, bool batched)
+  : hidden(hsz), output(osz),
+    hiddens(batched ?
+            std::max(1, std::min(64, (1 << 22) / std::max(osz, 1))) : 0, hsz),
+    outputs(hiddens.m_, osz) {}
+
+namespace {
+
+// The sigmoid and log tables, built once and shared read-only by every Model.
+struct Tables {
+  real sigmoid[SIGMOID_TABLE_SIZE + 1];
+  real log[LOG_TABLE_SIZE + 1];
+
+  Tables() {
+    for (int i = 0; i < SIGMOID_TABLE_SIZE + 1; i++) {
+      real x = real(i * 2 * MAX_SIGMOID) / SIGMOID_TABLE_SIZE - MAX_SIGMOID;
+      sigmoid[i] = 1.0 / (1.0 + std::exp(-x));
+    }
+    for (int i = 0; i < LOG_TABLE_SIZE + 1; i++) {
+      real x = (real(i) + 1e-5) / LOG_TABLE_SIZE;
+      log[i] = std::log(x);
+    }
+  }
+};
+
+const Tables& tables() {
+  static const Tables t;
+  return t;
+}
+
+}
+
 Model::Model(std::shared_ptr<Matrix> wi,
              std::shared_ptr<Matrix> wo,
              std::shared_ptr<Args> args,
              int32_t seed)
   : hidden_(args->dim), output_(wo->m_),
-  grad_(args->dim), rng(seed), quant_(false)
+  grad_(args->dim), samples_(args->neg + 1),
+  batchOut_(args->neg + 1, args->dim), batchGradIn_(2 * args->ws, args->dim),
+  batchGradOut_(args->neg + 1, args->dim), scores_(args->neg + 1),
+  nprobe_(0), dirtyIn_(nullptr), dirtyOut_(nullptr), rng(seed), quant_(false), half_(false)
 {
   wi_ = wi;
   wo_ = wo;
   args_ = args;
   osz_ = wo->m_;
   hsz_ = args->dim;
-  negpos = 0;
+  kernels_ = &kernels::get(hsz_);
   loss_ = 0.0;
   nexamples_ = 1;
-  initSigmoid();
-  initLog();
-}
-
-Model::~Model() {
-  delete[] t_sigmoid;
-  delete[] t_log;
+  t_sigmoid = tables().sigmoid;
+  t_log = tables().log;
 }
 
 void Model::setQuantizePointer(std::shared_ptr<QMatrix> qwi,
@@ -45,14 +125,30 @@ void Model::setQuantizePointer(std::shared_ptr<QMatrix> qwi,
   qwo_ = qwo;
   if (qout) {
     osz_ = qwo_->getM();
+    // wo_ is left empty when a quantized output matrix is loaded
+    output_.resize(osz_);
   }
 }
 
+// Predictions read hwi_ and hwo_ instead of wi_ and wo_, which are left
+// empty when a half-precision model is loaded.
+void Model::setHalfPointer(std::shared_ptr<HMatrix> hwi,
+                           std::shared_ptr<HMatrix> hwo) {
+  hwi_ = hwi;
+  hwo_ = hwo;
+  half_ = true;
+  osz_ = hwo_->getM();
+  output_.resize(osz_);
+}
+
 real Model::binaryLogistic(int32_t target, bool label, real lr) {
-  real score = sigmoid(wo_->dotRow(hidden_, target));
+  real* row = wo_->row(target);
+  real score = sigmoid(kernels_->dot(row, hidden_.data_, hsz_));
   real alpha = lr * (real(label) - score);
-  grad_.addRow(*wo_, target, alpha);
-  wo_->addRow(hidden_, target, alpha);
+  kernels_->update(alpha, row, hidden_.data_, grad_.data_, hsz_);
+  if (dirtyOut_) {
+    dirtyOut_[target] = 1;
+  }
   if (label) {
     return -log(score);
   } else {
@@ -63,12 +159,17 @@ real Model::binaryLogistic(int32_t target, bool label, real lr) {
 real Model::negativeSampling(int32_t target, real lr) {
   real loss = 0.0;
   grad_.zero();
+  // Draw all the rows first, so that the cache misses on the sampled
+  // negatives overlap with each other and with the positive update.
+  samples_[0] = target;
+  for (int32_t n = 1; n <= args_->neg; n++) {
+    samples_[n] = getNegative(target);
+  }
   for (int32_t n = 0; n <= args_->neg; n++) {
-    if (n == 0) {
-      loss += binaryLogistic(target, true, lr);
-    } else {
-      loss += binaryLogistic(getNegative(target), false, lr);
-    }
+    kernels::prefetch(wo_->row(samples_[n]), hsz_ * sizeof(real));
+  }
+  for (int32_t n = 0; n <= args_->neg; n++) {
+    loss += binaryLogistic(samples_[n], n == 0, lr);
   }
   return loss;
 }
@@ -76,10 +177,12 @@ real Model::negativeSampling(int32_t target, real lr) {
 real Model::hierarchicalSoftmax(int32_t target, real lr) {
   real loss = 0.0;
   grad_.zero();
-  const std::vector<bool>& binaryCode = codes[target];
-  const std::vector<int32_t>& pathToRoot = paths[target];
-  for (int32_t i = 0; i < pathToRoot.size(); i++) {
-    loss += binaryLogistic(pathToRoot[i], binaryCode[i], lr);
+  const int32_t b = pathStarts_[target], e = pathStarts_[target + 1];
+  for (int32_t i = b; i < e; i++) {
+    kernels::prefetch(wo_->row(pathRows_[i]), hsz_ * sizeof(real));
+  }
+  for (int32_t i = b; i < e; i++) {
+    loss += binaryLogistic(pathRows_[i], pathCodes_[i], lr);
   }
   return loss;
 }
@@ -87,9 +190,16 @@ real Model::hierarchicalSoftmax(int32_t target, real lr) {
 void Model::computeOutputSoftmax(Vector& hidden, Vector& output) const {
   if (quant_ && args_->qout) {
     output.mul(*qwo_, hidden);
+  } else if (half_) {
+    output.mul(*hwo_, hidden);
   } else {
-    output.mul(*wo_, hidden);
+    kernels_->gemv(wo_->data_, osz_, hsz_, wo_->stride_, hidden.data_,
+                   output.data_);
   }
+  normalizeSoftmax(output.data_);
+}
+
+void Model::normalizeSoftmax(real* output) const {
   real max = output[0], z = 0.0;
   for (int32_t i = 0; i < osz_; i++) {
     max = std::max(output[i], max);
@@ -113,8 +223,10 @@ real Model::softmax(int32_t target, real lr) {
   for (int32_t i = 0; i < osz_; i++) {
     real label = (i == target) ? 1.0 : 0.0;
     real alpha = lr * (label - output_[i]);
-    grad_.addRow(*wo_, i, alpha);
-    wo_->addRow(hidden_, i, alpha);
+    kernels_->update(alpha, wo_->row(i), hidden_.data_, grad_.data_, hsz_);
+  }
+  if (dirtyOut_) {
+    std::fill(dirtyOut_, dirtyOut_ + osz_, 1);
   }
   return -log(output_[target]);
 }
@@ -125,8 +237,10 @@ void Model::computeHidden(const std::vector<int32_t>& input, Vector& hidden) con
   for (auto it = input.cbegin(); it != input.cend(); ++it) {
     if(quant_) {
       hidden.addRow(*qwi_, *it);
+    } else if (half_) {
+      hidden.addRow(*hwi_, *it);
     } else {
-      hidden.addRow(*wi_, *it);
+      kernels_->axpy(1.0, wi_->row(*it), hidden.data_, hsz_);
     }
   }
   hidden.mul(1.0 / input.size());
@@ -139,7 +253,7 @@ bool Model::comparePairs(const std::pair<real, int32_t> &l,
 
 void Model::predict(const std::vector<int32_t>& input, int32_t k,
                     std::vector<std::pair<real, int32_t>>& heap,
-                    Vector& hidden, Vector& output) const {
+                    PredictBuffers& buffers) const {
   if (k <= 0) {
     throw std::invalid_argument("k needs to be 1 or higher!");
   }
@@ -147,68 +261,201 @@ void Model::predict(const std::vector<int32_t>& input, int32_t k,
     throw std::invalid_argument("Model needs to be supervised for prediction!");
   }
   heap.reserve(k + 1);
-  computeHidden(input, hidden);
+  computeHidden(input, buffers.hidden);
   if (args_->loss == loss_name::hs) {
-    dfs(k, 2 * osz_ - 2, 0.0, heap, hidden);
+    bestFirst(k, heap, buffers.hidden, buffers.frontier);
   } else {
-    findKBest(k, heap, hidden, output);
+    findKBest(k, heap, buffers.hidden, buffers.output, buffers.table);
   }
   std::sort_heap(heap.begin(), heap.end(), comparePairs);
 }
 
-void Model::predict(const std::vector<int32_t>& input, int32_t k,
-                    std::vector<std::pair<real, int32_t>>& heap) {
-  predict(input, k, heap, hidden_, output_);
+// Predicts a batch of documents, or the documents in [ib, ie) of it, into
+// the matching heaps. With a plain softmax, the hidden states of a chunk of
+// documents are scored against the output matrix in a single product, so
+// that each row of wo_ is read once per chunk instead of once per document.
+// Without normalize, softmax scores are left as logits, in the same order as
+// the log-probabilities, and the label index is used if there is one.
+void Model::predict(
+    const std::vector<std::vector<int32_t>>& inputs, int32_t k,
+    std::vector<std::vector<std::pair<real, int32_t>>>& heaps,
+    PredictBuffers& buffers, int64_t ib, int64_t ie, bool normalize) const {
+  if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  if (ie == -1) {
+    ie = inputs.size();
+  }
+  assert(heaps.size() >= ie);
+  if (args_->loss == loss_name::hs || (quant_ && args_->qout)) {
+    for (int64_t i = ib; i < ie; i++) {
+      heaps[i].clear();
+      if (inputs[i].empty()) continue;
+      predict(inputs[i], k, heaps[i], buffers);
+    }
+    return;
+  }
+  if (labelIndex_ && !normalize) {
+    for (int64_t i = ib; i < ie; i++) {
+      heaps[i].clear();
+      if (inputs[i].empty()) continue;
+      computeHidden(inputs[i], buffers.hidden);
+      findKBestApprox(k, heaps[i], buffers);
+      std::sort_heap(heaps[i].begin(), heaps[i].end(), comparePairs);
+    }
+    return;
+  }
+  const int64_t chunk = buffers.hiddens.m_;
+  assert(chunk > 0);
+  for (int64_t b = ib; b < ie; b += chunk) {
+    const int64_t n = std::min(chunk, ie - b);
+    for (int64_t i = 0; i < n; i++) {
+      if (inputs[b + i].empty()) {
+        std::fill(buffers.hiddens.row(i), buffers.hiddens.row(i) + hsz_, 0.0);
+        continue;
+      }
+      computeHidden(inputs[b + i], buffers.hidden);
+      std::copy(buffers.hidden.data_, buffers.hidden.data_ + hsz_,
+                buffers.hiddens.row(i));
+    }
+    if (half_) {
+      kernels::gemmHalf(buffers.hiddens.data_, n, hwo_->data(), osz_, hsz_,
+                        hsz_, buffers.outputs.data_, hwo_->isBf16());
+    } else {
+      kernels::gemm(buffers.hiddens.data_, n, wo_->data_, osz_, hsz_,
+                    wo_->stride_, buffers.outputs.data_);
+    }
+    for (int64_t i = 0; i < n; i++) {
+      std::vector<std::pair<real, int32_t>>& heap = heaps[b + i];
+      heap.clear();
+      if (inputs[b + i].empty()) continue;
+      heap.reserve(k + 1);
+      findKBest(k, heap, buffers.outputs.row(i), normalize);
+      std::sort_heap(heap.begin(), heap.end(), comparePairs);
+    }
+  }
 }
 
 void Model::findKBest(int32_t k, std::vector<std::pair<real, int32_t>>& heap,
-                      Vector& hidden, Vector& output) const {
-  computeOutputSoftmax(hidden, output);
-  for (int32_t i = 0; i < osz_; i++) {
-    if (heap.size() == k && log(output[i]) < heap.front().first) {
-      continue;
-    }
-    heap.push_back(std::make_pair(log(output[i]), i));
-    std::push_heap(heap.begin(), heap.end(), comparePairs);
-    if (heap.size() > k) {
-      std::pop_heap(heap.begin(), heap.end(), comparePairs);
-      heap.pop_back();
-    }
+                      Vector& hidden, Vector& output,
+                      std::vector<real>& table) const {
+  if (quant_ && args_->qout) {
+    qwo_->computeTable(hidden, table);
+    qwo_->dotRows(table, output.data_);
+  } else if (half_) {
+    output.mul(*hwo_, hidden);
+  } else {
+    kernels_->gemv(wo_->data_, osz_, hsz_, wo_->stride_, hidden.data_,
+                   output.data_);
   }
+  findKBest(k, heap, output.data_);
 }
 
-void Model::dfs(int32_t k, int32_t node, real score,
-                std::vector<std::pair<real, int32_t>>& heap,
-                Vector& hidden) const {
+void Model::keepKBest(int32_t k, std::vector<std::pair<real, int32_t>>& heap,
+                      real score, int32_t id) {
   if (heap.size() == k && score < heap.front().first) {
     return;
   }
+  heap.push_back(std::make_pair(score, id));
+  std::push_heap(heap.begin(), heap.end(), comparePairs);
+  if (heap.size() > k) {
+    std::pop_heap(heap.begin(), heap.end(), comparePairs);
+    heap.pop_back();
+  }
+}
 
-  if (tree[node].left == -1 && tree[node].right == -1) {
-    heap.push_back(std::make_pair(score, node));
-    std::push_heap(heap.begin(), heap.end(), comparePairs);
-    if (heap.size() > k) {
-      std::pop_heap(heap.begin(), heap.end(), comparePairs);
-      heap.pop_back();
+// Selects the k largest logits in a single pass, skipping the blocks of 16
+// whose maximum cannot enter the heap. Since log-probabilities are the logits
+// minus log(Z), only the kept ones are shifted, after a single pass of
+// exponentials for Z.
+void Model::findKBest(int32_t k, std::vector<std::pair<real, int32_t>>& heap,
+                      const real* logits, bool normalize) const {
+  const int32_t block = 16;
+  for (int32_t b = 0; b < osz_; b += block) {
+    const int32_t e = std::min(b + block, osz_);
+    if (heap.size() == k) {
+      real max = logits[b];
+      for (int32_t i = b + 1; i < e; i++) {
+        max = std::max(max, logits[i]);
+      }
+      if (max < heap.front().first) continue;
     }
+    for (int32_t i = b; i < e; i++) {
+      keepKBest(k, heap, logits[i], i);
+    }
+  }
+  if (!normalize || heap.empty()) {
     return;
   }
+  real max = heap.front().first;
+  for (const auto& p : heap) {
+    max = std::max(max, p.first);
+  }
+  const real logZ = max + std::log(kernels::sumexp(logits, max, osz_));
+  for (auto& p : heap) {
+    p.first -= logZ;
+  }
+}
 
-  real f;
-  if (quant_ && args_->qout) {
-    f= sigmoid(qwo_->dotRow(hidden, node - osz_));
-  } else {
-    f= sigmoid(wo_->dotRow(hidden, node - osz_));
+// Reranks with their exact logits the 4k rows of wo_ that the index finds
+// closest to the hidden state of buffers.
+void Model::findKBestApprox(int32_t k,
+                            std::vector<std::pair<real, int32_t>>& heap,
+                            PredictBuffers& buffers) const {
+  const Vector& hidden = buffers.hidden;
+  std::vector<std::pair<real, int32_t>>& candidates = buffers.candidates;
+  labelIndex_->search(hidden, 4 * k, nprobe_, candidates, buffers.search);
+  heap.reserve(k + 1);
+  for (const auto& c : candidates) {
+    keepKBest(k, heap, wo_->dotRow(hidden, c.second), c.second);
   }
+}
 
-  dfs(k, tree[node].left, score + log(1.0 - f), heap, hidden);
-  dfs(k, tree[node].right, score + log(f), heap, hidden);
+// Best-first search of the k most probable leaves. The score of a node only
+// decreases towards its children, so the leaves leave the frontier by
+// decreasing score and the search stops at the k-th one, having only scored
+// the inner nodes that beat it.
+void Model::bestFirst(int32_t k,
+                      std::vector<std::pair<real, int32_t>>& heap,
+                      const Vector& hidden,
+                      std::vector<std::pair<real, int32_t>>& frontier) const {
+  frontier.clear();
+  frontier.reserve(2 * k + 64);
+  frontier.push_back(std::make_pair(0.0, 0));
+  while (!frontier.empty() && heap.size() < k) {
+    std::pop_heap(frontier.begin(), frontier.end());
+    const real score = frontier.back().first;
+    const int32_t pos = frontier.back().second;
+    frontier.pop_back();
+    const TreeNode& node = tree_[pos];
+    if (node.id < 0) {
+      heap.push_back(std::make_pair(score, -1 - node.id));
+      std::push_heap(heap.begin(), heap.end(), comparePairs);
+      continue;
+    }
+    real f;
+    if (quant_ && args_->qout) {
+      f = sigmoid(qwo_->dotRow(hidden, node.id));
+    } else if (half_) {
+      f = sigmoid(hwo_->dotRow(hidden, node.id));
+    } else {
+      f = sigmoid(kernels_->dot(wo_->row(node.id), hidden.data_, hsz_));
+    }
+    frontier.push_back(std::make_pair(score + log(1.0 - f), pos + 1));
+    std::push_heap(frontier.begin(), frontier.end());
+    frontier.push_back(std::make_pair(score + log(f), node.right));
+    std::push_heap(frontier.begin(), frontier.end());
+  }
 }
 
 void Model::update(const std::vector<int32_t>& input, int32_t target, real lr) {
   assert(target >= 0);
   assert(target < osz_);
   if (input.size() == 0) return;
+  initTraining();
   computeHidden(input, hidden_);
   if (args_->loss == loss_name::ns) {
     loss_ += negativeSampling(target, lr);
@@ -223,84 +470,197 @@ void Model::update(const std::vector<int32_t>& input, int32_t target, real lr) {
     grad_.mul(1.0 / input.size());
   }
   for (auto it = input.cbegin(); it != input.cend(); ++it) {
-    wi_->addRow(grad_, *it, 1.0);
+    kernels_->axpy(1.0, grad_.data_, wi_->row(*it), hsz_);
+    if (dirtyIn_) {
+      dirtyIn_[*it] = 1;
+    }
+  }
+}
+
+// Negative sampling over a whole window at once: every input row of the
+// batch is scored against the same target and neg shared negatives. The
+// scores form a small (input x output) matrix, and both sides are updated
+// from the rows as they were before the batch, as in the pSGNScc scheme.
+void Model::updateBatch(const std::vector<int32_t>& input, int32_t target,
+                        real lr) {
+  assert(target >= 0);
+  assert(target < osz_);
+  assert(args_->loss == loss_name::ns);
+  assert(input.size() <= batchGradIn_.m_);
+  const int32_t nin = input.size();
+  const int32_t nout = args_->neg + 1;
+  if (nin == 0) return;
+  initTraining();
+
+  samples_[0] = target;
+  for (int32_t n = 1; n < nout; n++) {
+    samples_[n] = getNegative(target);
+  }
+  for (int32_t o = 0; o < nout; o++) {
+    std::copy(wo_->row(samples_[o]), wo_->row(samples_[o]) + hsz_,
+              batchOut_.row(o));
+    std::fill(batchGradOut_.row(o), batchGradOut_.row(o) + hsz_, 0.0);
+  }
+  for (int32_t b = 0; b < nin; b++) {
+    const real* in = wi_->row(input[b]);
+    real* gradIn = batchGradIn_.row(b);
+    std::fill(gradIn, gradIn + hsz_, 0.0);
+    kernels_->gemv(batchOut_.data_, nout, hsz_, hsz_, in, scores_.data_);
+    for (int32_t o = 0; o < nout; o++) {
+      real score = sigmoid(scores_[o]);
+      real alpha = lr * (real(o == 0) - score);
+      loss_ += (o == 0) ? -log(score) : -log(1.0 - score);
+      kernels_->axpy(alpha, batchOut_.row(o), gradIn, hsz_);
+      kernels_->axpy(alpha, in, batchGradOut_.row(o), hsz_);
+    }
+  }
+  for (int32_t b = 0; b < nin; b++) {
+    kernels_->axpy(1.0, batchGradIn_.row(b), wi_->row(input[b]), hsz_);
+    if (dirtyIn_) {
+      dirtyIn_[input[b]] = 1;
+    }
+  }
+  for (int32_t o = 0; o < nout; o++) {
+    kernels_->axpy(1.0, batchGradOut_.row(o), wo_->row(samples_[o]), hsz_);
+    if (dirtyOut_) {
+      dirtyOut_[samples_[o]] = 1;
+    }
   }
+  nexamples_ += nin;
 }
 
-void Model::setTargetCounts(const std::vector<int64_t>& counts) {
+// Only the tree is needed to predict. Without training, the negative
+// sampler and the hierarchical softmax paths are left to initTraining.
+void Model::setTargetCounts(const std::vector<int64_t>& counts,
+                            bool training) {
   assert(counts.size() == osz_);
   if (args_->loss == loss_name::ns) {
-    initTableNegatives(counts);
+    sampler_.reset();
+    counts_ = counts;
   }
   if (args_->loss == loss_name::hs) {
     buildTree(counts);
   }
+  if (training) {
+    initTraining();
+  }
 }
 
-void Model::initTableNegatives(const std::vector<int64_t>& counts) {
-  real z = 0.0;
-  for (size_t i = 0; i < counts.size(); i++) {
-    z += pow(counts[i], 0.5);
+void Model::initTraining() {
+  if (args_->loss == loss_name::ns && !sampler_) {
+    sampler_ = std::make_shared<NegativeSampler>(counts_);
+    counts_ = std::vector<int64_t>();
   }
-  for (size_t i = 0; i < counts.size(); i++) {
-    real c = pow(counts[i], 0.5);
-    for (size_t j = 0; j < c * NEGATIVE_TABLE_SIZE / z; j++) {
-      negatives.push_back(i);
-    }
+  if (args_->loss == loss_name::hs && pathStarts_.empty()) {
+    buildPaths();
   }
-  std::shuffle(negatives.begin(), negatives.end(), rng);
+}
+
+void Model::setNegativeSampler(
+    std::shared_ptr<const NegativeSampler> sampler) {
+  assert(sampler->size() == osz_);
+  sampler_ = sampler;
+}
+
+void Model::setLabelIndex(std::shared_ptr<const NNIndex> index,
+                          int32_t nprobe) {
+  assert(!index || index->nwords() == osz_);
+  labelIndex_ = index;
+  nprobe_ = nprobe;
+}
+
+void Model::setDirtyRows(uint8_t* in, uint8_t* out) {
+  dirtyIn_ = in;
+  dirtyOut_ = out;
 }
 
 int32_t Model::getNegative(int32_t target) {
   int32_t negative;
   do {
-    negative = negatives[negpos];
-    negpos = (negpos + 1) % negatives.size();
+    negative = sampler_->sample(rng);
   } while (target == negative);
   return negative;
 }
 
+// Builds the Huffman tree of the counts, whose inner node i >= osz_ uses
+// the output row i - osz_, and stores it in depth-first order.
 void Model::buildTree(const std::vector<int64_t>& counts) {
-  tree.resize(2 * osz_ - 1);
-  for (int32_t i = 0; i < 2 * osz_ - 1; i++) {
-    tree[i].parent = -1;
-    tree[i].left = -1;
-    tree[i].right = -1;
-    tree[i].count = 1e15;
-    tree[i].binary = false;
-  }
+  const int32_t size = 2 * osz_ - 1;
+  std::vector<int64_t> count(size, 1e15);
+  std::vector<int32_t> left(size, -1), right(size, -1);
   for (int32_t i = 0; i < osz_; i++) {
-    tree[i].count = counts[i];
+    count[i] = counts[i];
   }
   int32_t leaf = osz_ - 1;
   int32_t node = osz_;
-  for (int32_t i = osz_; i < 2 * osz_ - 1; i++) {
+  for (int32_t i = osz_; i < size; i++) {
     int32_t mini[2];
     for (int32_t j = 0; j < 2; j++) {
-      if (leaf >= 0 && tree[leaf].count < tree[node].count) {
+      if (leaf >= 0 && count[leaf] < count[node]) {
         mini[j] = leaf--;
       } else {
         mini[j] = node++;
       }
     }
-    tree[i].left = mini[0];
-    tree[i].right = mini[1];
-    tree[i].count = tree[mini[0]].count + tree[mini[1]].count;
-    tree[mini[0]].parent = i;
-    tree[mini[1]].parent = i;
-    tree[mini[1]].binary = true;
+    left[i] = mini[0];
+    right[i] = mini[1];
+    count[i] = count[mini[0]] + count[mini[1]];
+  }
+  tree_.resize(size);
+  // pending nodes, with the position of the parent whose right child they are
+  std::vector<std::pair<int32_t, int32_t>> stack;
+  stack.push_back(std::make_pair(size - 1, -1));
+  int32_t pos = 0;
+  while (!stack.empty()) {
+    const int32_t i = stack.back().first;
+    const int32_t parent = stack.back().second;
+    stack.pop_back();
+    if (parent >= 0) {
+      tree_[parent].right = pos;
+    }
+    tree_[pos].right = -1;
+    if (i < osz_) {
+      tree_[pos].id = -1 - i;
+    } else {
+      tree_[pos].id = i - osz_;
+      stack.push_back(std::make_pair(right[i], pos));
+      stack.push_back(std::make_pair(left[i], -1));
+    }
+    pos++;
+  }
+  pathStarts_.clear();
+  pathRows_.clear();
+  pathCodes_.clear();
+}
+
+void Model::buildPaths() {
+  const int32_t size = tree_.size();
+  std::vector<int32_t> parent(size, -1), leaves(osz_);
+  for (int32_t i = 0; i < size; i++) {
+    if (tree_[i].id < 0) {
+      leaves[-1 - tree_[i].id] = i;
+    } else {
+      parent[i + 1] = i;
+      parent[tree_[i].right] = i;
+    }
   }
+  pathStarts_.assign(osz_ + 1, 0);
   for (int32_t i = 0; i < osz_; i++) {
-    std::vector<int32_t> path;
-    std::vector<bool> code;
-    int32_t j = i;
-    while (tree[j].parent != -1) {
-      path.push_back(tree[j].parent - osz_);
-      code.push_back(tree[j].binary);
-      j = tree[j].parent;
+    int32_t depth = 0;
+    for (int32_t j = leaves[i]; parent[j] != -1; j = parent[j]) {
+      depth++;
+    }
+    pathStarts_[i + 1] = pathStarts_[i] + depth;
+  }
+  pathRows_.resize(pathStarts_[osz_]);
+  pathCodes_.resize(pathStarts_[osz_]);
+  for (int32_t i = 0; i < osz_; i++) {
+    int32_t p = pathStarts_[i];
+    for (int32_t j = leaves[i]; parent[j] != -1; j = parent[j]) {
+      pathRows_[p] = tree_[parent[j]].id;
+      pathCodes_[p] = j != parent[j] + 1;
+      p++;
     }
-    paths.push_back(path);
-    codes.push_back(code);
   }
 }
 
@@ -308,22 +668,6 @@ real Model::getLoss() const {
   return loss_ / nexamples_;
 }
 
-void Model::initSigmoid() {
-  t_sigmoid = new real[SIGMOID_TABLE_SIZE + 1];
-  for (int i = 0; i < SIGMOID_TABLE_SIZE + 1; i++) {
-    real x = real(i * 2 * MAX_SIGMOID) / SIGMOID_TABLE_SIZE - MAX_SIGMOID;
-    t_sigmoid[i] = 1.0 / (1.0 + std::exp(-x));
-  }
-}
-
-void Model::initLog() {
-  t_log = new real[LOG_TABLE_SIZE + 1];
-  for (int i = 0; i < LOG_TABLE_SIZE + 1; i++) {
-    real x = (real(i) + 1e-5) / LOG_TABLE_SIZE;
-    t_log[i] = std::log(x);
-  }
-}
-
 real Model::log(real x) const {
   if (x > 1.0) {
     return 0.0;
@@ -12,11 +12,15 @@
 
 #include <vector>
 #include <random>
+#include <string>
 #include <utility>
 #include <memory>
 
 #include "args.h"
 #include "matrix.h"
+#include "hmatrix.h"
+#include "kernels.h"
+#include "nnindex.h"
 #include "vector.h"
 #include "qmatrix.h"
 #include "real.h"
@@ -27,12 +31,59 @@
 
 namespace fasttext {
 
-struct Node {
-  int32_t parent;
-  int32_t left;
+// A node of the hierarchical softmax tree, stored in depth-first order: the
+// left child of an inner node is the next node, so that following left
+// branches reads the array sequentially. Label ids of the leaves are stored
+// as -1 - label.
+struct TreeNode {
+  // output row of an inner node, or -1 - label for a leaf
+  int32_t id;
+  // position of the right child of an inner node
   int32_t right;
-  int64_t count;
-  bool binary;
+};
+
+// Walker's alias table over the unigram counts raised to the power 1/2:
+// O(1) draws from a structure of two arrays of vocabulary size. It is
+// read-only once built, so a single instance is shared by every Model and
+// each training thread only brings its own random generator.
+class NegativeSampler {
+  protected:
+    std::vector<real> prob_;
+    std::vector<int32_t> alias_;
+
+  public:
+    explicit NegativeSampler(const std::vector<int64_t>&);
+
+    int32_t size() const { return prob_.size(); }
+    int32_t sample(std::minstd_rand&) const;
+};
+
+// Scratch space of one predicting thread, reused from call to call so that
+// Model::predict does not allocate once the buffers have grown. The chunk
+// matrices are only needed by batches of dense softmax predictions, and are
+// left empty without batched.
+struct PredictBuffers {
+  Vector hidden;
+  Vector output;
+  // one row per document of a chunk of the batch
+  Matrix hiddens;
+  Matrix outputs;
+  // candidates of the label index, and the scratch of its search
+  std::vector<std::pair<real, int32_t>> candidates;
+  SearchBuffers search;
+  // frontier of the hierarchical softmax search
+  std::vector<std::pair<real, int32_t>> frontier;
+  // partial products of a quantized output matrix
+  std::vector<real> table;
+  // the line being predicted, and its results
+  std::vector<int32_t> words;
+  std::vector<int32_t> labels;
+  std::vector<std::pair<real, int32_t>> heap;
+  // a line of text and one of its words, for sentence vectors
+  std::string text;
+  std::string word;
+
+  PredictBuffers(int32_t, int32_t, bool batched = true);
 };
 
 class Model {
@@ -41,37 +92,61 @@ class Model {
     std::shared_ptr<Matrix> wo_;
     std::shared_ptr<QMatrix> qwi_;
     std::shared_ptr<QMatrix> qwo_;
+    std::shared_ptr<HMatrix> hwi_;
+    std::shared_ptr<HMatrix> hwo_;
     std::shared_ptr<Args> args_;
     Vector hidden_;
     Vector output_;
     Vector grad_;
     int32_t hsz_;
     int32_t osz_;
+    // the kernels for rows of hsz_ values, picked once
+    const kernels::Kernels* kernels_;
     real loss_;
     int64_t nexamples_;
-    real* t_sigmoid;
-    real* t_log;
+    // tables shared by every Model
+    const real* t_sigmoid;
+    const real* t_log;
     // used for negative sampling:
-    std::vector<int32_t> negatives;
-    size_t negpos;
+    std::shared_ptr<const NegativeSampler> sampler_;
+    std::vector<int32_t> samples_;
+    // target counts kept until the first update needs the sampler
+    std::vector<int64_t> counts_;
+    // used for batched skipgram:
+    Matrix batchOut_;
+    Matrix batchGradIn_;
+    Matrix batchGradOut_;
+    Vector scores_;
     // used for hierarchical softmax:
-    std::vector< std::vector<int32_t> > paths;
-    std::vector< std::vector<bool> > codes;
-    std::vector<Node> tree;
+    std::vector<TreeNode> tree_;
+    // the path of label i, from the leaf up to the root, is made of the
+    // output rows pathRows_[pathStarts_[i] .. pathStarts_[i + 1]) and of the
+    // matching branches in pathCodes_
+    std::vector<int32_t> pathStarts_;
+    std::vector<int32_t> pathRows_;
+    std::vector<uint8_t> pathCodes_;
+    // approximate search over the rows of wo_, for unnormalized predictions
+    std::shared_ptr<const NNIndex> labelIndex_;
+    int32_t nprobe_;
+    // one byte per row of wi_ and wo_, set once the row is updated, for the
+    // averaging rounds of a cluster; null when not training in one
+    uint8_t* dirtyIn_;
+    uint8_t* dirtyOut_;
 
     static bool comparePairs(const std::pair<real, int32_t>&,
                              const std::pair<real, int32_t>&);
+    static void keepKBest(int32_t, std::vector<std::pair<real, int32_t>>&,
+                          real, int32_t);
+    void findKBestApprox(int32_t, std::vector<std::pair<real, int32_t>>&,
+                         PredictBuffers&) const;
 
     int32_t getNegative(int32_t target);
-    void initSigmoid();
-    void initLog();
-
-    static const int32_t NEGATIVE_TABLE_SIZE = 10000000;
+    void buildPaths();
+    void initTraining();
 
   public:
     Model(std::shared_ptr<Matrix>, std::shared_ptr<Matrix>,
           std::shared_ptr<Args>, int32_t);
-    ~Model();
 
     real binaryLogistic(int32_t, bool, real);
     real negativeSampling(int32_t, real);
@@ -80,29 +155,40 @@ class Model {
 
     void predict(const std::vector<int32_t>&, int32_t,
                  std::vector<std::pair<real, int32_t>>&,
-                 Vector&, Vector&) const;
-    void predict(const std::vector<int32_t>&, int32_t,
-                 std::vector<std::pair<real, int32_t>>&);
-    void dfs(int32_t, int32_t, real,
-             std::vector<std::pair<real, int32_t>>&,
-             Vector&) const;
+                 PredictBuffers&) const;
+    void predict(const std::vector<std::vector<int32_t>>&, int32_t,
+                 std::vector<std::vector<std::pair<real, int32_t>>>&,
+                 PredictBuffers&, int64_t ib = 0, int64_t ie = -1,
+                 bool normalize = true) const;
+    void bestFirst(int32_t, std::vector<std::pair<real, int32_t>>&,
+                   const Vector&, std::vector<std::pair<real, int32_t>>&) const;
+    void findKBest(int32_t, std::vector<std::pair<real, int32_t>>&,
+                   Vector&, Vector&, std::vector<real>&) const;
     void findKBest(int32_t, std::vector<std::pair<real, int32_t>>&,
-                   Vector&, Vector&) const;
+                   const real*, bool normalize = true) const;
     void update(const std::vector<int32_t>&, int32_t, real);
+    void updateBatch(const std::vector<int32_t>&, int32_t, real);
     void computeHidden(const std::vector<int32_t>&, Vector&) const;
     void computeOutputSoftmax(Vector&, Vector&) const;
     void computeOutputSoftmax();
+    void normalizeSoftmax(real*) const;
 
-    void setTargetCounts(const std::vector<int64_t>&);
-    void initTableNegatives(const std::vector<int64_t>&);
+    void setTargetCounts(const std::vector<int64_t>&, bool = true);
+    void setNegativeSampler(std::shared_ptr<const NegativeSampler>);
+    void setLabelIndex(std::shared_ptr<const NNIndex>, int32_t);
+    void setDirtyRows(uint8_t*, uint8_t*);
     void buildTree(const std::vector<int64_t>&);
     real getLoss() const;
     real sigmoid(real) const;
     real log(real) const;
 
     std::minstd_rand rng;
+    // scratch of the training loops of the thread owning the model
+    std::vector<int32_t> window;
     bool quant_;
     void setQuantizePointer(std::shared_ptr<QMatrix>, std::shared_ptr<QMatrix>, bool);
+    bool half_;
+    void setHalfPointer(std::shared_ptr<HMatrix>, std::shared_ptr<HMatrix>);
 };
 
 }
@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "modelhandle.h"
+
+namespace fasttext {
+
+ModelHandle::ModelHandle(const std::string& filename, bool mmap) {
+  load(filename, mmap);
+}
+
+std::shared_ptr<const FastText> ModelHandle::get() const {
+  return std::atomic_load(&model_);
+}
+
+void ModelHandle::set(std::shared_ptr<const FastText> model) {
+  std::atomic_store(&model_, model);
+}
+
+// The current model keeps serving while the new one loads. If the load
+// fails, the exception is passed on and the current model stays.
+void ModelHandle::load(const std::string& filename, bool mmap) {
+  std::lock_guard<std::mutex> lock(loading_);
+  auto model = std::make_shared<FastText>();
+  model->loadModel(filename, mmap);
+  model->warmUp();
+  set(model);
+}
+
+}
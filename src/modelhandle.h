@@ -0,0 +1,49 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_MODELHANDLE_H
+#define FASTTEXT_MODELHANDLE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "fasttext.h"
+
+namespace fasttext {
+
+// A model that can be replaced while other threads predict with it. get()
+// returns the current snapshot: a loaded FastText that is only used through
+// its const methods, and stays alive for as long as someone holds it. load()
+// builds the next snapshot aside, warms it up and then swaps it in, so that
+// requests in flight finish on the model they started with and the next ones
+// find a model that is ready.
+//
+// A mapped model keeps reading its file: new models should be written to
+// another file and renamed over the old one, not rewritten in place.
+class ModelHandle {
+  protected:
+    std::shared_ptr<const FastText> model_;
+    // one load at a time, without blocking get()
+    std::mutex loading_;
+
+  public:
+    ModelHandle() {}
+    explicit ModelHandle(const std::string&, bool mmap = true);
+    ModelHandle(const ModelHandle&) = delete;
+    ModelHandle& operator=(const ModelHandle&) = delete;
+
+    std::shared_ptr<const FastText> get() const;
+    void set(std::shared_ptr<const FastText>);
+    void load(const std::string&, bool mmap = true);
+};
+
+}
+
+#endif
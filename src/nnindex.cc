@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "nnindex.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+#include "kernels.h"
+
+namespace fasttext {
+
+const int32_t NNIndex::NLISTS;
+
+NNIndex::NNIndex()
+  : dim_(0), nwords_(0), nsubq_(0), innerProduct_(false), fingerprint_(0) {}
+
+bool NNIndex::canIndex(int32_t nwords) {
+  return nwords >= NLISTS;
+}
+
+// 64-bit FNV-1a over the shape and the bits of every value, so that a model
+// retrained with the same vocabulary does not reuse a stale index.
+uint64_t NNIndex::fingerprint(const Matrix& m) {
+  const uint64_t prime = 1099511628211ULL;
+  uint64_t h = 14695981039346656037ULL;
+  h = (h ^ uint64_t(m.m_)) * prime;
+  h = (h ^ uint64_t(m.n_)) * prime;
+  for (int64_t i = 0; i < m.m_; i++) {
+    const uint32_t* row = (const uint32_t*) m.row(i);
+    for (int64_t j = 0; j < m.n_; j++) {
+      h = (h ^ row[j]) * prime;
+    }
+  }
+  return h;
+}
+
+bool NNIndex::indexes(const Matrix& m) const {
+  return nwords_ == m.m_ && dim_ == m.n_ && fingerprint_ == fingerprint(m);
+}
+
+void NNIndex::build(const Matrix& wordVectors, int32_t dsub,
+                    int32_t nthreads, bool innerProduct) {
+  if (wordVectors.isPadded()) {
+    build(Matrix(wordVectors), dsub, nthreads, innerProduct);
+    return;
+  }
+  innerProduct_ = innerProduct;
+  fingerprint_ = fingerprint(wordVectors);
+  dim_ = wordVectors.n_;
+  nwords_ = wordVectors.m_;
+  coarse_ = std::unique_ptr<ProductQuantizer>(
+      new ProductQuantizer(dim_, dim_));
+  coarse_->train(nwords_, wordVectors.data_, nthreads);
+  std::vector<uint8_t> lists(nwords_);
+  coarse_->compute_codes(wordVectors.data_, lists.data(), nwords_, nthreads);
+
+  Matrix residuals(nwords_, dim_);
+  for (int32_t i = 0; i < nwords_; i++) {
+    const real* c = coarse_->get_centroids(0, lists[i]);
+    for (int32_t j = 0; j < dim_; j++) {
+      residuals.at(i, j) = wordVectors.at(i, j) - c[j];
+    }
+  }
+  pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(dim_, dsub));
+  pq_->train(nwords_, residuals.data_, nthreads);
+  nsubq_ = (dim_ + dsub - 1) / dsub;
+  std::vector<uint8_t> codes(int64_t(nwords_) * nsubq_);
+  pq_->compute_codes(residuals.data_, codes.data(), nwords_, nthreads);
+
+  offsets_.assign(NLISTS + 1, 0);
+  for (int32_t i = 0; i < nwords_; i++) {
+    offsets_[lists[i] + 1]++;
+  }
+  for (int32_t l = 0; l < NLISTS; l++) {
+    offsets_[l + 1] += offsets_[l];
+  }
+  std::vector<int32_t> next(offsets_.begin(), offsets_.end() - 1);
+  ids_.resize(nwords_);
+  codes_.resize(codes.size());
+  for (int32_t i = 0; i < nwords_; i++) {
+    const int32_t j = next[lists[i]]++;
+    ids_[j] = i;
+    std::copy(codes.begin() + int64_t(i) * nsubq_,
+              codes.begin() + int64_t(i + 1) * nsubq_,
+              codes_.begin() + int64_t(j) * nsubq_);
+  }
+}
+
+// Returns the k words with the highest approximate dot product with the
+// query, best first. More probed lists give a better recall, and a slower
+// search.
+void NNIndex::search(const Vector& query, int32_t k, int32_t nprobe,
+                     std::vector<std::pair<real, int32_t>>& heap) const {
+  SearchBuffers buffers;
+  search(query, k, nprobe, heap, buffers);
+}
+
+void NNIndex::search(const Vector& query, int32_t k, int32_t nprobe,
+                     std::vector<std::pair<real, int32_t>>& heap,
+                     SearchBuffers& buffers) const {
+  assert(query.size() == dim_);
+  // the centroids of normalized rows are ranked for the normalized query,
+  // so that the lists probed do not depend on its norm
+  real norm = query.norm();
+  if (norm < 1e-8) {
+    norm = 1;
+  }
+  std::vector<std::pair<real, int32_t>>& lists = buffers.lists;
+  std::vector<real>& bases = buffers.bases;
+  lists.resize(NLISTS);
+  bases.resize(NLISTS);
+  for (int32_t l = 0; l < NLISTS; l++) {
+    const real* c = coarse_->get_centroids(0, l);
+    bases[l] = kernels::dot(query.data_, c, dim_);
+    // squared distance to the centroid, up to the norm of the query, or the
+    // opposite of the inner product with it
+    lists[l] = std::make_pair(innerProduct_ ? -bases[l] :
+        kernels::dot(c, c, dim_) - 2 * bases[l] / norm, l);
+  }
+  nprobe = std::max(1, std::min(nprobe, NLISTS));
+  std::partial_sort(lists.begin(), lists.begin() + nprobe, lists.end());
+
+  std::vector<real>& table = buffers.table;
+  table.resize(pq_->table_size());
+  pq_->compute_table(query.data_, table.data());
+
+  auto worse = std::greater<std::pair<real, int32_t>>();
+  heap.clear();
+  heap.reserve(k + 1);
+  std::vector<real>& scores = buffers.scores;
+  int32_t longest = 0;
+  for (int32_t p = 0; p < nprobe; p++) {
+    const int32_t l = lists[p].second;
+    longest = std::max(longest, offsets_[l + 1] - offsets_[l]);
+  }
+  scores.resize(std::max<size_t>(scores.size(), longest));
+  for (int32_t p = 0; p < nprobe; p++) {
+    const int32_t l = lists[p].second;
+    const int32_t begin = offsets_[l];
+    pq_->mulcodes(table.data(), codes_.data() + int64_t(begin) * nsubq_,
+                  offsets_[l + 1] - begin, scores.data());
+    for (int32_t j = begin; j < offsets_[l + 1]; j++) {
+      real score = bases[l] + scores[j - begin];
+      if (heap.size() == k && score < heap.front().first) {
+        continue;
+      }
+      heap.push_back(std::make_pair(score, ids_[j]));
+      std::push_heap(heap.begin(), heap.end(), worse);
+      if (heap.size() > k) {
+        std::pop_heap(heap.begin(), heap.end(), worse);
+        heap.pop_back();
+      }
+    }
+  }
+  std::sort_heap(heap.begin(), heap.end(), worse);
+}
+
+void NNIndex::save(std::ostream& out) const {
+  const int32_t magic = FASTTEXT_NNINDEX_MAGIC_INT32;
+  const int32_t version = FASTTEXT_NNINDEX_VERSION;
+  out.write((char*) &magic, sizeof(int32_t));
+  out.write((char*) &version, sizeof(int32_t));
+  out.write((char*) &dim_, sizeof(int32_t));
+  out.write((char*) &nwords_, sizeof(int32_t));
+  out.write((char*) &nsubq_, sizeof(int32_t));
+  out.write((char*) &fingerprint_, sizeof(uint64_t));
+  out.write((char*) &innerProduct_, sizeof(bool));
+  coarse_->save(out);
+  pq_->save(out);
+  out.write((char*) offsets_.data(), offsets_.size() * sizeof(int32_t));
+  out.write((char*) ids_.data(), ids_.size() * sizeof(int32_t));
+  out.write((char*) codes_.data(), codes_.size() * sizeof(uint8_t));
+}
+
+void NNIndex::load(std::istream& in) {
+  int32_t magic, version;
+  in.read((char*) &magic, sizeof(int32_t));
+  in.read((char*) &version, sizeof(int32_t));
+  if (magic != FASTTEXT_NNINDEX_MAGIC_INT32 ||
+      version > FASTTEXT_NNINDEX_VERSION) {
+    throw std::invalid_argument("Not a nearest-neighbour index!");
+  }
+  in.read((char*) &dim_, sizeof(int32_t));
+  in.read((char*) &nwords_, sizeof(int32_t));
+  in.read((char*) &nsubq_, sizeof(int32_t));
+  in.read((char*) &fingerprint_, sizeof(uint64_t));
+  innerProduct_ = false;
+  if (version >= 2) {
+    in.read((char*) &innerProduct_, sizeof(bool));
+  }
+  // the sizes are checked against what is left of the stream before
+  // anything is allocated, so that a truncated file cannot make us resize
+  // from garbage
+  const std::streampos start = in.tellg();
+  in.seekg(0, std::ios::end);
+  const int64_t left = int64_t(in.tellg()) - int64_t(start);
+  in.seekg(start);
+  const int64_t quantizer = 4 * sizeof(int32_t) +
+    int64_t(dim_) * 256 * sizeof(real);
+  if (!in || dim_ <= 0 || nwords_ < 0 || nsubq_ <= 0 || nsubq_ > dim_ ||
+      left != 2 * quantizer + (NLISTS + 1) * sizeof(int32_t) +
+      int64_t(nwords_) * (sizeof(int32_t) + nsubq_)) {
+    throw std::invalid_argument("Corrupt nearest-neighbour index!");
+  }
+  coarse_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer());
+  coarse_->load(in);
+  pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer());
+  pq_->load(in);
+  offsets_.resize(NLISTS + 1);
+  in.read((char*) offsets_.data(), offsets_.size() * sizeof(int32_t));
+  ids_.resize(nwords_);
+  in.read((char*) ids_.data(), ids_.size() * sizeof(int32_t));
+  codes_.resize(int64_t(nwords_) * nsubq_);
+  in.read((char*) codes_.data(), codes_.size() * sizeof(uint8_t));
+  bool valid = in && offsets_[0] == 0 && offsets_[NLISTS] == nwords_;
+  for (int32_t l = 0; valid && l < NLISTS; l++) {
+    valid = offsets_[l] <= offsets_[l + 1];
+  }
+  for (int32_t i = 0; valid && i < nwords_; i++) {
+    valid = ids_[i] >= 0 && ids_[i] < nwords_;
+  }
+  if (!valid) {
+    throw std::invalid_argument("Corrupt nearest-neighbour index!");
+  }
+}
+
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_NNINDEX_H
+#define FASTTEXT_NNINDEX_H
+
+#define FASTTEXT_NNINDEX_VERSION 2
+#define FASTTEXT_NNINDEX_MAGIC_INT32 793712316
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "matrix.h"
+#include "productquantizer.h"
+#include "real.h"
+#include "vector.h"
+
+namespace fasttext {
+
+// Scratch space of NNIndex::search, reused from query to query.
+struct SearchBuffers {
+  std::vector<std::pair<real, int32_t>> lists;
+  std::vector<real> bases;
+  std::vector<real> table;
+  std::vector<real> scores;
+};
+
+// Approximate inner-product search over the normalized word vectors
+// (IVF-PQ). A coarse quantizer with a single codebook splits the words into
+// one inverted list per centroid, and the residual of each word to its
+// centroid is product-quantized. A query scans the nprobe lists closest to
+// it and scores their words from the codes alone. For unnormalized rows,
+// such as those of the output matrix, the lists are ranked by inner product
+// with their centroid instead of distance.
+class NNIndex {
+  protected:
+    int32_t dim_;
+    int32_t nwords_;
+    int32_t nsubq_;
+    bool innerProduct_;
+    // identity of what the rows were computed from, see setFingerprint
+    uint64_t fingerprint_;
+    std::unique_ptr<ProductQuantizer> coarse_;
+    std::unique_ptr<ProductQuantizer> pq_;
+    // words of list l are ids_[offsets_[l]] to ids_[offsets_[l + 1] - 1]
+    std::vector<int32_t> offsets_;
+    std::vector<int32_t> ids_;
+    // residual codes, in the order of ids_
+    std::vector<uint8_t> codes_;
+
+  public:
+    static const int32_t NLISTS = 256;
+
+    NNIndex();
+
+    static bool canIndex(int32_t);
+    static uint64_t fingerprint(const Matrix&);
+    void build(const Matrix&, int32_t, int32_t nthreads = 1,
+               bool innerProduct = false);
+    void search(const Vector&, int32_t, int32_t,
+                std::vector<std::pair<real, int32_t>>&) const;
+    void search(const Vector&, int32_t, int32_t,
+                std::vector<std::pair<real, int32_t>>&, SearchBuffers&) const;
+
+    int32_t nwords() const { return nwords_; }
+    int32_t dim() const { return dim_; }
+    bool innerProduct() const { return innerProduct_; }
+    // fingerprint of the built rows, unless the caller identifies them with
+    // something cheaper to check, such as the file they were computed from
+    uint64_t getFingerprint() const { return fingerprint_; }
+    void setFingerprint(uint64_t fingerprint) { fingerprint_ = fingerprint; }
+    // whether the index was built from exactly these rows
+    bool indexes(const Matrix&) const;
+
+    void save(std::ostream&) const;
+    void load(std::istream&);
+};
+
+}
+
+#endif
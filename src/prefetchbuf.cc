@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "prefetchbuf.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace fasttext {
+
+const int64_t PrefetchBuffer::BLOCK_SIZE;
+
+PrefetchBuffer::PrefetchBuffer(const std::string& filename)
+    : size_(0), current_(-1), start_(0), next_(0), atEnd_(false),
+      stop_(false) {
+  fd_ = open(filename.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    throw std::invalid_argument(filename + " cannot be opened for training!");
+  }
+  struct stat st;
+  if (fstat(fd_, &st) == 0) {
+    size_ = st.st_size;
+  }
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  for (int32_t i = 0; i < 2; i++) {
+    blocks_[i].offset = 0;
+    blocks_[i].size = 0;
+    blocks_[i].filled = false;
+  }
+  setg(nullptr, nullptr, nullptr);
+}
+
+PrefetchBuffer::~PrefetchBuffer() {
+  halt();
+  close(fd_);
+}
+
+// Fills the two blocks in turn, each one as soon as the parser is done with
+// it.
+void PrefetchBuffer::read() {
+  const int64_t capacity = std::min(BLOCK_SIZE, std::max<int64_t>(size_, 1));
+  int32_t b = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this, b]() { return stop_ || !blocks_[b].filled; });
+    if (stop_) {
+      return;
+    }
+    const int64_t offset = next_;
+    block& blk = blocks_[b];
+    lock.unlock();
+    blk.data.resize(capacity);
+    int64_t n = 0;
+    while (n < capacity) {
+      ssize_t r = pread(fd_, blk.data.data() + n, capacity - n, offset + n);
+      if (r <= 0) {
+        break;
+      }
+      n += r;
+    }
+    lock.lock();
+    blk.offset = offset;
+    blk.size = n;
+    blk.filled = true;
+    next_ = (n == 0 || offset + n >= size_) ? 0 : offset + n;
+    cv_.notify_all();
+    b ^= 1;
+  }
+}
+
+void PrefetchBuffer::halt() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+  stop_ = false;
+  blocks_[0].filled = false;
+  blocks_[1].filled = false;
+}
+
+// Drops whatever was prefetched; the reader starts again at pos on the next
+// underflow.
+void PrefetchBuffer::restart(int64_t pos) {
+  halt();
+  current_ = -1;
+  start_ = pos;
+  atEnd_ = false;
+  setg(nullptr, nullptr, nullptr);
+}
+
+PrefetchBuffer::int_type PrefetchBuffer::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  if (atEnd_ || size_ == 0) {
+    return traits_type::eof();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (current_ < 0) {
+    if (!reader_.joinable()) {
+      next_ = start_;
+      reader_ = std::thread(&PrefetchBuffer::read, this);
+    }
+    current_ = 0;
+  } else {
+    blocks_[current_].filled = false;
+    cv_.notify_all();
+    current_ ^= 1;
+  }
+  cv_.wait(lock, [this]() { return blocks_[current_].filled; });
+  block& b = blocks_[current_];
+  setg(b.data.data(), b.data.data(), b.data.data() + b.size);
+  atEnd_ = b.size == 0 || b.offset + b.size >= size_;
+  if (b.size == 0) {
+    return traits_type::eof();
+  }
+  return traits_type::to_int_type(*gptr());
+}
+
+PrefetchBuffer::pos_type PrefetchBuffer::seekoff(
+    off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+  const off_type pos = current_ < 0 ? start_ :
+    blocks_[current_].offset + (gptr() - eback());
+  if (dir == std::ios_base::cur && off == 0) {
+    return pos_type(pos);
+  }
+  if (dir == std::ios_base::beg) {
+    return seekpos(pos_type(off), which);
+  } else if (dir == std::ios_base::cur) {
+    return seekpos(pos_type(pos + off), which);
+  }
+  return seekpos(pos_type(size_ + off), which);
+}
+
+PrefetchBuffer::pos_type PrefetchBuffer::seekpos(
+    pos_type sp, std::ios_base::openmode which) {
+  const off_type pos = off_type(sp);
+  if (!(which & std::ios_base::in) || pos < 0 || pos > size_) {
+    return pos_type(off_type(-1));
+  }
+  if (current_ >= 0) {
+    block& b = blocks_[current_];
+    if (pos >= b.offset && pos < b.offset + b.size) {
+      setg(eback(), eback() + (pos - b.offset), egptr());
+      return sp;
+    }
+    if (atEnd_ && pos == 0 && b.size > 0) {
+      // the reader has wrapped around, the next block starts the file
+      atEnd_ = false;
+      setg(eback(), egptr(), egptr());
+      underflow();
+      return sp;
+    }
+  }
+  restart(pos);
+  return sp;
+}
+
+}
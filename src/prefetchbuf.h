@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_PREFETCHBUF_H
+#define FASTTEXT_PREFETCHBUF_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fasttext {
+
+// Read-only streambuf over a file, filled by a reader thread of its own: the
+// next block is read while the current one is parsed, so that training
+// threads do not wait on storage. After the block holding the end of the
+// file the reader wraps around to its beginning, which makes the seek back
+// to 0 done by Dictionary::reset free.
+class PrefetchBuffer : public std::streambuf {
+  protected:
+    struct block {
+      std::vector<char> data;
+      int64_t offset;
+      int64_t size;
+      bool filled;
+    };
+
+    int fd_;
+    int64_t size_;
+    block blocks_[2];
+    // block of the get area, -1 until the first underflow after a seek
+    int32_t current_;
+    // offset of the first block read after a seek
+    int64_t start_;
+    // offset the reader thread reads next
+    int64_t next_;
+    // the get area ends at the end of the file
+    bool atEnd_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread reader_;
+
+    void read();
+    void restart(int64_t);
+    void halt();
+
+    int_type underflow() override;
+    pos_type seekoff(off_type, std::ios_base::seekdir,
+                     std::ios_base::openmode) override;
+    pos_type seekpos(pos_type, std::ios_base::openmode) override;
+
+  public:
+    static const int64_t BLOCK_SIZE = 1 << 22;
+
+    explicit PrefetchBuffer(const std::string&);
+    PrefetchBuffer(const PrefetchBuffer&) = delete;
+    PrefetchBuffer& operator=(const PrefetchBuffer&) = delete;
+    ~PrefetchBuffer();
+
+    int64_t size() const { return size_; }
+};
+
+}
+
+#endif
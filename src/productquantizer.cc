@@ -12,6 +12,10 @@
 #include <algorithm>
 #include <iostream>
 #include <numeric>
+#include <stdexcept>
+
+#include "kernels.h"
+#include "utils.h"
 
 namespace fasttext {
 
@@ -25,7 +29,7 @@ real distL2(const real* x, const real* y, int32_t d) {
 }
 
 ProductQuantizer::ProductQuantizer(int32_t dim, int32_t dsub): dim_(dim),
-  nsubq_(dim / dsub), dsub_(dsub), centroids_(dim * ksub_), rng(seed_) {
+  nsubq_(dim / dsub), dsub_(dsub), centroids_(dim * ksub_) {
   lastdsub_ = dim_ % dsub;
   if (lastdsub_ == 0) {lastdsub_ = dsub_;}
   else {nsubq_++;}
@@ -57,17 +61,54 @@ real ProductQuantizer::assign_centroid(const real * x, const real* c0,
   return dis;
 }
 
+void ProductQuantizer::transpose_centroids(const real* c, int32_t d,
+                                           real* ct, real* cnorm) const {
+  for (auto j = 0; j < ksub_; j++) {
+    cnorm[j] = 0;
+    for (auto n = 0; n < d; n++) {
+      ct[n * ksub_ + j] = c[j * d + n];
+      cnorm[j] += c[j * d + n] * c[j * d + n];
+    }
+  }
+}
+
+// Writes the nearest centroid of the point x + i * stride to codes[i * cstride]
+// for the n points. ||x - c||^2 is ranked as ||c||^2 - 2 x.c, from centroids
+// transposed by transpose_centroids so that the loop over them vectorizes.
+void ProductQuantizer::assign_centroids(const real* x, const real* ct,
+                                        const real* cnorm, uint8_t* codes,
+                                        int32_t d, int32_t n,
+                                        int64_t stride,
+                                        int64_t cstride) const {
+  std::vector<real> dis(ksub_);
+  for (int64_t i = 0; i < n; i++) {
+    const real* xi = x + i * stride;
+    std::copy(cnorm, cnorm + ksub_, dis.begin());
+    for (auto k = 0; k < d; k++) {
+      const real a = -2 * xi[k];
+      const real* c = ct + k * ksub_;
+      for (auto j = 0; j < ksub_; j++) {
+        dis[j] += a * c[j];
+      }
+    }
+    codes[i * cstride] = std::min_element(dis.begin(), dis.end()) - dis.begin();
+  }
+}
+
 void ProductQuantizer::Estep(const real* x, const real* centroids,
                              uint8_t* codes, int32_t d,
-                             int32_t n) const {
-  for (auto i = 0; i < n; i++) {
-    assign_centroid(x + i * d, centroids, codes + i, d);
-  }
+                             int32_t n, int32_t nthreads) const {
+  std::vector<real> ct(ksub_ * d), cnorm(ksub_);
+  transpose_centroids(centroids, d, ct.data(), cnorm.data());
+  utils::parallelFor(n, nthreads, [&](int64_t ib, int64_t ie) {
+    assign_centroids(x + ib * d, ct.data(), cnorm.data(), codes + ib, d,
+                     ie - ib, d, 1);
+  });
 }
 
 void ProductQuantizer::MStep(const real* x0, real* centroids,
                              const uint8_t* codes,
-                             int32_t d, int32_t n) {
+                             int32_t d, int32_t n, std::minstd_rand& rng) {
   std::vector<int32_t> nelts(ksub_, 0);
   memset(centroids, 0, sizeof(real) * d * ksub_);
   const real* x = x0;
@@ -111,7 +152,8 @@ void ProductQuantizer::MStep(const real* x0, real* centroids,
   }
 }
 
-void ProductQuantizer::kmeans(const real *x, real* c, int32_t n, int32_t d) {
+void ProductQuantizer::kmeans(const real *x, real* c, int32_t n, int32_t d,
+                              std::minstd_rand& rng, int32_t nthreads) {
   std::vector<int32_t> perm(n,0);
   std::iota(perm.begin(), perm.end(), 0);
   std::shuffle(perm.begin(), perm.end(), rng);
@@ -120,59 +162,186 @@ void ProductQuantizer::kmeans(const real *x, real* c, int32_t n, int32_t d) {
   }
   uint8_t* codes = new uint8_t[n];
   for (auto i = 0; i < niter_; i++) {
-    Estep(x, c, codes, d, n);
-    MStep(x, c, codes, d, n);
+    Estep(x, c, codes, d, n, nthreads);
+    MStep(x, c, codes, d, n, rng);
   }
   delete [] codes;
 }
 
-void ProductQuantizer::train(int32_t n, const real * x) {
+// The subquantizers are trained in parallel, each from its own generator
+// seeded with seed_ + m, so that the centroids only depend on seed_ and not
+// on the number of threads. Threads left over when there are fewer
+// subquantizers than threads share the E-steps.
+void ProductQuantizer::train(int32_t n, const real * x, int32_t nthreads) {
   if (n < ksub_) {
     std::cerr<<"Matrix too small for quantization, must have > 256 rows"<<std::endl;
     exit(1);
   }
-  std::vector<int32_t> perm(n, 0);
-  std::iota(perm.begin(), perm.end(), 0);
-  auto d = dsub_;
   auto np = std::min(n, max_points_);
-  real* xslice = new real[np * dsub_];
-  for (auto m = 0; m < nsubq_; m++) {
-    if (m == nsubq_-1) {d = lastdsub_;}
-    if (np != n) {std::shuffle(perm.begin(), perm.end(), rng);}
-    for (auto j = 0; j < np; j++) {
-      memcpy (xslice + j * d, x + perm[j] * dim_ + m * dsub_, d * sizeof(real));
+  const int32_t estepThreads = std::max(1, nthreads / nsubq_);
+  utils::parallelFor(nsubq_, nthreads, [&](int64_t mb, int64_t me) {
+    std::vector<int32_t> perm(n, 0);
+    std::vector<real> xslice(np * dsub_);
+    for (auto m = mb; m < me; m++) {
+      std::minstd_rand rng(seed_ + m);
+      auto d = (m == nsubq_ - 1) ? lastdsub_ : dsub_;
+      std::iota(perm.begin(), perm.end(), 0);
+      if (np != n) {std::shuffle(perm.begin(), perm.end(), rng);}
+      for (auto j = 0; j < np; j++) {
+        memcpy (xslice.data() + j * d, x + int64_t(perm[j]) * dim_ + m * dsub_,
+                d * sizeof(real));
+      }
+      kmeans(xslice.data(), get_centroids(m, 0), np, d, rng, estepThreads);
+    }
+  });
+}
+
+// The products with the codes of subquantizers of D values, or of dsub_ for
+// D == 0, so that the loops over the usual small subquantizers are unrolled.
+// Subquantizers of 2 values, the default, gather their centroids with the
+// kernels. The last subquantizer, of lastdsub_ values, is done apart.
+template <int32_t D>
+real ProductQuantizer::mulcode_fixed(const Vector& x, const uint8_t* code,
+                                     real alpha) const {
+  const int32_t d = D > 0 ? D : dsub_;
+  const int32_t last = nsubq_ - 1;
+  real res = 0.0;
+  if (D == 2) {
+    res = kernels::dotCode2(centroids_.data(), code, x.data_, last);
+  } else {
+    for (auto m = 0; m < last; m++) {
+      const real* c = &centroids_[(m * ksub_ + code[m]) * d];
+      const real* xm = x.data_ + m * d;
+      for (auto n = 0; n < d; n++) {
+        res += xm[n] * c[n];
+      }
     }
-    kmeans(xslice, get_centroids(m, 0), np, d);
   }
-  delete [] xslice;
+  const real* c = get_centroids(last, code[last]);
+  for (auto n = 0; n < lastdsub_; n++) {
+    res += x[last * dsub_ + n] * c[n];
+  }
+  return res * alpha;
 }
 
 real ProductQuantizer::mulcode(const Vector& x, const uint8_t* codes,
                                int32_t t, real alpha) const {
-  real res = 0.0;
-  auto d = dsub_;
   const uint8_t* code = codes + nsubq_ * t;
-  for (auto m = 0; m < nsubq_; m++) {
-    const real* c = get_centroids(m, code[m]);
-    if (m == nsubq_ - 1) {d = lastdsub_;}
-    for(auto n = 0; n < d; n++) {
-      res += x[m * dsub_ + n] * c[n];
+  switch (dsub_) {
+    case 2:
+      return mulcode_fixed<2>(x, code, alpha);
+    case 4:
+      return mulcode_fixed<4>(x, code, alpha);
+    default:
+      return mulcode_fixed<0>(x, code, alpha);
+  }
+}
+
+// Partial dot products of x with every centroid of every subquantizer, so
+// that a code is then scored with nsubq_ lookups instead of a full product.
+void ProductQuantizer::compute_table(const real* x, real* table) const {
+  auto m = 0;
+  if (dsub_ == 2) {
+    // the default -dsub
+    m = lastdsub_ == 2 ? nsubq_ : nsubq_ - 1;
+    kernels::table2(centroids_.data(), x, m, table);
+  }
+  for (; m < nsubq_; m++) {
+    const auto d = (m == nsubq_ - 1) ? lastdsub_ : dsub_;
+    const real* c = get_centroids(m, 0);
+    const real* xm = x + m * dsub_;
+    real* t = table + m * ksub_;
+    for (auto j = 0; j < ksub_; j++) {
+      real dp = 0.0;
+      for (auto n = 0; n < d; n++) {
+        dp += xm[n] * c[j * d + n];
+      }
+      t[j] = dp;
     }
   }
-  return res * alpha;
 }
 
-void ProductQuantizer::addcode(Vector& x, const uint8_t* codes,
+real ProductQuantizer::mulcode(const real* table, const uint8_t* codes,
                                int32_t t, real alpha) const {
-  auto d = dsub_;
   const uint8_t* code = codes + nsubq_ * t;
-  for (auto m = 0; m < nsubq_; m++) {
-    const real* c = get_centroids(m, code[m]);
-    if (m == nsubq_ - 1) {d = lastdsub_;}
-    for(auto n = 0; n < d; n++) {
-      x[m * dsub_ + n] += alpha * c[n];
+  real res0 = 0.0, res1 = 0.0, res2 = 0.0, res3 = 0.0;
+  auto m = 0;
+  for (; m + 4 <= nsubq_; m += 4) {
+    res0 += table[m * ksub_ + code[m]];
+    res1 += table[(m + 1) * ksub_ + code[m + 1]];
+    res2 += table[(m + 2) * ksub_ + code[m + 2]];
+    res3 += table[(m + 3) * ksub_ + code[m + 3]];
+  }
+  for (; m < nsubq_; m++) {
+    res0 += table[m * ksub_ + code[m]];
+  }
+  return (res0 + res1 + res2 + res3) * alpha;
+}
+
+// mulcode of the n codes against the same table, two rows at a time so that
+// the lookups of one hide the latency of the other's.
+void ProductQuantizer::mulcodes(const real* table, const uint8_t* codes,
+                                int64_t n, real* y) const {
+  int64_t t = 0;
+  for (; t + 2 <= n; t += 2) {
+    const uint8_t* c0 = codes + nsubq_ * t;
+    const uint8_t* c1 = c0 + nsubq_;
+    real a0 = 0.0, a1 = 0.0, b0 = 0.0, b1 = 0.0;
+    auto m = 0;
+    for (; m + 2 <= nsubq_; m += 2) {
+      const real* tm = table + m * ksub_;
+      a0 += tm[c0[m]];
+      b0 += tm[c1[m]];
+      a1 += tm[ksub_ + c0[m + 1]];
+      b1 += tm[ksub_ + c1[m + 1]];
+    }
+    if (m < nsubq_) {
+      a0 += table[m * ksub_ + c0[m]];
+      b0 += table[m * ksub_ + c1[m]];
+    }
+    y[t] = a0 + a1;
+    y[t + 1] = b0 + b1;
+  }
+  if (t < n) {
+    y[t] = mulcode(table, codes, t, 1.0);
+  }
+}
+
+template <int32_t D>
+void ProductQuantizer::addcode_fixed(Vector& x, const uint8_t* code,
+                                     real alpha) const {
+  const int32_t d = D > 0 ? D : dsub_;
+  const int32_t last = nsubq_ - 1;
+  if (D == 2) {
+    kernels::axpyCode2(alpha, centroids_.data(), code, x.data_, last);
+  } else {
+    for (auto m = 0; m < last; m++) {
+      const real* c = &centroids_[(m * ksub_ + code[m]) * d];
+      real* xm = x.data_ + m * d;
+      for (auto n = 0; n < d; n++) {
+        xm[n] += alpha * c[n];
+      }
     }
   }
+  const real* c = get_centroids(last, code[last]);
+  for (auto n = 0; n < lastdsub_; n++) {
+    x[last * dsub_ + n] += alpha * c[n];
+  }
+}
+
+void ProductQuantizer::addcode(Vector& x, const uint8_t* codes,
+                               int32_t t, real alpha) const {
+  const uint8_t* code = codes + nsubq_ * t;
+  switch (dsub_) {
+    case 2:
+      addcode_fixed<2>(x, code, alpha);
+      break;
+    case 4:
+      addcode_fixed<4>(x, code, alpha);
+      break;
+    default:
+      addcode_fixed<0>(x, code, alpha);
+  }
 }
 
 void ProductQuantizer::compute_code(const real* x, uint8_t* code) const {
@@ -184,10 +353,21 @@ void ProductQuantizer::compute_code(const real* x, uint8_t* code) const {
 }
 
 void ProductQuantizer::compute_codes(const real* x, uint8_t* codes,
-                                     int32_t n) const {
-  for (auto i = 0; i < n; i++) {
-    compute_code(x + i * dim_, codes + i * nsubq_);
+                                     int32_t n, int32_t nthreads) const {
+  std::vector<real> ct(ksub_ * dim_), cnorm(ksub_ * nsubq_);
+  for (auto m = 0; m < nsubq_; m++) {
+    auto d = (m == nsubq_ - 1) ? lastdsub_ : dsub_;
+    transpose_centroids(get_centroids(m, 0), d, ct.data() + m * ksub_ * dsub_,
+                        cnorm.data() + m * ksub_);
   }
+  utils::parallelFor(n, nthreads, [&](int64_t ib, int64_t ie) {
+    for (auto m = 0; m < nsubq_; m++) {
+      auto d = (m == nsubq_ - 1) ? lastdsub_ : dsub_;
+      assign_centroids(x + ib * dim_ + m * dsub_,
+                       ct.data() + m * ksub_ * dsub_, cnorm.data() + m * ksub_,
+                       codes + ib * nsubq_ + m, d, ie - ib, dim_, nsubq_);
+    }
+  });
 }
 
 void ProductQuantizer::save(std::ostream& out) {
@@ -203,10 +383,13 @@ void ProductQuantizer::load(std::istream& in) {
   in.read((char*) &nsubq_, sizeof(nsubq_));
   in.read((char*) &dsub_, sizeof(dsub_));
   in.read((char*) &lastdsub_, sizeof(lastdsub_));
-  centroids_.resize(dim_ * ksub_);
-  for (auto i=0; i < centroids_.size(); i++) {
-    in.read((char*) &centroids_[i], sizeof(real));
+  if (!in || dim_ <= 0 || dsub_ <= 0 || lastdsub_ <= 0 ||
+      lastdsub_ > dsub_ || (dim_ - lastdsub_) % dsub_ != 0 ||
+      nsubq_ != (dim_ - lastdsub_) / dsub_ + 1) {
+    throw std::invalid_argument("Corrupt product quantizer!");
   }
+  centroids_.resize(dim_ * ksub_);
+  in.read((char*) centroids_.data(), centroids_.size() * sizeof(real));
 }
 
 }
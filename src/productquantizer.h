@@ -38,7 +38,13 @@ class ProductQuantizer {
 
     std::vector<real> centroids_;
 
-    std::minstd_rand rng;
+    void transpose_centroids(const real*, int32_t, real*, real*) const;
+    void assign_centroids(const real*, const real*, const real*, uint8_t*,
+                          int32_t, int32_t, int64_t, int64_t) const;
+    template <int32_t D>
+    real mulcode_fixed(const Vector&, const uint8_t*, real) const;
+    template <int32_t D>
+    void addcode_fixed(Vector&, const uint8_t*, real) const;
 
   public:
     ProductQuantizer() {}
@@ -48,15 +54,23 @@ class ProductQuantizer {
     const real* get_centroids(int32_t, uint8_t) const;
 
     real assign_centroid(const real*, const real*, uint8_t*, int32_t) const;
-    void Estep(const real*, const real*, uint8_t*, int32_t, int32_t) const;
-    void MStep(const real*, real*, const uint8_t*, int32_t, int32_t);
-    void kmeans(const real*, real*, int32_t, int32_t);
-    void train(int, const real*);
+    void Estep(const real*, const real*, uint8_t*, int32_t, int32_t,
+               int32_t) const;
+    void MStep(const real*, real*, const uint8_t*, int32_t, int32_t,
+               std::minstd_rand&);
+    void kmeans(const real*, real*, int32_t, int32_t, std::minstd_rand&,
+                int32_t);
+    void train(int, const real*, int32_t nthreads = 1);
 
     real mulcode(const Vector&, const uint8_t*, int32_t, real) const;
+    int32_t table_size() const { return nsubq_ * ksub_; }
+    void compute_table(const real*, real*) const;
+    real mulcode(const real*, const uint8_t*, int32_t, real) const;
+    void mulcodes(const real*, const uint8_t*, int64_t, real*) const;
     void addcode(Vector&, const uint8_t*, int32_t, real) const;
     void compute_code(const real*, uint8_t*)  const;
-    void compute_codes(const real*, uint8_t*, int32_t)  const;
+    void compute_codes(const real*, uint8_t*, int32_t,
+                       int32_t nthreads = 1) const;
 
     void save(std::ostream&);
     void load(std::istream&);
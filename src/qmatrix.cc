@@ -17,7 +17,8 @@ namespace fasttext {
 QMatrix::QMatrix() : qnorm_(false),
   m_(0), n_(0), codesize_(0) {}
 
-QMatrix::QMatrix(const Matrix& mat, int32_t dsub, bool qnorm)
+QMatrix::QMatrix(const Matrix& mat, int32_t dsub, bool qnorm,
+                 int32_t nthreads)
       : qnorm_(qnorm), m_(mat.m_), n_(mat.n_),
         codesize_(m_ * ((n_ + dsub - 1) / dsub)) {
   if (codesize_ > 0) {
@@ -28,25 +29,28 @@ QMatrix::QMatrix(const Matrix& mat, int32_t dsub, bool qnorm)
     norm_codes_ = new uint8_t[m_];
     npq_ = std::unique_ptr<ProductQuantizer>( new ProductQuantizer(1, 1));
   }
-  quantize(mat);
+  quantize(mat, nthreads);
 }
 
 QMatrix::~QMatrix() {
+  if (file_) {
+    return;
+  }
   if (codesize_ > 0) {
     delete[] codes_;
   }
   if (qnorm_) { delete[] norm_codes_; }
 }
 
-void QMatrix::quantizeNorm(const Vector& norms) {
+void QMatrix::quantizeNorm(const Vector& norms, int32_t nthreads) {
   assert(qnorm_);
   assert(norms.m_ == m_);
   auto dataptr = norms.data_;
-  npq_->train(m_, dataptr);
-  npq_->compute_codes(dataptr, norm_codes_, m_);
+  npq_->train(m_, dataptr, nthreads);
+  npq_->compute_codes(dataptr, norm_codes_, m_, nthreads);
 }
 
-void QMatrix::quantize(const Matrix& matrix) {
+void QMatrix::quantize(const Matrix& matrix, int32_t nthreads) {
   assert(n_ == matrix.n_);
   assert(m_ == matrix.m_);
   Matrix temp(matrix);
@@ -54,11 +58,11 @@ void QMatrix::quantize(const Matrix& matrix) {
     Vector norms(temp.m_);
     temp.l2NormRow(norms);
     temp.divideRow(norms);
-    quantizeNorm(norms);
+    quantizeNorm(norms, nthreads);
   }
   auto dataptr = temp.data_;
-  pq_->train(m_, dataptr);
-  pq_->compute_codes(dataptr, codes_, m_);
+  pq_->train(m_, dataptr, nthreads);
+  pq_->compute_codes(dataptr, codes_, m_, nthreads);
 }
 
 void QMatrix::addToVector(Vector& x, int32_t t) const {
@@ -80,6 +84,36 @@ real QMatrix::dotRow(const Vector& vec, int64_t i) const {
   return pq_->mulcode(vec, codes_, i, norm);
 }
 
+// Scores against the same vector share one table of partial products, see
+// ProductQuantizer::compute_table.
+void QMatrix::computeTable(const Vector& vec, std::vector<real>& table) const {
+  assert(vec.size() == n_);
+  table.resize(pq_->table_size());
+  pq_->compute_table(vec.data_, table.data());
+}
+
+real QMatrix::dotRow(const std::vector<real>& table, int64_t i) const {
+  assert(i >= 0);
+  assert(i < m_);
+  real norm = 1;
+  if (qnorm_) {
+    norm = npq_->get_centroids(0, norm_codes_[i])[0];
+  }
+  return pq_->mulcode(table.data(), codes_, i, norm);
+}
+
+// dotRow of every row.
+void QMatrix::dotRows(const std::vector<real>& table, real* y) const {
+  assert(table.size() == pq_->table_size());
+  pq_->mulcodes(table.data(), codes_, m_, y);
+  if (qnorm_) {
+    const real* norms = npq_->get_centroids(0, 0);
+    for (int64_t i = 0; i < m_; i++) {
+      y[i] *= norms[norm_codes_[i]];
+    }
+  }
+}
+
 int64_t QMatrix::getM() const {
   return m_;
 }
@@ -102,17 +136,32 @@ void QMatrix::save(std::ostream& out) {
 }
 
 void QMatrix::load(std::istream& in) {
+    load(in, nullptr);
+}
+
+void QMatrix::load(std::istream& in, std::shared_ptr<utils::MappedFile> file) {
     in.read((char*) &qnorm_, sizeof(qnorm_));
     in.read((char*) &m_, sizeof(m_));
     in.read((char*) &n_, sizeof(n_));
     in.read((char*) &codesize_, sizeof(codesize_));
-    codes_ = new uint8_t[codesize_];
-    in.read((char*) codes_, codesize_ * sizeof(uint8_t));
+    file_ = file;
+    if (file_) {
+      codes_ = (uint8_t*) file_->at(in.tellg(), codesize_);
+      in.seekg(codesize_, std::ios::cur);
+    } else {
+      codes_ = new uint8_t[codesize_];
+      in.read((char*) codes_, codesize_ * sizeof(uint8_t));
+    }
     pq_ = std::unique_ptr<ProductQuantizer>( new ProductQuantizer());
     pq_->load(in);
     if (qnorm_) {
-      norm_codes_ = new uint8_t[m_];
-      in.read((char*) norm_codes_, m_ * sizeof(uint8_t));
+      if (file_) {
+        norm_codes_ = (uint8_t*) file_->at(in.tellg(), m_);
+        in.seekg(m_, std::ios::cur);
+      } else {
+        norm_codes_ = new uint8_t[m_];
+        in.read((char*) norm_codes_, m_ * sizeof(uint8_t));
+      }
       npq_ = std::unique_ptr<ProductQuantizer>( new ProductQuantizer());
       npq_->load(in);
     }
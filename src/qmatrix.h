@@ -23,6 +23,7 @@
 #include "vector.h"
 
 #include "productquantizer.h"
+#include "utils.h"
 
 namespace fasttext {
 
@@ -41,23 +42,30 @@ class QMatrix {
 
     int32_t codesize_;
 
+    // set when codes_ and norm_codes_ point into a mapped model file
+    std::shared_ptr<utils::MappedFile> file_;
+
   public:
 
     QMatrix();
-    QMatrix(const Matrix&, int32_t, bool);
+    QMatrix(const Matrix&, int32_t, bool, int32_t nthreads = 1);
     ~QMatrix();
 
     int64_t getM() const;
     int64_t getN() const;
 
-    void quantizeNorm(const Vector&);
-    void quantize(const Matrix&);
+    void quantizeNorm(const Vector&, int32_t nthreads = 1);
+    void quantize(const Matrix&, int32_t nthreads = 1);
 
     void addToVector(Vector& x, int32_t t) const;
     real dotRow(const Vector&, int64_t) const;
+    void computeTable(const Vector&, std::vector<real>&) const;
+    real dotRow(const std::vector<real>&, int64_t) const;
+    void dotRows(const std::vector<real>&, real*) const;
 
     void save(std::ostream&);
     void load(std::istream&);
+    void load(std::istream&, std::shared_ptr<utils::MappedFile>);
 };
 
 }
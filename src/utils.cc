@@ -9,7 +9,21 @@
 
 #include "utils.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
 #include <ios>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 namespace fasttext {
 
@@ -24,6 +38,124 @@ namespace utils {
     ifs.clear();
     ifs.seekg(std::streampos(pos));
   }
+
+  int64_t seekLine(std::ifstream& ifs, int64_t pos) {
+    if (pos <= 0) {
+      seek(ifs, 0);
+      return 0;
+    }
+    seek(ifs, pos - 1);
+    ifs.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    if (ifs.eof()) {
+      ifs.clear();
+      return size(ifs);
+    }
+    return ifs.tellg();
+  }
+
+  namespace {
+    std::atomic<int64_t> allocations(0);
+  }
+
+  void* alignedAlloc(int64_t bytes) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = nullptr;
+    if (posix_memalign(&p, FASTTEXT_ALIGNMENT, bytes > 0 ? bytes : 1) != 0) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  void alignedFree(void* p) {
+    free(p);
+  }
+
+  int64_t alignedAllocations() {
+    return allocations.load(std::memory_order_relaxed);
+  }
+
+  void pad(std::ostream& out, int64_t alignment) {
+    int64_t pos = out.tellp();
+    for (int64_t i = pos % alignment; i > 0 && i < alignment; i++) {
+      out.put(0);
+    }
+  }
+
+  void skipPad(std::istream& in, int64_t alignment) {
+    int64_t pos = in.tellg();
+    int64_t rem = pos % alignment;
+    if (rem > 0) {
+      in.seekg(alignment - rem, std::ios::cur);
+    }
+  }
+
+  void parallelFor(int64_t n, int32_t threads,
+                   const std::function<void(int64_t, int64_t)>& f) {
+    threads = std::max<int64_t>(1, std::min<int64_t>(threads, n));
+    if (threads == 1) {
+      f(0, n);
+      return;
+    }
+    std::vector<std::thread> pool;
+    for (int32_t i = 0; i < threads; i++) {
+      pool.push_back(std::thread(f, i * n / threads, (i + 1) * n / threads));
+    }
+    for (auto& t : pool) {
+      t.join();
+    }
+  }
+
+  MappedFile::MappedFile(const std::string& filename)
+    : data_(nullptr), size_(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::invalid_argument(filename + " cannot be opened for mapping!");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw std::invalid_argument(filename + " cannot be stat'ed!");
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      // MAP_PRIVATE keeps the pages shared and clean until written; any
+      // write (e.g. fine-tuning a loaded model) only copies the touched page.
+      void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        throw std::invalid_argument(filename + " cannot be mapped!");
+      }
+      data_ = static_cast<char*>(p);
+    }
+    close(fd);
+  }
+
+  MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+  }
+
+  char* MappedFile::at(int64_t offset, int64_t length) const {
+    if (offset < 0 || length < 0 || offset + length > size_) {
+      throw std::invalid_argument("Mapped region is out of the file bounds!");
+    }
+    return data_ + offset;
+  }
+
+  void MappedFile::prefault() const {
+    if (data_ == nullptr) {
+      return;
+    }
+#if defined(MADV_WILLNEED)
+    madvise(data_, size_, MADV_WILLNEED);
+#endif
+    const int64_t page = sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+    for (int64_t i = 0; i < size_; i += page) {
+      sink = sink + data_[i];
+    }
+  }
 }
 
 }
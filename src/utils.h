@@ -10,7 +10,12 @@
 #ifndef FASTTEXT_UTILS_H
 #define FASTTEXT_UTILS_H
 
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
 
 #if defined(__clang__) || defined(__GNUC__)
 # define FASTTEXT_DEPRECATED(msg) __attribute__((__deprecated__(msg)))
@@ -20,12 +25,54 @@
 # define FASTTEXT_DEPRECATED(msg)
 #endif
 
+#define FASTTEXT_PAGE_SIZE 4096
+#define FASTTEXT_ALIGNMENT 64
+
 namespace fasttext {
 
 namespace utils {
 
   int64_t size(std::ifstream&);
   void seek(std::ifstream&, int64_t);
+  // Seeks to the first line starting at or after the offset, and returns
+  // the offset of that line, or the size of the file.
+  int64_t seekLine(std::ifstream&, int64_t);
+
+  // FASTTEXT_ALIGNMENT-byte aligned storage, released with alignedFree.
+  void* alignedAlloc(int64_t);
+  void alignedFree(void*);
+  // number of calls to alignedAlloc so far, in every thread
+  int64_t alignedAllocations();
+
+  // Zero-pads (resp. skips) the stream so that the next byte starts at a
+  // multiple of alignment, relative to the beginning of the stream.
+  void pad(std::ostream&, int64_t);
+  void skipPad(std::istream&, int64_t);
+
+  // Splits [0, n) into one contiguous range per thread and calls f on each.
+  void parallelFor(int64_t, int32_t,
+                   const std::function<void(int64_t, int64_t)>&);
+
+  // Read-only, copy-on-write view of a whole file. Pages are backed by the
+  // page cache, so every process mapping the same model shares them until
+  // one of them writes to a page.
+  class MappedFile {
+    protected:
+      char* data_;
+      int64_t size_;
+
+    public:
+      explicit MappedFile(const std::string&);
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+      ~MappedFile();
+
+      char* data() const { return data_; }
+      int64_t size() const { return size_; }
+      char* at(int64_t, int64_t) const;
+      // reads every page in, so that later accesses do not wait on storage
+      void prefault() const;
+  };
 }
 
 }
@@ -14,24 +14,37 @@
 #include <iomanip>
 #include <cmath>
 
+#include "hmatrix.h"
+#include "kernels.h"
 #include "matrix.h"
 #include "qmatrix.h"
+#include "utils.h"
 
 namespace fasttext {
 
 Vector::Vector(int64_t m) {
   m_ = m;
-  data_ = new real[m];
+  data_ = (real*) utils::alignedAlloc(m * sizeof(real));
 }
 
 Vector::~Vector() {
-  delete[] data_;
+  utils::alignedFree(data_);
 }
 
 int64_t Vector::size() const {
   return m_;
 }
 
+void Vector::resize(int64_t m) {
+  if (m == m_) {
+    return;
+  }
+  real* data = (real*) utils::alignedAlloc(m * sizeof(real));
+  utils::alignedFree(data_);
+  data_ = data;
+  m_ = m;
+}
+
 void Vector::zero() {
   for (int64_t i = 0; i < m_; i++) {
     data_[i] = 0.0;
@@ -70,18 +83,14 @@ void Vector::addRow(const Matrix& A, int64_t i) {
   assert(i >= 0);
   assert(i < A.m_);
   assert(m_ == A.n_);
-  for (int64_t j = 0; j < A.n_; j++) {
-    data_[j] += A.at(i, j);
-  }
+  kernels::axpy(1.0, A.row(i), data_, m_);
 }
 
 void Vector::addRow(const Matrix& A, int64_t i, real a) {
   assert(i >= 0);
   assert(i < A.m_);
   assert(m_ == A.n_);
-  for (int64_t j = 0; j < A.n_; j++) {
-    data_[j] += a * A.at(i, j);
-  }
+  kernels::axpy(a, A.row(i), data_, m_);
 }
 
 void Vector::addRow(const QMatrix& A, int64_t i) {
@@ -89,20 +98,30 @@ void Vector::addRow(const QMatrix& A, int64_t i) {
   A.addToVector(*this, i);
 }
 
+void Vector::addRow(const HMatrix& A, int64_t i) {
+  assert(i >= 0);
+  A.addToVector(*this, i);
+}
+
 void Vector::mul(const Matrix& A, const Vector& vec) {
   assert(A.m_ == m_);
   assert(A.n_ == vec.m_);
-  for (int64_t i = 0; i < m_; i++) {
-    data_[i] = A.dotRow(vec, i);
-  }
+  kernels::gemv(A.data_, A.m_, A.n_, A.stride_, vec.data_, data_);
 }
 
 void Vector::mul(const QMatrix& A, const Vector& vec) {
   assert(A.getM() == m_);
   assert(A.getN() == vec.m_);
-  for (int64_t i = 0; i < m_; i++) {
-    data_[i] = A.dotRow(vec, i);
-  }
+  std::vector<real> table;
+  A.computeTable(vec, table);
+  A.dotRows(table, data_);
+}
+
+void Vector::mul(const HMatrix& A, const Vector& vec) {
+  assert(A.getM() == m_);
+  assert(A.getN() == vec.m_);
+  kernels::gemvHalf(A.data(), A.getM(), A.getN(), A.getN(), vec.data_, data_,
+                    A.isBf16());
 }
 
 int64_t Vector::argmax() {
@@ -19,6 +19,7 @@ namespace fasttext {
 
 class Matrix;
 class QMatrix;
+class HMatrix;
 
 class Vector {
 
@@ -33,6 +34,8 @@ class Vector {
     const real& operator[](int64_t) const;
 
     int64_t size() const;
+    // reallocates the vector with the given size, without keeping its values
+    void resize(int64_t);
     void zero();
     void mul(real);
     real norm() const;
@@ -40,9 +43,11 @@ class Vector {
     void addVector(const Vector&, real);
     void addRow(const Matrix&, int64_t);
     void addRow(const QMatrix&, int64_t);
+    void addRow(const HMatrix&, int64_t);
     void addRow(const Matrix&, int64_t, real);
     void mul(const QMatrix&, const Vector&);
     void mul(const Matrix&, const Vector&);
+    void mul(const HMatrix&, const Vector&);
     int64_t argmax();
 };
 
@@ -0,0 +1,318 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "vectorsfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+namespace fasttext {
+
+namespace {
+
+// rows computed and written at once by save
+const int64_t SAVE_BATCH = 1 << 14;
+
+inline bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Parses the decimal number at p, which moves past it. Up to 7 significant
+// digits and exponents of at most 10, which covers the values written by
+// save, one product or quotient of exact reals rounds correctly; the other
+// numbers go through strtod.
+bool parseReal(const char*& p, const char* end, real& value) {
+  static const real powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10};
+  const char* start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p++ == '-';
+  }
+  int64_t mantissa = 0;
+  int32_t digits = 0, exponent = 0;
+  bool any = false, exact = true;
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    any = true;
+    if (digits < 18) {
+      mantissa = 10 * mantissa + (*p - '0');
+      digits += mantissa > 0;
+    } else {
+      exponent++;
+      exact = false;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      any = true;
+      if (digits < 18) {
+        mantissa = 10 * mantissa + (*p - '0');
+        digits += mantissa > 0;
+        exponent--;
+      } else {
+        exact = false;
+      }
+    }
+  }
+  if (any && p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool negativeExp = false;
+    if (q < end && (*q == '-' || *q == '+')) {
+      negativeExp = *q++ == '-';
+    }
+    if (q < end && *q >= '0' && *q <= '9') {
+      int32_t e = 0;
+      for (; q < end && *q >= '0' && *q <= '9'; q++) {
+        e = std::min(10 * e + (*q - '0'), 100000);
+      }
+      exponent += negativeExp ? -e : e;
+      p = q;
+    }
+  }
+  if (any && exact && mantissa < (1 << 24) && exponent >= -10 &&
+      exponent <= 10) {
+    value = exponent < 0 ? real(mantissa) / powers[-exponent] :
+      real(mantissa) * powers[exponent];
+    value = negative ? -value : value;
+    return true;
+  }
+  // rare or special numbers (nan, inf)
+  while (p < end && !isBlank(*p) && *p != '\n') {
+    p++;
+  }
+  const std::string token(start, p);
+  char* last;
+  value = std::strtod(token.c_str(), &last);
+  return !token.empty() && *last == '\0';
+}
+
+}
+
+VectorsFile::VectorsFile(const std::string& filename, int32_t threads)
+    : dim_(0), rows_(nullptr) {
+  file_ = std::make_shared<utils::MappedFile>(filename);
+  if (isBinary(filename)) {
+    readBinary(filename);
+  } else {
+    readText(filename, threads);
+  }
+}
+
+bool VectorsFile::isBinary(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  int32_t magic = 0;
+  ifs.read((char*) &magic, sizeof(int32_t));
+  return ifs.good() && magic == FASTTEXT_VECTORS_MAGIC_INT32;
+}
+
+void VectorsFile::readBinary(const std::string& filename) {
+  const char* p = file_->at(0, 2 * sizeof(int32_t) + 2 * sizeof(int64_t));
+  int32_t version;
+  int64_t n;
+  std::memcpy(&version, p + sizeof(int32_t), sizeof(int32_t));
+  std::memcpy(&n, p + 2 * sizeof(int32_t), sizeof(int64_t));
+  std::memcpy(&dim_, p + 2 * sizeof(int32_t) + sizeof(int64_t),
+              sizeof(int64_t));
+  if (version != FASTTEXT_VECTORS_VERSION || n < 0 || dim_ < 0) {
+    throw std::invalid_argument(
+        filename + " has an unsupported vectors format!");
+  }
+  int64_t pos = 2 * sizeof(int32_t) + 2 * sizeof(int64_t);
+  const char* end = file_->data() + file_->size();
+  words_.reserve(n);
+  for (int64_t i = 0; i < n; i++) {
+    const char* word = file_->data() + pos;
+    const char* nul = static_cast<const char*>(
+        std::memchr(word, '\0', end - word));
+    if (nul == nullptr) {
+      throw std::invalid_argument(filename + " is truncated!");
+    }
+    words_.emplace_back(word, nul);
+    pos += nul - word + 1;
+  }
+  pos += (FASTTEXT_PAGE_SIZE - pos % FASTTEXT_PAGE_SIZE) % FASTTEXT_PAGE_SIZE;
+  rows_ = reinterpret_cast<const real*>(
+      file_->at(pos, n * dim_ * sizeof(real)));
+}
+
+// Finds the word of every line, the threads taking contiguous parts of the
+// file; their values are only parsed by read.
+void VectorsFile::readText(const std::string& filename, int32_t threads) {
+  const char* data = file_->data();
+  const char* end = data + file_->size();
+  const char* body = data == nullptr ? nullptr :
+    static_cast<const char*>(std::memchr(data, '\n', end - data));
+  const std::string header(data, body == nullptr ? data : body);
+  char* last;
+  const int64_t n = std::strtoll(header.c_str(), &last, 10);
+  dim_ = std::strtoll(last, &last, 10);
+  if (last == header.c_str() || n < 0 || dim_ <= 0 || body == nullptr) {
+    throw std::invalid_argument(
+        filename + " does not start with the number of vectors and their "
+        "dimension!");
+  }
+  body++;
+  const int64_t length = end - body;
+  std::vector<std::vector<std::string>> words(threads);
+  std::vector<std::vector<int64_t>> offsets(threads);
+  utils::parallelFor(threads, threads, [&](int64_t ib, int64_t ie) {
+    for (int64_t t = ib; t < ie; t++) {
+      // the lines that start in [t, t + 1) * length / threads
+      const char* p = body + t * length / threads;
+      const char* stop = body + (t + 1) * length / threads;
+      if (p > body && p[-1] != '\n') {
+        p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        p = p == nullptr ? end : p + 1;
+      }
+      while (p < stop) {
+        while (p < end && isBlank(*p)) {
+          p++;
+        }
+        const char* word = p;
+        while (p < end && !isBlank(*p) && *p != '\n') {
+          p++;
+        }
+        if (p > word) {
+          words[t].emplace_back(word, p);
+          offsets[t].push_back(p - data);
+        }
+        p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        p = p == nullptr ? end : p + 1;
+      }
+    }
+  });
+  words_.reserve(n);
+  offsets_.reserve(n);
+  for (int32_t t = 0; t < threads && size() < n; t++) {
+    for (size_t i = 0; i < words[t].size() && size() < n; i++) {
+      words_.push_back(std::move(words[t][i]));
+      offsets_.push_back(offsets[t][i]);
+    }
+  }
+  if (size() < n) {
+    throw std::invalid_argument(
+        filename + " holds fewer vectors than its header says!");
+  }
+}
+
+void VectorsFile::parseRow(int64_t i, real* values) const {
+  const char* p = file_->data() + offsets_[i];
+  const char* end = file_->data() + file_->size();
+  for (int64_t j = 0; j < dim_; j++) {
+    while (p < end && isBlank(*p)) {
+      p++;
+    }
+    if (p == end || *p == '\n' || !parseReal(p, end, values[j])) {
+      throw std::invalid_argument(
+          "The vector of " + words_[i] + " does not have " +
+          std::to_string(dim_) + " values!");
+    }
+  }
+}
+
+// Copies row i into dest(i), for the rows where dest is not null.
+void VectorsFile::read(const std::function<real*(int64_t)>& dest,
+                       int32_t threads) const {
+  std::mutex mutex;
+  std::string error;
+  utils::parallelFor(size(), threads, [&](int64_t ib, int64_t ie) {
+    try {
+      for (int64_t i = ib; i < ie; i++) {
+        real* values = dest(i);
+        if (values == nullptr) {
+          continue;
+        }
+        if (rows_ != nullptr) {
+          std::memcpy(values, rows_ + i * dim_, dim_ * sizeof(real));
+        } else {
+          parseRow(i, values);
+        }
+      }
+    } catch (const std::invalid_argument& e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = e.what();
+    }
+  });
+  if (!error.empty()) {
+    throw std::invalid_argument(error);
+  }
+}
+
+// Writes the vectors of words, row(i, vec) giving the one of words[i]. The
+// rows are computed, and formatted for text, by batches shared between the
+// threads.
+void VectorsFile::save(const std::string& filename,
+                       const std::vector<std::string>& words, int64_t dim,
+                       const std::function<void(int64_t, Vector&)>& row,
+                       bool binary, int32_t threads) {
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving!");
+  }
+  const int64_t n = words.size();
+  if (binary) {
+    const int32_t magic = FASTTEXT_VECTORS_MAGIC_INT32;
+    const int32_t version = FASTTEXT_VECTORS_VERSION;
+    ofs.write((char*) &magic, sizeof(int32_t));
+    ofs.write((char*) &version, sizeof(int32_t));
+    ofs.write((char*) &n, sizeof(int64_t));
+    ofs.write((char*) &dim, sizeof(int64_t));
+    for (const auto& word : words) {
+      ofs.write(word.data(), word.size() * sizeof(char));
+      ofs.put(0);
+    }
+    utils::pad(ofs, FASTTEXT_PAGE_SIZE);
+  } else {
+    ofs << n << " " << dim << "\n";
+  }
+  std::vector<real> values(binary ? SAVE_BATCH * dim : 0);
+  std::vector<std::string> lines(binary ? 0 : SAVE_BATCH);
+  for (int64_t b = 0; b < n; b += SAVE_BATCH) {
+    const int64_t e = std::min(b + SAVE_BATCH, n);
+    utils::parallelFor(e - b, threads, [&](int64_t ib, int64_t ie) {
+      Vector vec(dim);
+      char number[32];
+      for (int64_t i = ib; i < ie; i++) {
+        row(b + i, vec);
+        if (binary) {
+          std::copy(vec.data_, vec.data_ + dim, values.data() + i * dim);
+          continue;
+        }
+        // the format of operator<< on a Vector, without the stream
+        std::string& line = lines[i];
+        line.assign(words[b + i]);
+        line.push_back(' ');
+        for (int64_t j = 0; j < dim; j++) {
+          const int len = std::snprintf(number, sizeof(number), "%.5g",
+                                        vec.data_[j]);
+          line.append(number, len);
+          line.push_back(' ');
+        }
+        line.push_back('\n');
+      }
+    });
+    if (binary) {
+      ofs.write((char*) values.data(), (e - b) * dim * sizeof(real));
+    } else {
+      for (int64_t i = 0; i < e - b; i++) {
+        ofs.write(lines[i].data(), lines[i].size());
+      }
+    }
+  }
+  if (!ofs) {
+    throw std::invalid_argument(filename + " could not be written!");
+  }
+}
+
+}
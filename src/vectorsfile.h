@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_VECTORSFILE_H
+#define FASTTEXT_VECTORSFILE_H
+
+#define FASTTEXT_VECTORS_VERSION 1
+#define FASTTEXT_VECTORS_MAGIC_INT32 793712316
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "real.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace fasttext {
+
+// Word vectors, either as text (the .vec format: an "n dim" line, then one
+// line per word and its values) or in a binary format: a header, the words
+// as null-terminated strings, then the rows as raw reals from a page
+// boundary. Both are memory-mapped when read. Text files are split between
+// threads at line boundaries, and their values are parsed without going
+// through iostreams.
+class VectorsFile {
+  protected:
+    std::shared_ptr<utils::MappedFile> file_;
+    int64_t dim_;
+    std::vector<std::string> words_;
+    // text: offset of the values of each row
+    std::vector<int64_t> offsets_;
+    // binary: the rows, one after the other
+    const real* rows_;
+
+    void readText(const std::string&, int32_t);
+    void readBinary(const std::string&);
+    void parseRow(int64_t, real*) const;
+
+  public:
+    VectorsFile(const std::string&, int32_t);
+
+    static bool isBinary(const std::string&);
+    static void save(const std::string&, const std::vector<std::string>&,
+                     int64_t, const std::function<void(int64_t, Vector&)>&,
+                     bool, int32_t);
+
+    int64_t size() const { return words_.size(); }
+    int64_t dim() const { return dim_; }
+    const std::vector<std::string>& words() const { return words_; }
+    void read(const std::function<real*(int64_t)>&, int32_t) const;
+};
+
+}
+
+#endif